@@ -0,0 +1,209 @@
+#include <SDL/SDL.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+#include "ring.h"
+
+const uint32_t AUDIO_RING_SAMPLES = 8192u;                    // ~185 ms
+const uint32_t AUDIO_MAX_QUEUED = AUDIO_SAMPLES_PER_FRAME * 4; // keep latency to a few frames
+const uint16_t AUDIO_DEVICE_SAMPLES = 512u;
+const double BEEP_FREQUENCY = 440.0;
+const int16_t BEEP_VOLUME = 3000;
+
+struct Chip8Audio
+{
+    Chip8AudioBackend backend;
+    Chip8Ring ring;
+    SDL_AudioDeviceID device;
+    SDL_atomic_t underruns;
+    FILE *wav;
+    uint32_t wavSamples;
+    double phase; // position in the waveform, in cycles (beep) or pattern bits (XO-CHIP)
+};
+
+// device callback: runs on SDL's audio thread and must never block
+static void audioCallback(void *userdata, uint8_t *stream, int len)
+{
+    Chip8Audio *audio = userdata;
+    uint32_t wanted = (uint32_t)len / sizeof(int16_t);
+    uint32_t got = PopChip8Ring(&audio->ring, stream, wanted);
+    if (got < wanted)
+    {
+        memset(stream + got * sizeof(int16_t), 0, (wanted - got) * sizeof(int16_t));
+        SDL_AtomicAdd(&audio->underruns, 1);
+    }
+}
+
+static void writeLE(FILE *file, uint32_t value, int bytes)
+{
+    for (int b = 0; b < bytes; ++b)
+    {
+        fputc((value >> (b * 8)) & 0xFF, file);
+    }
+}
+
+// RIFF header for 16-bit mono PCM; the sizes are patched in on close
+static void writeWavHeader(FILE *file, uint32_t samples)
+{
+    uint32_t dataBytes = samples * sizeof(int16_t);
+    fwrite("RIFF", 1, 4, file);
+    writeLE(file, 36 + dataBytes, 4);
+    fwrite("WAVEfmt ", 1, 8, file);
+    writeLE(file, 16, 4);                                   // fmt chunk size
+    writeLE(file, 1, 2);                                    // PCM
+    writeLE(file, 1, 2);                                    // mono
+    writeLE(file, AUDIO_SAMPLE_RATE, 4);                    // sample rate
+    writeLE(file, AUDIO_SAMPLE_RATE * sizeof(int16_t), 4);  // byte rate
+    writeLE(file, sizeof(int16_t), 2);                      // block align
+    writeLE(file, 16, 2);                                   // bits per sample
+    fwrite("data", 1, 4, file);
+    writeLE(file, dataBytes, 4);
+}
+
+Chip8Audio *OpenChip8Audio(Chip8AudioBackend backend, const char *path)
+{
+    Chip8Audio *audio = calloc(sizeof(Chip8Audio), 1);
+    if (!audio)
+    {
+        return NULL;
+    }
+    audio->backend = backend;
+
+    if (backend != CHIP8_AUDIO_NULL && !InitChip8Ring(&audio->ring, sizeof(int16_t), AUDIO_RING_SAMPLES))
+    {
+        free(audio);
+        return NULL;
+    }
+
+    if (backend == CHIP8_AUDIO_SDL)
+    {
+        SDL_AudioSpec want, have;
+        memset(&want, 0, sizeof(want));
+        want.freq = AUDIO_SAMPLE_RATE;
+        want.format = AUDIO_S16SYS;
+        want.channels = 1;
+        want.samples = AUDIO_DEVICE_SAMPLES;
+        want.callback = audioCallback;
+        want.userdata = audio;
+
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0 ||
+            !(audio->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0)))
+        {
+            printf("SDL failed to open audio: %s\n", SDL_GetError());
+            FreeChip8Ring(&audio->ring);
+            free(audio);
+            return NULL;
+        }
+        SDL_PauseAudioDevice(audio->device, 0);
+    }
+    else if (backend == CHIP8_AUDIO_WAV)
+    {
+        audio->wav = fopen(path, "wb");
+        if (!audio->wav)
+        {
+            printf("ERROR: Couldn't open %s\n", path);
+            FreeChip8Ring(&audio->ring);
+            free(audio);
+            return NULL;
+        }
+        writeWavHeader(audio->wav, 0);
+    }
+
+    return audio;
+}
+
+void CloseChip8Audio(Chip8Audio *audio)
+{
+    if (!audio)
+    {
+        return;
+    }
+
+    if (audio->backend == CHIP8_AUDIO_SDL)
+    {
+        SDL_CloseAudioDevice(audio->device);
+    }
+    else if (audio->backend == CHIP8_AUDIO_WAV)
+    {
+        fseek(audio->wav, 0L, SEEK_SET);
+        writeWavHeader(audio->wav, audio->wavSamples);
+        fclose(audio->wav);
+    }
+
+    if (audio->backend != CHIP8_AUDIO_NULL)
+    {
+        FreeChip8Ring(&audio->ring);
+    }
+    free(audio);
+}
+
+// next sample of output; beeps a square wave, or plays the 128-bit pattern on XO-CHIP
+static int16_t nextSample(Chip8Audio *audio, const Chip8State *state)
+{
+    if (!state->sound)
+    {
+        return 0;
+    }
+
+    if (state->profile == CHIP8_PROFILE_XOCHIP)
+    {
+        // the pattern plays at 4000 * 2^((pitch - 64) / 48) bits per second
+        double rate = 4000.0 * pow(2.0, (state->pitch - 64) / 48.0);
+        uint32_t bit = (uint32_t)audio->phase & 127;
+        audio->phase = fmod(audio->phase + rate / AUDIO_SAMPLE_RATE, 128.0);
+        return (state->audioPattern[bit >> 3] >> (7 - (bit & 7))) & 1 ? BEEP_VOLUME : -BEEP_VOLUME;
+    }
+
+    audio->phase = fmod(audio->phase + BEEP_FREQUENCY / AUDIO_SAMPLE_RATE, 1.0);
+    return audio->phase < 0.5 ? BEEP_VOLUME : -BEEP_VOLUME;
+}
+
+void QueueChip8Audio(Chip8Audio *audio, const Chip8State *state, uint32_t samples)
+{
+    if (!audio || audio->backend == CHIP8_AUDIO_NULL)
+    {
+        return;
+    }
+
+    // don't let the queue (and so the latency) grow past a few frames; drop instead
+    uint32_t queued = Chip8RingCount(&audio->ring);
+    if (audio->backend == CHIP8_AUDIO_SDL && queued + samples > AUDIO_MAX_QUEUED)
+    {
+        samples = queued < AUDIO_MAX_QUEUED ? AUDIO_MAX_QUEUED - queued : 0;
+    }
+
+    int16_t chunk[256];
+    while (samples)
+    {
+        uint32_t count = samples < 256 ? samples : 256;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            chunk[i] = nextSample(audio, state);
+        }
+        PushChip8Ring(&audio->ring, chunk, count);
+        samples -= count;
+
+        if (audio->backend == CHIP8_AUDIO_WAV)
+        {
+            // headless: be our own consumer
+            uint32_t got;
+            while ((got = PopChip8Ring(&audio->ring, chunk, 256)))
+            {
+                for (uint32_t i = 0; i < got; ++i)
+                {
+                    writeLE(audio->wav, (uint16_t)chunk[i], 2);
+                }
+                audio->wavSamples += got;
+            }
+        }
+    }
+}
+
+uint32_t Chip8AudioUnderruns(Chip8Audio *audio)
+{
+    return audio ? (uint32_t)SDL_AtomicGet(&audio->underruns) : 0;
+}
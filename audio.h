@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+#define AUDIO_SAMPLE_RATE 44100u
+#define AUDIO_SAMPLES_PER_FRAME (AUDIO_SAMPLE_RATE / 60u) // one 60 Hz timer tick
+
+typedef enum Chip8AudioBackend
+{
+    CHIP8_AUDIO_NULL, // generate nothing
+    CHIP8_AUDIO_SDL,  // play through the default SDL audio device
+    CHIP8_AUDIO_WAV,  // write a 16-bit mono .wav file, for headless runs
+} Chip8AudioBackend;
+
+typedef struct Chip8Audio Chip8Audio;
+
+/**
+ * Audio output
+ * The emulation thread calls QueueChip8Audio to turn the sound timer (and
+ *  the XO-CHIP pattern and pitch) into samples, which go through a
+ *  lock-free ring to the backend. The SDL callback only ever pops from the
+ *  ring and pads with silence if it runs dry, and the producer drops
+ *  samples rather than wait if the ring is full, so neither side blocks.
+ * path is the output file for CHIP8_AUDIO_WAV and ignored otherwise.
+ * Returns NULL if the backend couldn't be opened.
+ */
+Chip8Audio *OpenChip8Audio(Chip8AudioBackend backend, const char *path);
+void CloseChip8Audio(Chip8Audio *audio);
+
+// generate the next `samples` samples of output for the machine's current sound state
+void QueueChip8Audio(Chip8Audio *audio, const Chip8State *state, uint32_t samples);
+
+// number of times the device asked for samples the ring didn't have
+uint32_t Chip8AudioUnderruns(Chip8Audio *audio);
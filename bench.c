@@ -0,0 +1,177 @@
+#include <SDL/SDL.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "render.h"
+#include "tools.h"
+
+const uint32_t BENCH_DEFAULT_INSTRUCTIONS = 50000000u;
+const uint32_t BENCH_RENDER_FRAMES = 500u;
+const uint32_t BENCH_DEFAULT_RENDER_SCALE = 8u; // the window's 1024x512
+
+// run a ROM for a fixed number of instructions and return nanoseconds per instruction
+static double timeCore(const char *rom, Chip8Profile profile, Chip8Emulator emulate, uint32_t instructions)
+{
+    Chip8Image *image = LoadChip8Image(profile, rom);
+    if (!image)
+    {
+        printf("ERROR: Couldn't open %s\n", rom);
+        exit(2);
+    }
+    Chip8State *state = InitChip8(image);
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (uint32_t i = 0; i < instructions; ++i)
+    {
+        emulate(state);
+    }
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+
+    DestroyChip8(state);
+    DestroyChip8Image(image);
+
+    return (double)elapsed * 1e9 / (double)SDL_GetPerformanceFrequency() / (double)instructions;
+}
+
+#include "bench_baseline.inc"
+
+// the same for the baseline core, on the default profile's image
+static double timeBaseline(const char *rom, uint32_t instructions)
+{
+    Chip8Image *image = LoadChip8Image(CHIP8_PROFILE_DEFAULT, rom);
+    if (!image)
+    {
+        printf("ERROR: Couldn't open %s\n", rom);
+        exit(2);
+    }
+    BaselineState *state = InitBaseline(image);
+    if (!state)
+    {
+        printf("ERROR: Out of memory\n");
+        exit(3);
+    }
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (uint32_t i = 0; i < instructions; ++i)
+    {
+        EmulateBaseline(state);
+    }
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+
+    DestroyBaseline(state);
+    DestroyChip8Image(image);
+
+    return (double)elapsed * 1e9 / (double)SDL_GetPerformanceFrequency() / (double)instructions;
+}
+
+// microseconds to render a frame the size of a 128x64 display at scale
+static double timeRender(Chip8Renderer *renderer, const Chip8Frame *frame, uint32_t scale, uint32_t *pixels)
+{
+    uint32_t frameScale = frame->hires ? scale : scale * 2;
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (uint32_t f = 0; f < BENCH_RENDER_FRAMES; ++f)
+    {
+        RenderChip8Frame(renderer, frame, frameScale, pixels, HIRES_WIDTH * scale * sizeof(uint32_t));
+    }
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+    return (double)elapsed * 1e6 / (double)SDL_GetPerformanceFrequency() / (double)BENCH_RENDER_FRAMES;
+}
+
+// time the software renderer on each path it can use, with and without smoothing
+static int benchRender(uint32_t scale)
+{
+    static const char *const PATH_NAMES[CHIP8_RENDER_PATH_COUNT] = {"scalar", "sse2", "avx2"};
+    static const char *const SMOOTHING_NAMES[CHIP8_SMOOTH_COUNT] = {"none", "scale2x", "scale3x"};
+    static const char *const FRAME_NAMES[3] = {"lores", "hires", "hires 2 planes"};
+    const uint32_t palette[4] = {0xFF6495ED, 0xFF2051A9, 0xFFB0C8F5, 0xFF10285A};
+
+    // noise, so every byte of the lookup tables and every colour gets used
+    Chip8Frame *frames = calloc(sizeof(Chip8Frame), 3);
+    uint32_t *pixels = malloc((size_t)HIRES_WIDTH * HIRES_HEIGHT * scale * scale * sizeof(uint32_t));
+    Chip8Renderer *renderer = malloc(sizeof(Chip8Renderer));
+    if (!frames || !pixels || !renderer)
+    {
+        printf("ERROR: Out of memory\n");
+        return 3;
+    }
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    for (int f = 0; f < 3; ++f)
+    {
+        frames[f].hires = f > 0;
+        for (uint32_t y = 0; y < HIRES_HEIGHT; ++y)
+        {
+            for (uint32_t w = 0; w < 2; ++w)
+            {
+                seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                frames[f].display[0][y][w] = seed;
+                frames[f].display[1][y][w] = f == 2 ? seed * 0xff51afd7ed558ccdull : 0;
+            }
+        }
+    }
+
+    printf("%ux%u\n%-16s %-8s %-8s %10s\n", HIRES_WIDTH * scale, HIRES_HEIGHT * scale, "frame", "path", "smooth", "us/frame");
+    Chip8RenderPath best = Chip8BestRenderPath();
+    for (int s = 0; s < CHIP8_SMOOTH_COUNT; ++s)
+    {
+        InitChip8Renderer(renderer, palette, (Chip8Smoothing)s);
+        for (int f = 0; f < 3; ++f)
+        {
+            for (int p = 0; p <= (int)best; ++p)
+            {
+                renderer->path = (Chip8RenderPath)p;
+                printf("%-16s %-8s %-8s %10.1f\n", FRAME_NAMES[f], PATH_NAMES[p], SMOOTHING_NAMES[s], timeRender(renderer, &frames[f], scale, pixels));
+            }
+        }
+        FreeChip8Renderer(renderer);
+    }
+
+    free(renderer);
+    free(pixels);
+    free(frames);
+    return 0;
+}
+
+/**
+ * Times every specialised core on the same ROM, plus EmulateChip8 itself
+ *  (which looks the core up through the profile table on each call) and
+ *  the single core they replaced (see bench_baseline.inc) for reference
+ * With --render, times the software renderer instead: microseconds per
+ *  frame at a scale (pixels per high resolution pixel)
+ * usage: bench <rom> [instructions] | bench --render [scale]
+ */
+int bench_main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: bench <rom> [instructions] | bench --render [scale]\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "--render") == 0)
+    {
+        uint32_t scale = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : BENCH_DEFAULT_RENDER_SCALE;
+        return benchRender(scale ? scale : BENCH_DEFAULT_RENDER_SCALE);
+    }
+
+    uint32_t instructions = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : BENCH_DEFAULT_INSTRUCTIONS;
+    if (!instructions)
+    {
+        instructions = BENCH_DEFAULT_INSTRUCTIONS;
+    }
+
+    printf("%-16s %10s %10s\n", "core", "ns/instr", "MIPS");
+    for (int p = 0; p < CHIP8_PROFILE_COUNT; ++p)
+    {
+        double ns = timeCore(argv[1], (Chip8Profile)p, GetChip8Emulator((Chip8Profile)p), instructions);
+        printf("%-16s %10.2f %10.1f\n", Chip8ProfileName((Chip8Profile)p), ns, 1000.0 / ns);
+    }
+    double ns = timeCore(argv[1], CHIP8_PROFILE_DEFAULT, EmulateChip8, instructions);
+    printf("%-16s %10.2f %10.1f\n", "EmulateChip8", ns, 1000.0 / ns);
+    ns = timeBaseline(argv[1], instructions);
+    printf("%-16s %10.2f %10.1f\n", "baseline", ns, 1000.0 / ns);
+
+    return 0;
+}
@@ -0,0 +1,686 @@
+#include "capture.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CAPTURE_WIDTH HIRES_WIDTH
+#define CAPTURE_HEIGHT HIRES_HEIGHT
+
+// the writer's working state for one recording
+typedef struct Encoder
+{
+    Chip8Capture *capture;
+    FILE *file;        // Y4M and GIF
+    uint32_t width;    // canvas size after scaling
+    uint32_t height;
+    uint8_t *pixels;   // palette index per canvas pixel
+    uint8_t *yuv;      // Y4M: the last frame converted, Y then U then V
+    uint32_t written;  // frames written (Y4M/GIF: counting repeats)
+    uint32_t centiseconds; // GIF: delay written so far
+    uint16_t (*children)[4]; // GIF: LZW dictionary as a trie, 4 children per code
+} Encoder;
+
+Chip8CaptureFormat Chip8CaptureFormatFromPath(const char *path)
+{
+    const char *extension = strrchr(path, '.');
+    if (!extension)
+        return CHIP8_CAPTURE_FORMAT_COUNT;
+    if (strcmp(extension, ".y4m") == 0)
+        return CHIP8_CAPTURE_Y4M;
+    if (strcmp(extension, ".gif") == 0)
+        return CHIP8_CAPTURE_GIF;
+    if (strcmp(extension, ".png") == 0)
+        return CHIP8_CAPTURE_PNG;
+    return CHIP8_CAPTURE_FORMAT_COUNT;
+}
+
+// words of one plane in use for a resolution: word 0 of 32 rows, or both words of 64
+static uint32_t frameWords(uint8_t hires)
+{
+    return hires ? HIRES_HEIGHT * 2 : DISPLAY_HEIGHT;
+}
+
+// palette indices for the whole canvas; low resolution pixels are drawn twice as big
+static void expandFrame(Encoder *encoder, const Chip8CaptureFrame *frame)
+{
+    uint32_t scale = encoder->capture->scale;
+    uint32_t size = frame->hires ? scale : scale * 2; // canvas pixels per CHIP-8 pixel
+    uint32_t width = frame->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+    uint32_t height = frame->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        uint8_t *line = encoder->pixels + (size_t)y * size * encoder->width;
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            uint32_t word = frame->hires ? y * 2 + (x >> 6) : y;
+            uint32_t bit = 63 - (x & 63);
+            uint8_t index = (uint8_t)(((frame->words[0][word] >> bit) & 1) | (((frame->words[1][word] >> bit) & 1) << 1));
+            memset(line + x * size, index, size);
+        }
+        // the rest of this pixel's rows are the same
+        for (uint32_t Y = 1; Y < size; ++Y)
+        {
+            memcpy(line + (size_t)Y * encoder->width, line, encoder->width);
+        }
+    }
+}
+
+/**
+ * Y4M
+ * A header and then every frame's planes as they are; a frame that lasts
+ *  several ticks is written that many times, so the video plays at 60 fps.
+ */
+static void writeY4mHeader(Encoder *encoder)
+{
+    fprintf(encoder->file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", encoder->width, encoder->height, CAPTURE_FPS);
+}
+
+static void writeY4mFrame(Encoder *encoder, uint32_t repeats)
+{
+    // BT.601 studio range, once per colour rather than per pixel
+    uint8_t yuv[4][3];
+    for (int c = 0; c < 4; ++c)
+    {
+        int r = (encoder->capture->palette[c] >> 16) & 0xff;
+        int g = (encoder->capture->palette[c] >> 8) & 0xff;
+        int b = encoder->capture->palette[c] & 0xff;
+        yuv[c][0] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        yuv[c][1] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        yuv[c][2] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+
+    size_t area = (size_t)encoder->width * encoder->height;
+    for (size_t p = 0; p < area; ++p)
+    {
+        const uint8_t *colour = yuv[encoder->pixels[p]];
+        encoder->yuv[p] = colour[0];
+        encoder->yuv[area + p] = colour[1];
+        encoder->yuv[area * 2 + p] = colour[2];
+    }
+
+    for (uint32_t r = 0; r < repeats; ++r)
+    {
+        fputs("FRAME\n", encoder->file);
+        fwrite(encoder->yuv, 1, area * 3, encoder->file);
+    }
+    encoder->written += repeats;
+}
+
+/**
+ * GIF
+ * A 4-colour global palette, then each frame as a full image with its
+ *  duration as the delay. Delays are in hundredths of a second, which 60
+ *  fps doesn't divide, so each is rounded against the running total to
+ *  keep the animation in time.
+ */
+static void writeLe16(FILE *file, uint32_t value)
+{
+    fputc(value & 0xff, file);
+    fputc((value >> 8) & 0xff, file);
+}
+
+static void writeGifHeader(Encoder *encoder)
+{
+    FILE *file = encoder->file;
+    fwrite("GIF89a", 1, 6, file);
+    writeLe16(file, encoder->width);
+    writeLe16(file, encoder->height);
+    fputc(0x80 | (1 << 4) | 1, file); // global palette of 4 colours, 2 bits each
+    fputc(0, file);                   // background colour
+    fputc(0, file);                   // square pixels
+    for (int c = 0; c < 4; ++c)
+    {
+        uint32_t colour = encoder->capture->palette[c];
+        fputc((colour >> 16) & 0xff, file);
+        fputc((colour >> 8) & 0xff, file);
+        fputc(colour & 0xff, file);
+    }
+
+    // loop forever
+    fwrite("\x21\xff\x0bNETSCAPE2.0\x03\x01\x00\x00\x00", 1, 19, file);
+}
+
+// LZW codes packed least significant bit first into 255-byte sub-blocks
+typedef struct GifBits
+{
+    FILE *file;
+    uint32_t bits;
+    int count;
+    uint8_t block[255];
+    int blockSize;
+    // a decoder's view of the stream, to check every code is as wide as it will be read
+    uint32_t decoderNext; // the code its next dictionary entry will get
+    int decoderSize;
+    int decoderCleared;   // the next code follows a CLEAR, so adds no entry
+} GifBits;
+
+static void gifFlushBlock(GifBits *out)
+{
+    if (out->blockSize)
+    {
+        fputc(out->blockSize, out->file);
+        fwrite(out->block, 1, out->blockSize, out->file);
+        out->blockSize = 0;
+    }
+}
+
+static void gifBits(GifBits *out, uint32_t code, int size)
+{
+    out->bits |= code << out->count;
+    out->count += size;
+    while (out->count >= 8)
+    {
+        out->block[out->blockSize++] = out->bits & 0xff;
+        out->bits >>= 8;
+        out->count -= 8;
+        if (out->blockSize == 255)
+        {
+            gifFlushBlock(out);
+        }
+    }
+}
+
+// write a code of LZW over 2-bit pixels, checking (in debug builds) that a decoder would read it at this size
+static void gifCode(GifBits *out, uint32_t code, int size)
+{
+    enum { CLEAR = 4, END = 5 };
+    assert(size == out->decoderSize);
+    gifBits(out, code, size);
+    if (code == CLEAR)
+    {
+        out->decoderNext = END + 1;
+        out->decoderSize = 3;
+        out->decoderCleared = 1;
+    }
+    else if (code != END)
+    {
+        // a decoder adds an entry for every code but the first after a CLEAR, then widens if it's run out
+        out->decoderNext += !out->decoderCleared;
+        out->decoderCleared = 0;
+        if (out->decoderNext == (1u << out->decoderSize) && out->decoderSize < 12)
+        {
+            ++out->decoderSize;
+        }
+    }
+}
+
+static void writeGifFrame(Encoder *encoder, uint32_t repeats)
+{
+    FILE *file = encoder->file;
+    encoder->written += repeats;
+    uint32_t until = (encoder->written * 100 + CAPTURE_FPS / 2) / CAPTURE_FPS;
+    uint32_t delay = until - encoder->centiseconds;
+    encoder->centiseconds = until;
+
+    // graphic control: no transparency, the delay
+    fwrite("\x21\xf9\x04\x00", 1, 4, file);
+    writeLe16(file, delay);
+    fputc(0, file);
+    fputc(0, file);
+
+    // image descriptor: the whole canvas, global palette
+    fputc(0x2c, file);
+    writeLe16(file, 0);
+    writeLe16(file, 0);
+    writeLe16(file, encoder->width);
+    writeLe16(file, encoder->height);
+    fputc(0, file);
+
+    // LZW over 2-bit pixels
+    enum { MIN_CODE_SIZE = 2, CLEAR = 4, END = 5, MAX_CODE = 4095 };
+    uint16_t(*children)[4] = encoder->children;
+    size_t dictionarySize = (MAX_CODE + 1) * sizeof(children[0]);
+    memset(children, 0, dictionarySize);
+    int codeSize = MIN_CODE_SIZE + 1;
+    uint32_t maxCode = END;
+    GifBits out = {file, 0, 0, {0}, 0, END + 1, codeSize, 1};
+
+    fputc(MIN_CODE_SIZE, file);
+    gifCode(&out, CLEAR, codeSize);
+    size_t area = (size_t)encoder->width * encoder->height;
+    uint32_t current = encoder->pixels[0];
+    for (size_t p = 1; p < area; ++p)
+    {
+        uint8_t next = encoder->pixels[p];
+        if (children[current][next])
+        {
+            current = children[current][next];
+            continue;
+        }
+
+        gifCode(&out, current, codeSize);
+        children[current][next] = (uint16_t)++maxCode;
+        if (maxCode >= (1u << codeSize))
+        {
+            ++codeSize;
+        }
+        if (maxCode == MAX_CODE)
+        {
+            // dictionary full: start again
+            gifCode(&out, CLEAR, codeSize);
+            memset(children, 0, dictionarySize);
+            codeSize = MIN_CODE_SIZE + 1;
+            maxCode = END;
+        }
+        current = next;
+    }
+    gifCode(&out, current, codeSize);
+    // the decoder adds an entry for that last code too, and may widen before reading the CLEAR
+    if (++maxCode >= (1u << codeSize) && codeSize < 12)
+    {
+        ++codeSize;
+    }
+    gifCode(&out, CLEAR, codeSize);
+    gifCode(&out, END, MIN_CODE_SIZE + 1);
+    if (out.count)
+    {
+        gifBits(&out, 0, 8 - out.count);
+    }
+    gifFlushBlock(&out);
+    fputc(0, file); // end of image data
+}
+
+/**
+ * PNG
+ * A 2-bit palette image per distinct frame, compressed with stored
+ *  (uncompressed) deflate blocks: a frame is only a few KB that way and
+ *  there's no compressor to hold the writer up. Files are numbered by
+ *  frame, so repeats show up as gaps in the numbering.
+ */
+static uint32_t crcTable[256];
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+    if (!crcTable[1])
+    {
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            crcTable[n] = c;
+        }
+    }
+    crc = ~crc;
+    while (size--)
+        crc = crcTable[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void writeBe32(uint8_t *out, uint32_t value)
+{
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+static void writePngChunk(FILE *file, const char *type, const uint8_t *data, uint32_t size)
+{
+    uint8_t header[8];
+    writeBe32(header, size);
+    memcpy(header + 4, type, 4);
+    uint32_t crc = crc32(crc32(0, header + 4, 4), data, size);
+    uint8_t trailer[4];
+    writeBe32(trailer, crc);
+
+    fwrite(header, 1, 8, file);
+    fwrite(data, 1, size, file);
+    fwrite(trailer, 1, 4, file);
+}
+
+static int writePngFrame(Encoder *encoder, uint32_t number)
+{
+    char name[1024];
+    snprintf(name, sizeof(name), encoder->capture->path, number);
+    FILE *file = fopen(name, "wb");
+    if (!file)
+    {
+        return 0;
+    }
+
+    // rows of filter byte 0 and 4 pixels a byte, first pixel in the top bits
+    uint32_t stride = 1 + (encoder->width + 3) / 4;
+    uint32_t rawSize = stride * encoder->height;
+    uint32_t blocks = (rawSize + 65534) / 65535;
+    uint32_t idatSize = 2 + rawSize + blocks * 5 + 4;
+    uint8_t *idat = calloc(idatSize, 1);
+    uint8_t *raw = calloc(rawSize, 1);
+    if (!idat || !raw)
+    {
+        free(idat);
+        free(raw);
+        fclose(file);
+        return 0;
+    }
+    for (uint32_t y = 0; y < encoder->height; ++y)
+    {
+        uint8_t *row = raw + y * stride + 1;
+        const uint8_t *pixels = encoder->pixels + (size_t)y * encoder->width;
+        for (uint32_t x = 0; x < encoder->width; ++x)
+        {
+            row[x >> 2] |= pixels[x] << (6 - (x & 3) * 2);
+        }
+    }
+
+    // zlib stream of stored blocks
+    uint8_t *out = idat;
+    *out++ = 0x78;
+    *out++ = 0x01;
+    uint32_t a = 1, b = 0;
+    for (uint32_t offset = 0; offset < rawSize;)
+    {
+        uint32_t size = rawSize - offset < 65535 ? rawSize - offset : 65535;
+        *out++ = offset + size == rawSize; // final block?
+        *out++ = size & 0xff;
+        *out++ = size >> 8;
+        *out++ = ~size & 0xff;
+        *out++ = (~size >> 8) & 0xff;
+        memcpy(out, raw + offset, size);
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            a = (a + raw[offset + i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        out += size;
+        offset += size;
+    }
+    writeBe32(out, (b << 16) | a);
+
+    uint8_t ihdr[13];
+    writeBe32(ihdr, encoder->width);
+    writeBe32(ihdr + 4, encoder->height);
+    ihdr[8] = 2;  // bit depth
+    ihdr[9] = 3;  // palette
+    ihdr[10] = 0; // deflate
+    ihdr[11] = 0; // adaptive filtering
+    ihdr[12] = 0; // not interlaced
+    uint8_t plte[12];
+    for (int c = 0; c < 4; ++c)
+    {
+        plte[c * 3] = (encoder->capture->palette[c] >> 16) & 0xff;
+        plte[c * 3 + 1] = (encoder->capture->palette[c] >> 8) & 0xff;
+        plte[c * 3 + 2] = encoder->capture->palette[c] & 0xff;
+    }
+
+    fwrite("\x89PNG\r\n\x1a\n", 1, 8, file);
+    writePngChunk(file, "IHDR", ihdr, sizeof(ihdr));
+    writePngChunk(file, "PLTE", plte, sizeof(plte));
+    writePngChunk(file, "IDAT", idat, idatSize);
+    writePngChunk(file, "IEND", NULL, 0);
+
+    free(idat);
+    free(raw);
+    int ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+// encode a frame that lasted `repeats` ticks
+static int emitFrame(Encoder *encoder, const Chip8CaptureFrame *frame, uint32_t repeats)
+{
+    expandFrame(encoder, frame);
+    switch (encoder->capture->format)
+    {
+    case CHIP8_CAPTURE_Y4M:
+        writeY4mFrame(encoder, repeats);
+        break;
+    case CHIP8_CAPTURE_GIF:
+        writeGifFrame(encoder, repeats);
+        break;
+    default:
+        return writePngFrame(encoder, frame->number);
+    }
+    return !ferror(encoder->file);
+}
+
+/**
+ * Writer thread
+ * A frame's duration is only known once the next distinct frame (or the
+ *  end marker) arrives, so one frame is always held back.
+ */
+static int writerThread(void *data)
+{
+    Chip8Capture *capture = data;
+    Encoder encoder;
+    memset(&encoder, 0, sizeof(encoder));
+    encoder.capture = capture;
+    encoder.width = CAPTURE_WIDTH * capture->scale;
+    encoder.height = CAPTURE_HEIGHT * capture->scale;
+    encoder.pixels = malloc((size_t)encoder.width * encoder.height);
+    encoder.yuv = capture->format == CHIP8_CAPTURE_Y4M ? malloc((size_t)encoder.width * encoder.height * 3) : NULL;
+    encoder.children = capture->format == CHIP8_CAPTURE_GIF ? malloc(4096 * sizeof(encoder.children[0])) : NULL;
+    if (capture->format != CHIP8_CAPTURE_PNG)
+    {
+        encoder.file = fopen(capture->path, "wb");
+    }
+
+    Chip8CaptureFrame *frame = malloc(sizeof(Chip8CaptureFrame));
+    Chip8CaptureFrame *held = malloc(sizeof(Chip8CaptureFrame));
+    int ok = encoder.pixels && frame && held && (encoder.file || capture->format == CHIP8_CAPTURE_PNG) &&
+             (capture->format != CHIP8_CAPTURE_Y4M || encoder.yuv) && (capture->format != CHIP8_CAPTURE_GIF || encoder.children);
+    if (ok && capture->format == CHIP8_CAPTURE_Y4M)
+        writeY4mHeader(&encoder);
+    if (ok && capture->format == CHIP8_CAPTURE_GIF)
+        writeGifHeader(&encoder);
+
+    int holding = 0;
+    for (;;)
+    {
+        SDL_SemWait(capture->queued);
+        if (!PopChip8Ring(&capture->frames, frame, 1))
+        {
+            continue;
+        }
+
+        if (holding && ok)
+        {
+            ok = emitFrame(&encoder, held, frame->number - held->number);
+        }
+        if (frame->last)
+        {
+            break;
+        }
+
+        Chip8CaptureFrame *swap = held;
+        held = frame;
+        frame = swap;
+        holding = 1;
+    }
+
+    if (encoder.file)
+    {
+        if (ok && capture->format == CHIP8_CAPTURE_GIF)
+            fputc(0x3b, encoder.file);
+        ok = fclose(encoder.file) == 0 && ok;
+    }
+    capture->failed = !ok;
+
+    free(frame);
+    free(held);
+    free(encoder.pixels);
+    free(encoder.yuv);
+    free(encoder.children);
+    return 0;
+}
+
+// a PNG path as the format writePngFrame names frames with: its first %[0-9]*[du] is where
+//  the number goes (%05u before the extension if it has none), and any other % is kept as it is
+static char *pngPattern(const char *path)
+{
+    size_t length = strlen(path);
+    char *pattern = malloc(2 * length + 8); // every % doubled, and room for a number
+    if (!pattern)
+    {
+        return NULL;
+    }
+
+    int numbered = 0;
+    char *out = pattern;
+    for (const char *p = path; *p; ++p)
+    {
+        *out++ = *p;
+        if (*p != '%')
+        {
+            continue;
+        }
+        size_t width = strspn(p + 1, "0123456789");
+        if (!numbered && (p[1 + width] == 'd' || p[1 + width] == 'u'))
+        {
+            memcpy(out, p + 1, width);
+            out += width;
+            *out++ = 'u'; // the frame number is unsigned
+            p += width + 1;
+            numbered = 1;
+        }
+        else
+        {
+            *out++ = '%';
+        }
+    }
+    *out = '\0';
+
+    if (!numbered)
+    {
+        char *extension = strrchr(pattern, '.');
+        extension = extension ? extension : out;
+        memmove(extension + 4, extension, strlen(extension) + 1);
+        memcpy(extension, "%05u", 4);
+    }
+    return pattern;
+}
+
+Chip8Capture *OpenChip8Capture(Chip8CaptureFormat format, const char *path, const uint32_t palette[4], uint32_t scale)
+{
+    if (format >= CHIP8_CAPTURE_FORMAT_COUNT)
+    {
+        return NULL;
+    }
+
+    Chip8Capture *capture = calloc(sizeof(Chip8Capture), 1);
+    if (!capture)
+    {
+        return NULL;
+    }
+    capture->format = format;
+    capture->scale = scale ? scale : 1;
+    memcpy(capture->palette, palette, sizeof(capture->palette));
+
+    if (format == CHIP8_CAPTURE_PNG)
+    {
+        capture->path = pngPattern(path);
+    }
+    else
+    {
+        capture->path = malloc(strlen(path) + 1);
+        if (capture->path)
+            strcpy(capture->path, path);
+    }
+
+    capture->queued = SDL_CreateSemaphore(0);
+    if (!capture->path || !capture->queued ||
+        !InitChip8Ring(&capture->frames, sizeof(Chip8CaptureFrame), CAPTURE_QUEUE_CAPACITY))
+    {
+        CloseChip8Capture(capture);
+        return NULL;
+    }
+    capture->previous.number = UINT32_MAX; // nothing queued yet
+
+    capture->writer = SDL_CreateThread(writerThread, "capture", capture);
+    if (!capture->writer)
+    {
+        CloseChip8Capture(capture);
+        return NULL;
+    }
+
+    return capture;
+}
+
+void CaptureChip8Frame(Chip8Capture *capture, const Chip8State *state)
+{
+    uint32_t number = capture->captured++;
+    uint8_t hires = state->hires;
+    uint32_t words = frameWords(hires);
+
+    // the same as the last frame queued: the writer will see the gap in numbers
+    Chip8CaptureFrame *previous = &capture->previous;
+    if (previous->number != UINT32_MAX && previous->hires == hires)
+    {
+        int same = 1;
+        for (uint32_t p = 0; p < DISPLAY_PLANES && same; ++p)
+        {
+            for (uint32_t w = 0; w < words; ++w)
+            {
+                if (previous->words[p][w] != state->display[p][hires ? w >> 1 : w][hires ? w & 1 : 0])
+                {
+                    same = 0;
+                    break;
+                }
+            }
+        }
+        if (same)
+        {
+            return;
+        }
+    }
+
+    Chip8CaptureFrame *frame = &capture->previous;
+    frame->number = number;
+    frame->hires = hires;
+    frame->last = 0;
+    for (uint32_t p = 0; p < DISPLAY_PLANES; ++p)
+    {
+        for (uint32_t w = 0; w < words; ++w)
+        {
+            frame->words[p][w] = state->display[p][hires ? w >> 1 : w][hires ? w & 1 : 0];
+        }
+    }
+
+    if (PushChip8Ring(&capture->frames, frame, 1))
+    {
+        SDL_SemPost(capture->queued);
+    }
+    else
+    {
+        // the writer is behind; this frame is lost, and the one before it runs on instead
+        ++capture->dropped;
+        previous->number = UINT32_MAX;
+    }
+}
+
+int CloseChip8Capture(Chip8Capture *capture)
+{
+    if (!capture)
+    {
+        return 1;
+    }
+
+    if (capture->writer)
+    {
+        // the end marker gives the last frame its duration; it has to get through
+        Chip8CaptureFrame *end = &capture->previous;
+        end->number = capture->captured;
+        end->last = 1;
+        while (!PushChip8Ring(&capture->frames, end, 1))
+        {
+            SDL_Delay(1);
+        }
+        SDL_SemPost(capture->queued);
+        SDL_WaitThread(capture->writer, NULL);
+    }
+
+    int ok = !capture->failed;
+    if (capture->dropped)
+    {
+        printf("capture: dropped %u of %u frames\n", capture->dropped, capture->captured);
+    }
+
+    FreeChip8Ring(&capture->frames);
+    if (capture->queued)
+        SDL_DestroySemaphore(capture->queued);
+    free(capture->path);
+    free(capture);
+    return ok;
+}
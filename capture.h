@@ -0,0 +1,67 @@
+#pragma once
+
+#include <SDL/SDL.h>
+
+#include <stdint.h>
+
+#include "chip8.h"
+#include "ring.h"
+
+#define CAPTURE_QUEUE_CAPACITY 64u // frames the writer can fall behind by before frames are dropped
+#define CAPTURE_FPS 60u
+
+typedef enum Chip8CaptureFormat
+{
+    CHIP8_CAPTURE_Y4M, // uncompressed 4:4:4 video, for piping into an encoder
+    CHIP8_CAPTURE_GIF, // animated GIF
+    CHIP8_CAPTURE_PNG, // one PNG per distinct frame, numbered by frame
+    CHIP8_CAPTURE_FORMAT_COUNT
+} Chip8CaptureFormat;
+
+// a frame as queued: just the words of the display in use
+typedef struct Chip8CaptureFrame
+{
+    uint32_t number; // frames captured before this one
+    uint8_t hires;
+    uint8_t last;    // set on the end-of-recording marker
+    uint64_t words[DISPLAY_PLANES][HIRES_HEIGHT * 2];
+} Chip8CaptureFrame;
+
+/**
+ * Capture
+ * The emulation side copies each frame's display into a queue and carries
+ *  on; a writer thread encodes them. A frame identical to the one before
+ *  isn't queued at all: the writer works out durations from the frame
+ *  numbers instead. If the writer falls behind, frames are dropped (and
+ *  counted) rather than making the emulator wait.
+ * Every format is 128x64 pixels times the scale; low resolution frames are
+ *  drawn at double size to fill it.
+ */
+typedef struct Chip8Capture
+{
+    Chip8CaptureFormat format;
+    Chip8Ring frames;
+    SDL_sem *queued;   // posted for each frame pushed
+    SDL_Thread *writer;
+    uint32_t palette[4]; // 0xAARRGGBB for neither/plane 1/plane 2/both planes
+    uint32_t scale;
+    char *path;
+    int failed;        // set by the writer if it couldn't write
+    // emulation side only
+    uint32_t captured; // frames seen, including duplicates
+    uint32_t dropped;
+    Chip8CaptureFrame previous;
+} Chip8Capture;
+
+// format from a file name's extension (.y4m, .gif, .png); returns CHIP8_CAPTURE_FORMAT_COUNT if unknown
+Chip8CaptureFormat Chip8CaptureFormatFromPath(const char *path);
+
+// start recording to path (for PNG, where a %d or %u such as "shot%05d.png" puts the frame
+//  number; %05u is added before the extension if it has none); returns NULL on failure
+Chip8Capture *OpenChip8Capture(Chip8CaptureFormat format, const char *path, const uint32_t palette[4], uint32_t scale);
+
+// queue the machine's current display as the next frame; never waits
+void CaptureChip8Frame(Chip8Capture *capture, const Chip8State *state);
+
+// finish writing and free; returns 0 if the writer hit an error
+int CloseChip8Capture(Chip8Capture *capture);
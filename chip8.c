@@ -0,0 +1,610 @@
+#if DEBUG
+#include <SDL/SDL.h> // SDL_GetTicks, for the core's debug messages
+#endif
+
+#include "chip8.h"
+#include "pool.h"
+
+
+/**
+ * Sets first 80 (0x50) bytes of memory to the sprites for chars 0-F
+ */
+static void InsertFontIntoMemory(uint8_t *memory)
+{
+    // 0
+    memory[0x00] = 0b11110000;
+    memory[0x01] = 0b10010000;
+    memory[0x02] = 0b10010000;
+    memory[0x03] = 0b10010000;
+    memory[0x04] = 0b11110000;
+    // 1
+    memory[0x05] = 0b00100000;
+    memory[0x06] = 0b01100000;
+    memory[0x07] = 0b00100000;
+    memory[0x08] = 0b00100000;
+    memory[0x09] = 0b01110000;
+    // 2
+    memory[0x0A] = 0b11110000;
+    memory[0x0B] = 0b00010000;
+    memory[0x0C] = 0b11110000;
+    memory[0x0D] = 0b10000000;
+    memory[0x0E] = 0b11110000;
+    // 3
+    memory[0x0F] = 0b11110000;
+    memory[0x10] = 0b00010000;
+    memory[0x11] = 0b11110000;
+    memory[0x12] = 0b00010000;
+    memory[0x13] = 0b11110000;
+    // 4
+    memory[0x14] = 0b10010000;
+    memory[0x15] = 0b10010000;
+    memory[0x16] = 0b11110000;
+    memory[0x17] = 0b00010000;
+    memory[0x18] = 0b00010000;
+    // 5
+    memory[0x19] = 0b11110000;
+    memory[0x1A] = 0b10000000;
+    memory[0x1B] = 0b11110000;
+    memory[0x1C] = 0b00010000;
+    memory[0x1D] = 0b11110000;
+    // 6
+    memory[0x1E] = 0b11110000;
+    memory[0x1F] = 0b10000000;
+    memory[0x20] = 0b11110000;
+    memory[0x21] = 0b10010000;
+    memory[0x22] = 0b11110000;
+    // 7
+    memory[0x23] = 0b11110000;
+    memory[0x24] = 0b00010000;
+    memory[0x25] = 0b00100000;
+    memory[0x26] = 0b01000000;
+    memory[0x27] = 0b01000000;
+    // 8
+    memory[0x28] = 0b11110000;
+    memory[0x29] = 0b10010000;
+    memory[0x2A] = 0b11110000;
+    memory[0x2B] = 0b10010000;
+    memory[0x2C] = 0b11110000;
+    // 9
+    memory[0x2D] = 0b11110000;
+    memory[0x2E] = 0b10010000;
+    memory[0x2F] = 0b11110000;
+    memory[0x30] = 0b00010000;
+    memory[0x31] = 0b00010000;
+    // a
+    memory[0x32] = 0b11110000;
+    memory[0x33] = 0b10010000;
+    memory[0x34] = 0b11110000;
+    memory[0x35] = 0b10010000;
+    memory[0x36] = 0b10010000;
+    // b
+    memory[0x37] = 0b11100000;
+    memory[0x38] = 0b10010000;
+    memory[0x39] = 0b11100000;
+    memory[0x3A] = 0b10010000;
+    memory[0x3B] = 0b11100000;
+    // c
+    memory[0x3C] = 0b11110000;
+    memory[0x3D] = 0b10000000;
+    memory[0x3E] = 0b10000000;
+    memory[0x3F] = 0b10000000;
+    memory[0x40] = 0b11110000;
+    // d
+    memory[0x41] = 0b11100000;
+    memory[0x42] = 0b10010000;
+    memory[0x43] = 0b10010000;
+    memory[0x44] = 0b10010000;
+    memory[0x45] = 0b11100000;
+    // e
+    memory[0x46] = 0b11110000;
+    memory[0x47] = 0b10000000;
+    memory[0x48] = 0b11110000;
+    memory[0x49] = 0b10000000;
+    memory[0x4A] = 0b11110000;
+    // f
+    memory[0x4B] = 0b11110000;
+    memory[0x4C] = 0b10000000;
+    memory[0x4D] = 0b11110000;
+    memory[0x4E] = 0b10000000;
+    memory[0x4F] = 0b10000000;
+}
+
+/**
+ * Sets the 160 (0xA0) bytes from BIGFONT_BUFFER to the SUPER-CHIP 8x10 sprites
+ *  for chars 0-F (SUPER-CHIP itself only had 0-9; A-F are XO-CHIP's)
+ */
+static void InsertBigFontIntoMemory(uint8_t *memory)
+{
+    static const uint8_t bigFont[0x10 * 10] = {
+        0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+        0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+        0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+        0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+        0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+        0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+        0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // a
+        0xFE, 0xFF, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFF, 0xFE, // b
+        0x3E, 0x7F, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7F, 0x3E, // c
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // d
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // e
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0, // f
+    };
+    memcpy(&memory[BIGFONT_BUFFER], bigFont, sizeof(bigFont));
+}
+
+Chip8Image *CreateChip8Image(Chip8Profile profile, const uint8_t *rom, uint32_t romSize)
+{
+    Chip8Image *image = calloc(sizeof(Chip8Image), 1);
+
+    if (image)
+    {
+        image->profile = profile < CHIP8_PROFILE_COUNT ? profile : CHIP8_PROFILE_DEFAULT;
+        image->pageShift = GetChip8Quirks(image->profile)->pageShift;
+        image->memorySize = PAGE_COUNT << image->pageShift;
+        image->memory = calloc(image->memorySize, 1);
+        if (!image->memory)
+        {
+            free(image);
+            return NULL;
+        }
+
+        InsertFontIntoMemory(image->memory);
+        InsertBigFontIntoMemory(image->memory);
+
+        // CHIP-8 convention puts programs into RAM at 0x200
+        // ROMs will be hardcoded to expect that
+        if (romSize > image->memorySize - PROGRAM_BUFFER)
+        {
+            romSize = image->memorySize - PROGRAM_BUFFER;
+        }
+        if (rom)
+        {
+            memcpy(image->memory + PROGRAM_BUFFER, rom, romSize);
+            image->romSize = romSize;
+        }
+
+        // the machine every InitChip8 and ResetChip8 copies
+        Chip8State *s = calloc(sizeof(Chip8State), 1);
+        if (!s)
+        {
+            free(image->memory);
+            free(image);
+            return NULL;
+        }
+        s->image = image;
+        s->profile = image->profile;
+        s->memorySize = image->memorySize;
+        s->pageShift = image->pageShift;
+        // every page starts out shared with the image
+        for (uint32_t page = 0; page < PAGE_COUNT; ++page)
+        {
+            s->pages[page] = image->memory + (page << image->pageShift);
+        }
+        s->privatePages = 0;
+
+        s->SP = 0;
+        s->PC = PROGRAM_BUFFER;
+        s->I = 0;
+        s->keys = 0;
+        s->awaitingKey = 0;
+        s->planes = 1;
+        s->pitch = 64; // XO-CHIP default, 4000 Hz pattern playback
+        s->rng = CHIP8_RNG_SEED;
+        memset(s->V, 0x00, 0x10); // init V registers to 0
+        image->pristine = s;
+
+        size_t pageSize = (size_t)1 << image->pageShift;
+        for (uint32_t page = 0; page < PAGE_COUNT; ++page)
+        {
+            image->pageHashes[page] = HashChip8Bytes(page, image->memory + pageSize * page, pageSize);
+        }
+    }
+
+    return image;
+}
+
+Chip8Image *LoadChip8Image(Chip8Profile profile, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+
+    // get file size
+    fseek(file, 0L, SEEK_END);
+    long fsize = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+
+    uint8_t *rom = malloc(fsize > 0 ? fsize : 1);
+    size_t read = rom ? fread(rom, 1, fsize, file) : 0;
+    fclose(file);
+
+    Chip8Image *image = rom ? CreateChip8Image(profile, rom, (uint32_t)read) : NULL;
+    free(rom);
+    return image;
+}
+
+void DestroyChip8Image(Chip8Image *image)
+{
+    if (image)
+    {
+        free(image->pristine);
+        free(image->memory);
+        free(image);
+    }
+}
+
+// initialise a chip-8 instance
+Chip8State *InitChip8(const Chip8Image *image)
+{
+    Chip8State *s = malloc(sizeof(Chip8State));
+
+    if (s)
+    {
+        memcpy(s, image->pristine, sizeof(Chip8State));
+    }
+
+    return s;
+}
+
+// hand back every private page, leaving the page table pointing at nothing in particular
+static void releasePages(Chip8State *state)
+{
+    for (uint32_t page = 0; page < PAGE_COUNT; ++page)
+    {
+        if (state->privatePages & (1u << page))
+        {
+            if (state->pool)
+                FreeChip8PoolPage(state->pool, state->pages[page]);
+            else
+                free(state->pages[page]);
+        }
+    }
+    state->privatePages = 0;
+    state->writablePages = 0;
+}
+
+void DestroyChip8(Chip8State *state)
+{
+    if (!state)
+    {
+        return;
+    }
+    if (state->pool)
+    {
+        ReleaseChip8(state->pool, state);
+        return;
+    }
+    releasePages(state);
+    free(state);
+}
+
+void ResetChip8(Chip8State *state)
+{
+    struct Chip8Pool *pool = state->pool;
+    Chip8Watch *watch = state->watch;
+    releasePages(state);
+    memcpy(state, state->image->pristine, sizeof(Chip8State));
+    state->pool = pool;
+    state->watch = watch;
+}
+
+void CopyChip8(Chip8State *dst, const Chip8State *src)
+{
+    struct Chip8Pool *pool = dst->pool;
+    Chip8Watch *watch = dst->watch;
+    releasePages(dst);
+    memcpy(dst, src, sizeof(Chip8State));
+    dst->pool = pool;
+    dst->watch = watch;
+
+    // share what src shares, and take copies of its own pages
+    dst->privatePages = 0;
+    dst->writablePages = 0;
+    for (uint32_t page = 0; page < PAGE_COUNT; ++page)
+    {
+        if (src->privatePages & (1u << page))
+        {
+            PrivatizeChip8Page(dst, page);
+        }
+    }
+}
+
+Chip8State *CloneChip8(const Chip8State *state)
+{
+    Chip8State *s = InitChip8(state->image);
+    if (s)
+    {
+        CopyChip8(s, state);
+    }
+    return s;
+}
+
+void ReloadChip8(Chip8State *state, const Chip8Image *image, int keepState)
+{
+    const Chip8Image *old = state->image;
+    state->image = image;
+    if (!keepState)
+    {
+        ResetChip8(state);
+        return;
+    }
+
+    // shared pages just point at the new image; the core decodes every
+    //  instruction as it runs it, so there's nothing cached to throw away
+    size_t pageSize = (size_t)1 << state->pageShift;
+    for (uint32_t page = 0; page < PAGE_COUNT; ++page)
+    {
+        const uint8_t *before = old->memory + pageSize * page;
+        const uint8_t *after = image->memory + pageSize * page;
+        if (!(state->privatePages & (1u << page)))
+        {
+            state->pages[page] = image->memory + pageSize * page;
+        }
+        else if (memcmp(before, after, pageSize) != 0)
+        {
+            // the machine's own copy: take the edited bytes, keep what it wrote everywhere else
+            for (size_t offset = 0; offset < pageSize; ++offset)
+            {
+                if (before[offset] != after[offset])
+                {
+                    state->pages[page][offset] = after[offset];
+                }
+            }
+        }
+    }
+}
+
+static uint64_t mixHash(uint64_t hash, uint64_t word)
+{
+    word *= 0xff51afd7ed558ccdull;
+    word ^= word >> 32;
+    hash ^= word;
+    hash *= 0x9e3779b97f4a7c15ull;
+    return (hash << 27) | (hash >> 37);
+}
+
+// 8 bytes at a time; size needn't be a multiple of 8. Blocks of 32 go
+//  through four independent chains, so the multiplies overlap.
+uint64_t HashChip8Bytes(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    if (size >= 32)
+    {
+        uint64_t lanes[4] = {hash, hash ^ 1, hash ^ 2, hash ^ 3};
+        for (; size >= 32; bytes += 32, size -= 32)
+        {
+            uint64_t words[4];
+            memcpy(words, bytes, 32);
+            for (int l = 0; l < 4; ++l)
+            {
+                lanes[l] = mixHash(lanes[l], words[l]);
+            }
+        }
+        hash = mixHash(mixHash(mixHash(lanes[0], lanes[1]), lanes[2]), lanes[3]);
+    }
+    for (; size >= 8; bytes += 8, size -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        hash = mixHash(hash, word);
+    }
+    if (size)
+    {
+        uint64_t word = 0;
+        memcpy(&word, bytes, size);
+        hash = mixHash(hash, word ^ ((uint64_t)size << 56));
+    }
+    return hash;
+}
+
+uint64_t HashChip8Display(const Chip8State *state)
+{
+    return HashChip8Bytes(0x243f6a8885a308d3ull, state->display, sizeof(state->display));
+}
+
+uint64_t HashChip8Registers(const Chip8State *state)
+{
+    uint64_t hash = HashChip8Bytes(0x452821e638d01377ull, state->V, sizeof(state->V));
+    for (uint32_t s = 0; s < state->SP && s < STACK_DEPTH; ++s)
+    {
+        hash = mixHash(hash, state->stack[s]);
+    }
+    hash = HashChip8Bytes(hash, state->flags, sizeof(state->flags));
+    hash = HashChip8Bytes(hash, state->audioPattern, sizeof(state->audioPattern));
+    hash = mixHash(hash, (uint64_t)state->I | (uint64_t)state->PC << 16 | (uint64_t)state->SP << 32 | (uint64_t)state->delay << 48 | (uint64_t)state->sound << 56);
+    hash = mixHash(hash, (uint64_t)state->rng | (uint64_t)state->hires << 32 | (uint64_t)state->planes << 40 | (uint64_t)state->halted << 48 | (uint64_t)state->awaitingKey << 56);
+    return mixHash(hash, state->pitch);
+}
+
+uint64_t HashChip8Memory(const Chip8State *state)
+{
+    size_t pageSize = (size_t)1 << state->pageShift;
+    uint64_t hash = 0x13198a2e03707344ull;
+    for (uint32_t page = 0; page < PAGE_COUNT; ++page)
+    {
+        uint64_t pageHash = state->privatePages & (1u << page) ? HashChip8Bytes(page, state->pages[page], pageSize) : state->image->pageHashes[page];
+        hash = mixHash(hash, pageHash);
+    }
+    return hash;
+}
+
+uint64_t HashChip8State(const Chip8State *state)
+{
+    uint64_t hash = mixHash(mixHash(HashChip8Display(state), HashChip8Registers(state)), HashChip8Memory(state));
+
+    // finalise (splitmix64), so the top bits are as good as the rest
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebull;
+    hash ^= hash >> 31;
+    return hash ? hash : 1;
+}
+
+void PrivatizeChip8Page(Chip8State *state, uint32_t page)
+{
+    size_t pageSize = (size_t)1 << state->pageShift;
+    uint8_t *copy = state->pool ? AllocChip8PoolPage(state->pool) : malloc(pageSize);
+    if (!copy)
+    {
+        // out of memory: there's nowhere to put the write, so stop here
+        printf("ERROR: Couldn't allocate a memory page\n");
+        abort();
+    }
+    memcpy(copy, state->pages[page], pageSize);
+    state->pages[page] = copy;
+    state->privatePages |= 1u << page;
+    SetChip8Watch(state, state->watch);
+}
+
+void TrapChip8Write(Chip8State *state, uint32_t addr, uint8_t value)
+{
+    uint32_t page = (addr >> state->pageShift) & (PAGE_COUNT - 1);
+    uint32_t offset = addr & ((1u << state->pageShift) - 1);
+    if (!(state->privatePages & (1u << page)))
+    {
+        PrivatizeChip8Page(state, page);
+    }
+
+    uint8_t old = state->pages[page][offset];
+    state->pages[page][offset] = value;
+    if (state->watch && (state->watch->pages & (1u << page)))
+    {
+        state->watch->written(state->watch, state, addr & (state->memorySize - 1), old);
+    }
+}
+
+void SetChip8Watch(Chip8State *state, Chip8Watch *watch)
+{
+    state->watch = watch;
+    state->writablePages = state->privatePages & ~(watch ? watch->pages : 0);
+}
+
+/**
+ * Quirk table
+ * The one place each profile's quirks are set, a row per profile in
+ *  Chip8Profile order with the columns of Chip8Quirks. It becomes both the
+ *  QUIRK_<profile>_* constants the specialised cores are compiled with and
+ *  the table GetChip8Quirks returns (which the recompiler translates
+ *  against), so the two can't drift apart.
+ */
+//                  shiftVy  loadStoreInc  jumpVx  drawWrapOrigin  vfReset  keyRelease  drawWrap  schip  xochip  pageShift
+#define CHIP8_QUIRKS(Q)                                    \
+    Q(DEFAULT, 0, 1, 0, 0, 0, 0, 0, 0, 0, 8)               \
+    Q(VIP, 1, 1, 0, 1, 1, 1, 0, 0, 0, 8)                   \
+    Q(CHIP48, 0, 2, 1, 1, 0, 1, 0, 0, 0, 8)                \
+    Q(SCHIP, 0, 0, 1, 1, 0, 1, 0, 1, 0, 8)                 \
+    Q(XOCHIP, 1, 1, 0, 1, 0, 1, 1, 1, 1, 12)
+
+#define QUIRK_CONSTANTS(profile, shiftVy, loadStoreInc, jumpVx, drawWrapOrigin, vfReset, keyRelease, drawWrap, schip, xochip, pageShift) \
+    enum                                                                                                                           \
+    {                                                                                                                              \
+        QUIRK_##profile##_SHIFT_VY = shiftVy,                                                                                      \
+        QUIRK_##profile##_LOADSTORE_INC = loadStoreInc,                                                                            \
+        QUIRK_##profile##_JUMP_VX = jumpVx,                                                                                        \
+        QUIRK_##profile##_DRAW_WRAP_ORIGIN = drawWrapOrigin,                                                                       \
+        QUIRK_##profile##_VF_RESET = vfReset,                                                                                      \
+        QUIRK_##profile##_KEY_RELEASE = keyRelease,                                                                                \
+        QUIRK_##profile##_DRAW_WRAP = drawWrap,                                                                                    \
+        QUIRK_##profile##_SCHIP = schip,                                                                                           \
+        QUIRK_##profile##_XOCHIP = xochip,                                                                                         \
+        QUIRK_##profile##_PAGE_SHIFT = pageShift,                                                                                  \
+    };
+CHIP8_QUIRKS(QUIRK_CONSTANTS)
+
+#define QUIRK_ROW(profile, ...) {__VA_ARGS__},
+static const Chip8Quirks quirks[CHIP8_PROFILE_COUNT] = {CHIP8_QUIRKS(QUIRK_ROW)};
+
+/**
+ * Specialised cores
+ * chip8_core.inc is the interpreter written against Q_* quirk macros; it is
+ *  included once per profile so every quirk is a compile-time constant and
+ *  the compiler folds the alternatives away.
+ */
+#define CORE_SUFFIX Default
+#define CORE_PROFILE DEFAULT
+#include "chip8_core.inc"
+
+#define CORE_SUFFIX Vip
+#define CORE_PROFILE VIP
+#include "chip8_core.inc"
+
+#define CORE_SUFFIX Chip48
+#define CORE_PROFILE CHIP48
+#include "chip8_core.inc"
+
+#define CORE_SUFFIX Schip
+#define CORE_PROFILE SCHIP
+#include "chip8_core.inc"
+
+#define CORE_SUFFIX Xochip
+#define CORE_PROFILE XOCHIP
+#include "chip8_core.inc"
+
+static const Chip8Emulator emulators[CHIP8_PROFILE_COUNT] = {
+    EmulateChip8Default,
+    EmulateChip8Vip,
+    EmulateChip8Chip48,
+    EmulateChip8Schip,
+    EmulateChip8Xochip,
+};
+
+static Chip8Stop (*const runners[CHIP8_PROFILE_COUNT])(Chip8State *, const Chip8Until *, uint64_t *) = {
+    RunChip8UntilDefault,
+    RunChip8UntilVip,
+    RunChip8UntilChip48,
+    RunChip8UntilSchip,
+    RunChip8UntilXochip,
+};
+
+static const char *const profileNames[CHIP8_PROFILE_COUNT] = {
+    "default",
+    "vip",
+    "chip48",
+    "schip",
+    "xochip",
+};
+
+const Chip8Quirks *GetChip8Quirks(Chip8Profile profile)
+{
+    return &quirks[profile < CHIP8_PROFILE_COUNT ? profile : CHIP8_PROFILE_DEFAULT];
+}
+
+Chip8Emulator GetChip8Emulator(Chip8Profile profile)
+{
+    return emulators[profile < CHIP8_PROFILE_COUNT ? profile : CHIP8_PROFILE_DEFAULT];
+}
+
+Chip8Profile Chip8ProfileFromName(const char *name)
+{
+    for (int p = 0; p < CHIP8_PROFILE_COUNT; ++p)
+    {
+        if (strcmp(name, profileNames[p]) == 0)
+        {
+            return (Chip8Profile)p;
+        }
+    }
+    return CHIP8_PROFILE_COUNT;
+}
+
+const char *Chip8ProfileName(Chip8Profile profile)
+{
+    return profile < CHIP8_PROFILE_COUNT ? profileNames[profile] : "unknown";
+}
+
+// executes the next instruction for the given state
+void EmulateChip8(Chip8State *state)
+{
+    emulators[state->profile](state);
+}
+
+Chip8Stop RunChip8Until(Chip8State *state, const Chip8Until *until, uint64_t *ran)
+{
+    return runners[state->profile](state, until, ran);
+}
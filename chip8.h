@@ -1,488 +1,306 @@
+#pragma once
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 
 // constants
-const uint16_t MEMORY_CAPACITY = 4096u;
-const uint8_t DISPLAY_WIDTH = 64u;
-const uint8_t DISPLAY_HEIGHT = 32u;
-const uint16_t PROGRAM_BUFFER = 0x200u;
-const uint16_t DISPLAY_BUFFER = 0xF00u;
-const uint16_t STACK_BUFFER = 0xEA0u;
+#define MEMORY_CAPACITY 4096u
+#define XO_MEMORY_CAPACITY 0x10000u // XO-CHIP has a full 16-bit address space
+#define DISPLAY_WIDTH 64u
+#define DISPLAY_HEIGHT 32u
+#define HIRES_WIDTH 128u // SUPER-CHIP/XO-CHIP high resolution mode
+#define HIRES_HEIGHT 64u
+#define DISPLAY_PLANES 2u // XO-CHIP bitplanes
+#define PROGRAM_BUFFER 0x200u
+#define BIGFONT_BUFFER 0x50u // SUPER-CHIP 8x10 digits, straight after the small font
+#define STACK_DEPTH 16u
+#define PAGE_COUNT 16u // RAM is split into 16 pages: 256 bytes each, or 4 KB on XO-CHIP
+#define CHIP8_RNG_SEED 0x2545f491u // every machine draws the same random numbers unless reseeded
+#define CHIP8_TICK_INSTRUCTIONS 16u // tools that count instructions rather than frames tick the timers this often
+
+#if defined(_MSC_VER)
+#define CHIP8_ALIGN(n) __declspec(align(n))
+#else
+#define CHIP8_ALIGN(n) __attribute__((aligned(n)))
+#endif
+
+/**
+ * Quirk profiles
+ * Interpreters disagree on a handful of instructions, and ROMs are written
+ *  against whichever one their author used. Each profile is compiled as its
+ *  own specialised core (see chip8_core.inc), so picking one costs nothing
+ *  per instruction.
+ *
+ *                 8XY6/8XYE  FX55/FX65  BNNN      DRAW               8XY1-3  FX0A
+ *  DEFAULT        VX         I += X+1   V0+NNN    clip, no x wrap    -       press
+ *  VIP            VY         I += X+1   V0+NNN    wrap origin, clip  VF = 0  release
+ *  CHIP48         VX         I += X     VX+NNN    wrap origin, clip  -       release
+ *  SCHIP          VX         I          VX+NNN    wrap origin, clip  -       release
+ *  XOCHIP         VY         I += X+1   V0+NNN    wrap everything    -       release
+ *
+ * SCHIP and XOCHIP also get the SUPER-CHIP instructions (128x64 mode,
+ *  scrolling, 16x16 sprites, big font, flag registers); XOCHIP adds the
+ *  XO-CHIP ones on top (bitplanes, 64 KB of RAM, long I, audio patterns).
+ */
+typedef enum Chip8Profile
+{
+    CHIP8_PROFILE_DEFAULT, // this emulator's original behaviour
+    CHIP8_PROFILE_VIP,     // COSMAC VIP interpreter
+    CHIP8_PROFILE_CHIP48,  // CHIP-48 on the HP-48
+    CHIP8_PROFILE_SCHIP,   // SUPER-CHIP 1.1
+    CHIP8_PROFILE_XOCHIP,  // XO-CHIP (Octo)
+    CHIP8_PROFILE_COUNT
+} Chip8Profile;
+
+// a profile's quirks, as its core is compiled with them (the Q_* in chip8_core.inc)
+typedef struct Chip8Quirks
+{
+    uint8_t shiftVy;        // 8XY6/8XYE shift VY
+    uint8_t loadStoreInc;   // FX55/FX65 leave I alone (0), add X+1 (1) or add X (2)
+    uint8_t jumpVx;         // BNNN adds VX
+    uint8_t drawWrapOrigin; // DRAW wraps its starting coordinate
+    uint8_t vfReset;        // 8XY1/8XY2/8XY3 clear VF
+    uint8_t keyRelease;     // FX0A waits for the key to be released
+    uint8_t drawWrap;       // DRAW wraps pixels round the edges
+    uint8_t schip;          // SUPER-CHIP instructions
+    uint8_t xochip;         // XO-CHIP instructions
+    uint8_t pageShift;      // log2 of the page size
+} Chip8Quirks;
+
+/**
+ * Display
+ * Each row is a pair of 64-bit words, leftmost pixel in the top bit of
+ *  word 0, so a sprite row is drawn with a couple of shifts and XORs and
+ *  horizontal scrolls are word shifts. In low resolution only word 0 of
+ *  rows 0-31 is used; in high resolution both words of rows 0-63 are.
+ */
+typedef uint64_t Chip8Display[DISPLAY_PLANES][HIRES_HEIGHT][2];
+
+/**
+ * Image
+ * The RAM contents of a machine straight after loading: fonts plus ROM.
+ *  Any number of machines can be started from one image and share its
+ *  pages read-only; see Chip8State. The image must outlive them.
+ */
+typedef struct Chip8Image
+{
+    uint8_t *memory;     // memorySize bytes
+    struct Chip8State *pristine; // a machine that has just loaded this image; new and reset machines copy it
+    uint32_t memorySize; // MEMORY_CAPACITY, or XO_MEMORY_CAPACITY for XO-CHIP
+    uint32_t romSize;
+    uint8_t pageShift;   // log2 of the page size
+    uint8_t profile;
+    uint64_t pageHashes[PAGE_COUNT]; // what machines' shared pages hash as (see HashChip8Memory)
+} Chip8Image;
+
+/**
+ * Write watch
+ * Writes to the pages in `pages` leave the fast path (see writablePages
+ *  below) and, once made, are reported to `written` with the byte they
+ *  replaced. Machines without one pay nothing for it.
+ */
+typedef struct Chip8Watch
+{
+    uint16_t pages;
+    void (*written)(struct Chip8Watch *watch, struct Chip8State *state, uint32_t addr, uint8_t old);
+} Chip8Watch;
 
+/**
+ * The display and stack live here rather than in RAM, so ROMs get all of
+ *  memory to themselves and can't scribble on either through I.
+ * RAM is copy-on-write: pages[] starts out pointing into the image, and the
+ *  first write to a page gives this machine its own copy (marked in
+ *  privatePages). Most ROMs only ever write a page or two, so a machine
+ *  costs a few hundred bytes of RAM on top of this struct.
+ * Writes go straight in only for pages in writablePages (private and not
+ *  watched); the rest take TrapChip8Write, so a write costs one test
+ *  either way.
+ */
 typedef struct Chip8State
 {
+    CHIP8_ALIGN(16) Chip8Display display;
+    uint16_t stack[STACK_DEPTH]; // return addresses
+
     // RAM and Registers
     uint8_t V[0x10];     // 16 8-bit registers
-    uint8_t *memory;     // RAM
-    uint8_t *screen;     // display buffer - memory[0xF00]
-    uint8_t keys[0x10];  // 16 key states (1 down, 0 up)
+    uint8_t *pages[PAGE_COUNT]; // RAM, a page at a time
+    uint16_t privatePages;      // bit n set: pages[n] is this machine's own copy
+    uint16_t writablePages;     // privatePages less any watched pages
+    Chip8Watch *watch;          // NULL unless something is watching writes
+    uint8_t pageShift;          // log2 of the page size, as in the image
+    uint32_t memorySize;        // MEMORY_CAPACITY, or XO_MEMORY_CAPACITY for XO-CHIP
+    const Chip8Image *image;    // where unwritten pages come from
+    struct Chip8Pool *pool;     // where private pages come from (NULL: malloc)
+    uint8_t hires;       // SUPER-CHIP 128x64 mode
+    uint8_t planes;      // XO-CHIP bitplanes selected for drawing (bit 0 = plane 1)
+    uint8_t halted;      // SUPER-CHIP EXIT was executed
+    uint8_t flags[0x10]; // SUPER-CHIP/XO-CHIP persistent flag registers
+    uint8_t audioPattern[0x10]; // XO-CHIP 1-bit audio pattern
+    uint8_t pitch;       // XO-CHIP audio pattern playback rate
+    uint32_t rng;        // RANDMASK state (xorshift32), so runs replay exactly
+    uint16_t keys;       // held keys, bit n = key n
     uint16_t I;          // memory address register
-    uint16_t SP;         // stack pointer
+    uint16_t SP;         // stack pointer - number of entries in stack
     uint16_t PC;         // program counter/index
     uint8_t delay;       // timer
     uint8_t sound;       // timer
-    uint8_t awaitingKey; // flag showing whether we are waiting for input
+    uint8_t awaitingKey; // FX0A: 0 not waiting, 1 waiting for a press, 2 + k key k pressed
+    uint8_t profile;     // Chip8Profile this machine was created with
+    uint32_t draws;      // DXYN instructions run, for statistics (wraps)
 } Chip8State;
 
+// executes one instruction for a state; one of these exists per profile
+typedef void (*Chip8Emulator)(Chip8State *state);
+
+// why RunChip8Until returned
+typedef enum Chip8Stop
+{
+    CHIP8_STOP_BUDGET,     // ran every instruction it was given
+    CHIP8_STOP_DISPLAY,    // the last instruction drew, cleared or scrolled the display
+    CHIP8_STOP_KEY_WAIT,   // the last instruction was an FX0A still waiting for its key
+    CHIP8_STOP_TIMER_READ, // the last instruction was FX07
+    CHIP8_STOP_PC,         // the PC reached the address asked for (the instruction there hasn't run)
+    CHIP8_STOP_HALTED,     // SUPER-CHIP EXIT; always stops, and a halted machine runs nothing
+} Chip8Stop;
+
+// events to stop at, as a mask for Chip8Until
+#define CHIP8_UNTIL_DISPLAY (1u << CHIP8_STOP_DISPLAY)
+#define CHIP8_UNTIL_KEY_WAIT (1u << CHIP8_STOP_KEY_WAIT)
+#define CHIP8_UNTIL_TIMER_READ (1u << CHIP8_STOP_TIMER_READ)
+#define CHIP8_UNTIL_PC (1u << CHIP8_STOP_PC)
+
 /**
- * Sets first 80 (0x50) bytes of memory to the sprites for chars 0-F
+ * Run-until
+ * Runs the profile's core in its own loop for up to `instructions`,
+ *  returning early at the first of `events` to happen, so callers pay one
+ *  call per event rather than one per instruction. With no events the
+ *  loop is just the core and a halt test; each event asked for adds a
+ *  test of the instruction just run.
  */
-static void InsertFontIntoMemory(Chip8State *state)
+typedef struct Chip8Until
 {
-    // 0
-    state->memory[0x00] = 0b11110000;
-    state->memory[0x01] = 0b10010000;
-    state->memory[0x02] = 0b10010000;
-    state->memory[0x03] = 0b10010000;
-    state->memory[0x04] = 0b11110000;
-    // 1
-    state->memory[0x05] = 0b00100000;
-    state->memory[0x06] = 0b01100000;
-    state->memory[0x07] = 0b00100000;
-    state->memory[0x08] = 0b00100000;
-    state->memory[0x09] = 0b01110000;
-    // 2
-    state->memory[0x0A] = 0b11110000;
-    state->memory[0x0B] = 0b00010000;
-    state->memory[0x0C] = 0b11110000;
-    state->memory[0x0D] = 0b10000000;
-    state->memory[0x0E] = 0b11110000;
-    // 3
-    state->memory[0x0F] = 0b11110000;
-    state->memory[0x10] = 0b00010000;
-    state->memory[0x11] = 0b11110000;
-    state->memory[0x12] = 0b00010000;
-    state->memory[0x13] = 0b11110000;
-    // 4
-    state->memory[0x14] = 0b10010000;
-    state->memory[0x15] = 0b10010000;
-    state->memory[0x16] = 0b11110000;
-    state->memory[0x17] = 0b00010000;
-    state->memory[0x18] = 0b00010000;
-    // 5
-    state->memory[0x19] = 0b11110000;
-    state->memory[0x1A] = 0b10000000;
-    state->memory[0x1B] = 0b11110000;
-    state->memory[0x1C] = 0b00010000;
-    state->memory[0x1D] = 0b11110000;
-    // 6
-    state->memory[0x1E] = 0b11110000;
-    state->memory[0x1F] = 0b10000000;
-    state->memory[0x20] = 0b11110000;
-    state->memory[0x21] = 0b10010000;
-    state->memory[0x22] = 0b11110000;
-    // 7
-    state->memory[0x23] = 0b11110000;
-    state->memory[0x24] = 0b00010000;
-    state->memory[0x25] = 0b00100000;
-    state->memory[0x26] = 0b01000000;
-    state->memory[0x27] = 0b01000000;
-    // 8
-    state->memory[0x28] = 0b11110000;
-    state->memory[0x29] = 0b10010000;
-    state->memory[0x2A] = 0b11110000;
-    state->memory[0x2B] = 0b10010000;
-    state->memory[0x2C] = 0b11110000;
-    // 9
-    state->memory[0x2D] = 0b11110000;
-    state->memory[0x2E] = 0b10010000;
-    state->memory[0x2F] = 0b11110000;
-    state->memory[0x30] = 0b00010000;
-    state->memory[0x31] = 0b00010000;
-    // a
-    state->memory[0x32] = 0b11110000;
-    state->memory[0x33] = 0b10010000;
-    state->memory[0x34] = 0b11110000;
-    state->memory[0x35] = 0b10010000;
-    state->memory[0x36] = 0b10010000;
-    // b
-    state->memory[0x37] = 0b11100000;
-    state->memory[0x38] = 0b10010000;
-    state->memory[0x39] = 0b11100000;
-    state->memory[0x3A] = 0b10010000;
-    state->memory[0x3B] = 0b11100000;
-    // c
-    state->memory[0x3C] = 0b11110000;
-    state->memory[0x3D] = 0b10000000;
-    state->memory[0x3E] = 0b10000000;
-    state->memory[0x3F] = 0b10000000;
-    state->memory[0x40] = 0b11110000;
-    // d
-    state->memory[0x41] = 0b11100000;
-    state->memory[0x42] = 0b10010000;
-    state->memory[0x43] = 0b10010000;
-    state->memory[0x44] = 0b10010000;
-    state->memory[0x45] = 0b11100000;
-    // e
-    state->memory[0x46] = 0b11110000;
-    state->memory[0x47] = 0b10000000;
-    state->memory[0x48] = 0b11110000;
-    state->memory[0x49] = 0b10000000;
-    state->memory[0x4A] = 0b11110000;
-    // f
-    state->memory[0x4B] = 0b11110000;
-    state->memory[0x4C] = 0b10000000;
-    state->memory[0x4D] = 0b11110000;
-    state->memory[0x4E] = 0b10000000;
-    state->memory[0x4F] = 0b10000000;
-}
+    uint64_t instructions; // budget
+    uint32_t events;       // CHIP8_UNTIL_*
+    uint32_t pc;           // for CHIP8_UNTIL_PC
+} Chip8Until;
 
-// initialise a chip-8 instance
-Chip8State *InitChip8(void)
-{
-    Chip8State *s = calloc(sizeof(Chip8State), 1);
+// build an image with the fonts and a ROM at PROGRAM_BUFFER (rom may be NULL for none)
+Chip8Image *CreateChip8Image(Chip8Profile profile, const uint8_t *rom, uint32_t romSize);
 
-    if (s)
-    {
-        s->memory = calloc(MEMORY_CAPACITY, 1);
-        if (s->memory)
-        {
-            s->screen = &s->memory[DISPLAY_BUFFER];
-            s->SP = STACK_BUFFER;
-            s->PC = PROGRAM_BUFFER;
-            s->I = 0;
-            s->awaitingKey = 0;
-            memset(s->V, 0x00, 0x10); // init V registers to 0
-
-            InsertFontIntoMemory(s);
-        }
-    }
+// build an image from a ROM file; returns NULL if it can't be read
+Chip8Image *LoadChip8Image(Chip8Profile profile, const char *path);
+void DestroyChip8Image(Chip8Image *image);
 
-    return s;
-}
+// initialise a chip-8 instance running the image
+Chip8State *InitChip8(const Chip8Image *image);
+void DestroyChip8(Chip8State *state);
+
+// put a machine back to how it was straight after loading its image
+void ResetChip8(Chip8State *state);
+
+// make dst (a machine running the same image) an exact copy of src
+void CopyChip8(Chip8State *dst, const Chip8State *src);
+
+// a new machine that is an exact copy of state; free with DestroyChip8
+Chip8State *CloneChip8(const Chip8State *state);
+
+// move a machine onto a new image of the same profile (the old one can then be destroyed).
+//  keepState 0 resets it onto the new image; 1 keeps registers, display and
+//  everything it has written, patching in only the bytes where the images differ
+void ReloadChip8(Chip8State *state, const Chip8Image *image, int keepState);
+
+/**
+ * State hashes
+ * 64-bit hashes for telling machines apart: explore's visited set,
+ *  difftest's lockstep comparison and regress's goldens. Pages still
+ *  shared with the image hash as the image's page did, from hashes the
+ *  image keeps, so only the pages a machine has written are read; a page
+ *  written back to how it was hashes as one never written. Held keys are
+ *  left out, as they're input rather than state.
+ */
+uint64_t HashChip8Bytes(uint64_t hash, const void *data, size_t size);
+uint64_t HashChip8Display(const Chip8State *state);
+// registers, timers, the live part of the stack, flags and the audio pattern
+uint64_t HashChip8Registers(const Chip8State *state);
+uint64_t HashChip8Memory(const Chip8State *state);
+// all of the above, finalised so every bit is as good as the rest; never 0
+uint64_t HashChip8State(const Chip8State *state);
 
-static void Op0(Chip8State *state, uint8_t *instr)
+// give the machine its own copy of a page before it's written
+void PrivatizeChip8Page(Chip8State *state, uint32_t page);
+
+// a write to a page not in writablePages: privatise it if need be, write, and report it if watched
+void TrapChip8Write(Chip8State *state, uint32_t addr, uint8_t value);
+
+// start (or stop, with NULL) watching writes; call again whenever watch->pages changes
+void SetChip8Watch(Chip8State *state, Chip8Watch *watch);
+
+const Chip8Quirks *GetChip8Quirks(Chip8Profile profile);
+
+// the specialised core for a profile; fetch once and call it directly in hot loops
+Chip8Emulator GetChip8Emulator(Chip8Profile profile);
+
+// look up a profile by name ("default", "vip", "chip48", "schip", "xochip"); returns CHIP8_PROFILE_COUNT if unknown
+Chip8Profile Chip8ProfileFromName(const char *name);
+const char *Chip8ProfileName(Chip8Profile profile);
+
+// executes the next instruction for the given state, using its profile's core
+void EmulateChip8(Chip8State *state);
+
+// run until the budget's spent or one of the events happens; *ran is set to the instructions run
+Chip8Stop RunChip8Until(Chip8State *state, const Chip8Until *until, uint64_t *ran);
+
+/**
+ * Timers
+ * The delay and sound timers count down at 60 Hz whatever the CPU is
+ *  doing, so the cores leave them alone: whoever decides what a frame is
+ *  (see timing.h) ticks them once a frame.
+ */
+static inline void TickChip8Timers(Chip8State *state)
 {
-    switch (instr[1])
-    {
-    case 0xe0: // CLS
-        // set all bits in the screen area to 0
-        memset(state->screen, 0, 256); // (64 / 8) * 32 bytes
-        state->PC += 2;
-        break;
-    case 0xee: // RET
-        // take two bytes from the stack
-        uint16_t target = (state->memory[state->SP] << 8) | state->memory[state->SP + 1];
-        state->SP += 2;
-        // set them in the PC
-        state->PC = target;
-        break;
-    default: // SYS $NNN
-        // NOT IMPLEMENTED
-        break;
-    }
+    if (state->delay)
+        state->delay--;
+    if (state->sound)
+        state->sound--;
 }
 
-static void Op8(Chip8State *state, uint8_t *instr)
+// byte of RAM at any address (wrapped into the machine's memory)
+static inline uint8_t Chip8ReadMemory(const Chip8State *state, uint32_t addr)
 {
-    uint8_t X = instr[0] & 0x0f;
-    uint8_t Y = (instr[1] & 0xf0) >> 4;
-
-    switch (instr[1] & 0x0f)
-    {
-    case 0x0: // MOV VX,VY
-        state->V[X] = state->V[Y];
-        break;
-    case 0x1: // OR VX,VY
-        state->V[X] = state->V[X] | state->V[Y];
-        break;
-    case 0x2: // AND VX,VY
-        state->V[X] = state->V[X] & state->V[Y];
-        break;
-    case 0x3: // XOR VX,VY
-        state->V[X] = state->V[X] ^ state->V[Y];
-        break;
-    case 0x4: // ADD VX,VY
-    {
-        uint16_t result = state->V[X] + state->V[Y];
-        state->V[0xF] = result > 0xFF;
-        state->V[X] = result & 0xFF;
-    }
-    break;
-    case 0x5: // SUB VX,VY
-        state->V[0xF] = state->V[X] > state->V[Y];
-        state->V[X] -= state->V[Y];
-        break;
-    case 0x6: // RSHFT VX,1
-        // save the least significant bit 0b00000001/0x01/001
-        state->V[0xF] = state->V[X] & 0b1;
-        state->V[X] = (state->V[X] >> 1) & 0x7F;
-        break;
-    case 0x7: // BSUB VX,VY
-        state->V[0xF] = state->V[Y] > state->V[X];
-        state->V[X] = state->V[Y] - state->V[X];
-        break;
-    case 0xe: // LSHFT VX,1
-        // save the most significant bit 0b10000000/0x80/128
-        state->V[0xF] = (state->V[X] & 0b10000000);
-        state->V[X] = (state->V[X] << 1) & 0xFE;
-        break;
-    }
+    return state->pages[(addr >> state->pageShift) & (PAGE_COUNT - 1)][addr & ((1u << state->pageShift) - 1)];
 }
 
-static void OpD(Chip8State *state, uint8_t spr_x, uint8_t spr_y, uint8_t spr_h)
+static inline void Chip8WriteMemory(Chip8State *state, uint32_t addr, uint8_t value)
 {
-    // need to draw each bit individually because pixels are XOR'ed with each other
-    // this also determines if a collision has occurred
-
-    // Draw sprite
-    int i, j;
-    state->V[0xF] = 0;
-    for (i = 0; i < spr_h; i++)
+    uint32_t page = (addr >> state->pageShift) & (PAGE_COUNT - 1);
+    if (!(state->writablePages & (1u << page)))
     {
-        uint8_t *sprite = &state->memory[state->I + i];
-        int spritebit = 7;
-        for (j = spr_x; j < (spr_x + 8) && j < 64; j++)
-        {
-            int jover8 = j / 8; // picks the byte in the row
-            int jmod8 = j % 8;  // picks the bit in the byte
-            uint8_t srcbit = (*sprite >> spritebit) & 0x1;
-
-            if (srcbit)
-            {
-                uint8_t *destbyte_p = &state->screen[(i + spr_y) * (64 / 8) + jover8];
-                uint8_t destbyte = *destbyte_p;
-                uint8_t destmask = (0x80 >> jmod8);
-                uint8_t destbit = destbyte & destmask;
-
-                srcbit = srcbit << (7 - jmod8);
-
-                if (srcbit & destbit)
-                {
-                    state->V[0xF] = 1;
-                }
-
-                destbit ^= srcbit;
-
-                destbyte = (destbyte & ~destmask) | destbit;
-
-                *destbyte_p = destbyte;
-            }
-            spritebit--;
-        }
+        TrapChip8Write(state, addr, value);
+        return;
     }
+    state->pages[page][addr & ((1u << state->pageShift) - 1)] = value;
 }
 
-static void OpE(Chip8State *state, uint8_t *instr)
+// next byte from the machine's own random number generator
+static inline uint8_t Chip8Random(Chip8State *state)
 {
-    uint8_t X = instr[0] & 0x0f;
-    switch (instr[1])
-    {
-    case 0x9e: // SKIP.KEY VX
-        if (state->keys[state->V[X]])
-        {
-            state->PC += 2;
-        }
-        break;
-    case 0xa1: // SKIP.NKEY VX
-        if (!state->keys[state->V[X]])
-        {
-            state->PC += 2;
-        }
-        break;
-    }
-    state->PC += 2;
+    uint32_t x = state->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state->rng = x;
+    return (uint8_t)(x >> 24);
 }
 
-static void OpF(Chip8State *state, uint8_t *instr)
+// size of the visible display for the current mode
+static inline uint8_t Chip8DisplayWidth(const Chip8State *state)
 {
-    uint8_t X = instr[0] & 0x0f;
-
-    switch (instr[1])
-    {
-    case 0x07: // MOV VX,DELAY
-        state->V[X] = state->delay;
-        state->PC += 2;
-        break;
-    case 0x0a: // MOV VX,KEY
-    {
-        printf("%-10i Awaiting key not yet implemented!\n", SDL_GetTicks());
-        if (!state->awaitingKey)
-        {
-            state->awaitingKey = 1;
-        }
-        else
-        {
-            // determine if a key is pressed
-            uint8_t k;
-            for (k = 0; k < 0x10; ++k)
-            {
-                if (state->keys[k])
-                {
-                    break;
-                }
-            }
-            // if was pressed:
-            if (k < 0x10)
-            {
-                state->V[X] = k;
-                state->awaitingKey = 0;
-                state->PC += 2;
-            }
-            // else, continue and come back
-        }
-    }
-    break;
-    case 0x15: // MOV DELAY,VX
-        state->delay = state->V[X];
-        state->PC += 2;
-        break;
-    case 0x18: // MOV SOUND,VX
-        state->sound = state->V[X];
-        state->PC += 2;
-        break;
-    case 0x1e: // ADD I,VX
-        state->I += state->V[X];
-        state->PC += 2;
-        break;
-    case 0x29: // SPRITE.GET I,VX
-        // char sprite locations start at addr 0, sprites are 5 tall
-        // therefore: address = value * 5
-        state->I = state->V[X] * 5;
-        state->PC += 2;
-        break;
-    case 0x33: // BCD VX
-    {
-        uint8_t value = state->V[X];
-        uint8_t ones = value % 10;
-        value /= 10;
-        uint8_t tens = value % 10;
-        uint8_t hundreds = value / 10;
-        state->memory[state->I] = hundreds;
-        state->memory[state->I + 1] = tens;
-        state->memory[state->I + 2] = ones;
-        state->PC += 2;
-    }
-    break;
-    case 0x55: // REG.DUMP VX
-        for (int v = 0; v <= X; ++v)
-        {
-            state->memory[state->I + v] = state->V[v];
-        }
-        state->I += X + 1;
-        state->PC += 2;
-        break;
-    case 0x65: // REG.LOAD VX
-        for (int v = 0; v <= X; ++v)
-        {
-            state->V[v] = state->memory[state->I + v];
-        }
-        state->I += X + 1;
-        state->PC += 2;
-        break;
-    }
+    return state->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
 }
 
-// executes the next instruction for the given state
-void EmulateChip8(Chip8State *state)
+static inline uint8_t Chip8DisplayHeight(const Chip8State *state)
 {
-    // update timers
-    if (state->delay)
-        state->delay--;
-    if (state->sound)
-        state->sound--;
-
-    uint8_t *instr = &state->memory[state->PC];
-
-    uint8_t highNibble = (instr[0] & 0xF0) >> 4;
-    // second nibble
-    uint8_t X = instr[0] & 0x0F;
-    // third nibble
-    uint8_t Y = ((instr[1] & 0xF0) >> 4);
-    // fourth nibble
-    uint8_t N = instr[1] & 0x0F;
-    // second byte (3rd,4th nibbles)
-    uint8_t NN = instr[1];
-    // 2nd,3rd,4th nibbles
-    uint16_t NNN = (((instr[0] & 0x0F) << 8) | instr[1]) & 0x0FFF;
-
-    switch (highNibble)
-    {
-    case 0x0: // Op0
-        Op0(state, instr);
-        // Op0 adjusts PC itself, so don't here
-        break;
-    case 0x1: // JMP $NNN
-        // jump to current instruction - infinite loop
-        if (state->PC == NNN)
-        {
-            // TODO: halt on infinite loop
-            printf("%-10i Infinite loop detected!\n", SDL_GetTicks());
-        }
-        state->PC = NNN;
-        break;
-    case 0x2: // CALL $NNN
-        state->SP -= 2;
-        // load the two-byte return address from the next memory index after this instruction into 2 bytes in the stack
-        state->memory[state->SP] = ((state->PC + 2) & 0xFF00) >> 8;
-        state->memory[state->SP + 1] = (state->PC + 2) & 0xFF;
-        // set PC to intended address
-        state->PC = NNN;
-        break;
-    case 0x3: // SKIP.EQ VX,#$NN
-        if (state->V[X] == NN)
-        {
-            state->PC += 2;
-        }
-        state->PC += 2;
-        break;
-    case 0x4: // SKIP.NE VX,#$NN
-        if (state->V[X] != NN)
-        {
-            state->PC += 2;
-        }
-        state->PC += 2;
-        break;
-    case 0x5: // SKIP.EQ VX,VY
-        if (state->V[X] == state->V[Y])
-        {
-            state->PC += 2;
-        }
-        state->PC += 2;
-        break;
-    case 0x6: // MOV VX,#$NN
-        state->V[X] = NN;
-        state->PC += 2;
-        break;
-    case 0x7: // ADD VX,#$NN
-        state->V[X] += NN;
-        state->PC += 2;
-        break;
-    case 0x8: // Op8
-        Op8(state, instr);
-        state->PC += 2;
-        break;
-    case 0x9: // SKIP.NE VX,VY
-        if (state->V[X] != state->V[Y])
-        {
-            state->PC += 2;
-        }
-        state->PC += 2;
-        break;
-    case 0xa: // MOV I,#$NNN
-        state->I = NNN;
-        state->PC += 2;
-        break;
-    case 0xb: // JUMP $NNN+V0
-        state->PC = NNN + (uint16_t)state->V[0];
-        break;
-    case 0xc: // RANDMASK VX,$NN
-        state->V[X] = rand() & (uint32_t)NN;
-        state->PC += 2;
-        break;
-    case 0xd: // DRAW VX,VY,#$N
-        OpD(state, state->V[X], state->V[Y], N);
-        state->PC += 2;
-        break;
-    case 0xe: // OpE
-        OpE(state, instr);
-        // OpE adjusts PC itself, so don't here
-        break;
-    case 0xf: // OpF
-        OpF(state, instr);
-        // OpF adjusts PC itself, so don't here
-        break;
-    }
+    return state->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
 }
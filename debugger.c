@@ -0,0 +1,465 @@
+#include "debugger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tools.h"
+
+const uint64_t DEBUG_CONTINUE_LIMIT = 100000000u; // instructions `c` runs before giving control back
+const uint32_t DEBUG_LIST_LENGTH = 10u;
+const uint32_t DEBUG_DUMP_LENGTH = 64u;
+
+static void watched(Chip8Watch *watch, Chip8State *state, uint32_t addr, uint8_t old)
+{
+    Chip8Debugger *debugger = (Chip8Debugger *)watch;
+    if (debugger->watchHit || !Chip8HasWatchpoint(debugger, addr))
+    {
+        return; // only the first watched byte an instruction writes is reported
+    }
+    debugger->watchHit = 1;
+    debugger->watchAddr = addr;
+    debugger->watchOld = old;
+    debugger->watchPC = state->PC; // instructions move the PC on after writing
+}
+
+Chip8Debugger *AttachChip8Debugger(Chip8State *state)
+{
+    Chip8Debugger *debugger = calloc(sizeof(Chip8Debugger), 1);
+    if (!debugger)
+    {
+        return NULL;
+    }
+    debugger->state = state;
+    debugger->emulate = GetChip8Emulator((Chip8Profile)state->profile);
+    debugger->breakpoints = calloc(state->memorySize / 8, 1);
+    debugger->watchpoints = calloc(state->memorySize / 8, 1);
+    if (!debugger->breakpoints || !debugger->watchpoints)
+    {
+        DetachChip8Debugger(debugger);
+        return NULL;
+    }
+    debugger->watch.written = watched;
+    SetChip8Watch(state, &debugger->watch);
+    return debugger;
+}
+
+void DetachChip8Debugger(Chip8Debugger *debugger)
+{
+    if (!debugger)
+    {
+        return;
+    }
+    if (debugger->state->watch == &debugger->watch)
+    {
+        SetChip8Watch(debugger->state, NULL);
+    }
+    free(debugger->breakpoints);
+    free(debugger->watchpoints);
+    free(debugger);
+}
+
+void SetChip8Breakpoint(Chip8Debugger *debugger, uint32_t addr, int on)
+{
+    addr &= debugger->state->memorySize - 1;
+    if (Chip8HasBreakpoint(debugger, addr) == !!on)
+    {
+        return;
+    }
+    debugger->breakpoints[addr >> 3] ^= 1u << (addr & 7);
+    debugger->breakpointCount += on ? 1 : -1;
+}
+
+void SetChip8Watchpoint(Chip8Debugger *debugger, uint32_t addr, int on)
+{
+    Chip8State *state = debugger->state;
+    addr &= state->memorySize - 1;
+    if (Chip8HasWatchpoint(debugger, addr) == !!on)
+    {
+        return;
+    }
+    debugger->watchpoints[addr >> 3] ^= 1u << (addr & 7);
+    debugger->watchpointCount += on ? 1 : -1;
+
+    // a page is watched while it has any watchpoints in it
+    uint32_t page = addr >> state->pageShift;
+    debugger->pageWatchpoints[page] += on ? 1 : -1;
+    if (debugger->pageWatchpoints[page])
+        debugger->watch.pages |= 1u << page;
+    else
+        debugger->watch.pages &= ~(1u << page);
+    SetChip8Watch(state, &debugger->watch);
+}
+
+// one instruction, ticking the timers every CHIP8_TICK_INSTRUCTIONS as the headless tools do
+static inline void step(Chip8Debugger *debugger, Chip8Emulator emulate, Chip8State *state)
+{
+    emulate(state);
+    if (++debugger->sinceTick == CHIP8_TICK_INSTRUCTIONS)
+    {
+        debugger->sinceTick = 0;
+        TickChip8Timers(state);
+    }
+}
+
+Chip8DebugStop RunChip8Debugger(Chip8Debugger *debugger, uint64_t instructions, uint64_t *ran)
+{
+    Chip8State *state = debugger->state;
+    Chip8Emulator emulate = debugger->emulate;
+    const uint8_t *breakpoints = debugger->breakpoints;
+    uint32_t mask = state->memorySize - 1;
+    uint64_t i = 0;
+    Chip8DebugStop stop = CHIP8_DEBUG_DONE;
+    debugger->watchHit = 0;
+
+    if (!debugger->breakpointCount && !debugger->watchpointCount)
+    {
+        for (; i < instructions; ++i)
+        {
+            step(debugger, emulate, state);
+        }
+        *ran = i;
+        return stop;
+    }
+
+    // the instruction at the PC runs even if it has a breakpoint
+    if (instructions)
+    {
+        step(debugger, emulate, state);
+        i = 1;
+    }
+
+    if (!debugger->watchpointCount)
+    {
+        for (; i < instructions; ++i)
+        {
+            uint32_t pc = state->PC & mask;
+            if ((breakpoints[pc >> 3] >> (pc & 7)) & 1)
+            {
+                stop = CHIP8_DEBUG_BREAKPOINT;
+                break;
+            }
+            step(debugger, emulate, state);
+        }
+    }
+    else
+    {
+        for (; i < instructions && !debugger->watchHit; ++i)
+        {
+            uint32_t pc = state->PC & mask;
+            if ((breakpoints[pc >> 3] >> (pc & 7)) & 1)
+            {
+                stop = CHIP8_DEBUG_BREAKPOINT;
+                break;
+            }
+            step(debugger, emulate, state);
+        }
+        if (debugger->watchHit)
+        {
+            stop = CHIP8_DEBUG_WATCHPOINT;
+        }
+    }
+
+    *ran = i;
+    return stop;
+}
+
+Chip8DebugStop StepOverChip8(Chip8Debugger *debugger, uint64_t instructions, uint64_t *ran)
+{
+    Chip8State *state = debugger->state;
+    if ((Chip8ReadMemory(state, state->PC) & 0xF0) != 0x20)
+    {
+        return RunChip8Debugger(debugger, instructions ? 1 : 0, ran);
+    }
+
+    // run until the call returns: a breakpoint where it returns to, taken
+    //  only once the stack is back where it was (a recursive call passes it)
+    uint32_t back = (state->PC + 2u) & (state->memorySize - 1);
+    uint16_t depth = state->SP;
+    int temporary = !Chip8HasBreakpoint(debugger, back);
+    if (temporary)
+    {
+        SetChip8Breakpoint(debugger, back, 1);
+    }
+
+    uint64_t total = 0;
+    Chip8DebugStop stop;
+    do
+    {
+        uint64_t step;
+        stop = RunChip8Debugger(debugger, instructions - total, &step);
+        total += step;
+    } while (stop == CHIP8_DEBUG_BREAKPOINT && state->PC == back && state->SP > depth && total < instructions);
+
+    if (temporary)
+    {
+        SetChip8Breakpoint(debugger, back, 0);
+        if (stop == CHIP8_DEBUG_BREAKPOINT && state->PC == back)
+        {
+            stop = CHIP8_DEBUG_DONE;
+        }
+    }
+    *ran = total;
+    return stop;
+}
+
+// the machine's memory in one piece, for the disassembler (which reads past the end of the last instruction)
+static uint8_t *flatten(const Chip8State *state)
+{
+    uint8_t *flat = calloc(state->memorySize + 4, 1);
+    for (uint32_t addr = 0; flat && addr < state->memorySize; ++addr)
+    {
+        flat[addr] = Chip8ReadMemory(state, addr);
+    }
+    return flat;
+}
+
+static void listCode(const Chip8Debugger *debugger, uint32_t from, uint32_t count)
+{
+    const Chip8State *state = debugger->state;
+    uint8_t *flat = flatten(state);
+    if (!flat)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t addr = (from + i * 2) & (state->memorySize - 1);
+        printf("%c%s", Chip8HasBreakpoint(debugger, addr) ? '*' : ' ', addr == state->PC ? "-> " : "   ");
+        disassembleChip8(flat, (int)addr);
+        printf("\n");
+    }
+    free(flat);
+}
+
+static void printRegisters(const Chip8State *state)
+{
+    printf("PC %04x  I %04x  SP %x  DT %02x  ST %02x  keys %04x%s%s\n", state->PC, state->I, state->SP,
+           state->delay, state->sound, state->keys, state->hires ? "  hires" : "", state->halted ? "  halted" : "");
+    for (int r = 0; r < 0x10; ++r)
+    {
+        printf("V%X %02x%s", r, state->V[r], r == 0x7 || r == 0xF ? "\n" : "  ");
+    }
+    if (state->SP)
+    {
+        printf("stack");
+        for (uint32_t s = 0; s < state->SP && s < STACK_DEPTH; ++s)
+        {
+            printf(" %04x", state->stack[s]);
+        }
+        printf("\n");
+    }
+}
+
+static void dumpMemory(const Chip8Debugger *debugger, uint32_t from, uint32_t length)
+{
+    const Chip8State *state = debugger->state;
+    for (uint32_t line = 0; line < length; line += 16)
+    {
+        uint32_t addr = (from + line) & (state->memorySize - 1);
+        printf("%04x ", addr);
+        for (uint32_t b = 0; b < 16 && line + b < length; ++b)
+        {
+            uint32_t at = (addr + b) & (state->memorySize - 1);
+            printf("%c%02x", Chip8HasWatchpoint(debugger, at) ? '*' : ' ', Chip8ReadMemory(state, at));
+        }
+        printf("\n");
+    }
+}
+
+static void listPoints(const Chip8Debugger *debugger, const uint8_t *bits, const char *what)
+{
+    printf("%s:", what);
+    for (uint32_t addr = 0; addr < debugger->state->memorySize; ++addr)
+    {
+        if ((bits[addr >> 3] >> (addr & 7)) & 1)
+        {
+            printf(" %04x", addr);
+        }
+    }
+    printf("\n");
+}
+
+static void reportStop(const Chip8Debugger *debugger, Chip8DebugStop stop, uint64_t ran)
+{
+    const Chip8State *state = debugger->state;
+    switch (stop)
+    {
+    case CHIP8_DEBUG_BREAKPOINT:
+        printf("breakpoint at %04x after %llu instructions\n", state->PC, (unsigned long long)ran);
+        break;
+    case CHIP8_DEBUG_WATCHPOINT:
+        printf("watchpoint: %04x %02x -> %02x, written by %04x\n", debugger->watchAddr, debugger->watchOld,
+               Chip8ReadMemory(state, debugger->watchAddr), debugger->watchPC);
+        break;
+    default:
+        if (state->halted)
+            printf("halted\n");
+        break;
+    }
+    listCode(debugger, state->PC, 1);
+}
+
+static const char *DEBUG_HELP =
+    "s [n]            step n instructions (1)\n"
+    "n                step over a call\n"
+    "c [n]            continue until a breakpoint or watchpoint (for at most n instructions)\n"
+    "b [addr]         toggle a breakpoint; list them with no address\n"
+    "w [addr [len]]   toggle write watchpoints on len bytes (1); list them with no address\n"
+    "r                registers\n"
+    "m [addr [len]]   memory (from I)\n"
+    "l [addr [n]]     list n instructions (from PC)\n"
+    "k [keys]         hold keys, as a hex mask of 0-F\n"
+    "reset            restart the ROM, keeping breakpoints and watchpoints\n"
+    "q                quit\n";
+
+/**
+ * Console debugger for a ROM
+ * Numbers are hex, as in the disassembly; an empty line repeats a step.
+ * usage: debug [--profile <name>] <rom>
+ */
+int debug_main(int argc, char **argv)
+{
+    Chip8Profile profile = CHIP8_PROFILE_DEFAULT;
+    const char *romPath = NULL;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (strcmp(argv[a], "--profile") == 0 && a + 1 < argc)
+        {
+            profile = Chip8ProfileFromName(argv[++a]);
+            if (profile == CHIP8_PROFILE_COUNT)
+            {
+                printf("ERROR: Unknown profile %s\n", argv[a]);
+                return 1;
+            }
+        }
+        else if (!romPath && argv[a][0] != '-')
+        {
+            romPath = argv[a];
+        }
+        else
+        {
+            romPath = NULL;
+            break;
+        }
+    }
+    if (!romPath)
+    {
+        printf("usage: debug [--profile <name>] <rom>\n");
+        return 1;
+    }
+
+    Chip8Image *image = LoadChip8Image(profile, romPath);
+    if (!image)
+    {
+        printf("ERROR: Couldn't open %s\n", romPath);
+        return 2;
+    }
+    Chip8State *state = InitChip8(image);
+    Chip8Debugger *debugger = state ? AttachChip8Debugger(state) : NULL;
+    if (!debugger)
+    {
+        printf("ERROR: Out of memory\n");
+        return 3;
+    }
+
+    printf("%s, %s profile; h for help\n", romPath, Chip8ProfileName(profile));
+    listCode(debugger, state->PC, 1);
+
+    char line[256];
+    char last[256] = "";
+    for (;;)
+    {
+        printf("(chip8) ");
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin))
+        {
+            break;
+        }
+        if (line[0] == '\n' && (last[0] == 's' || last[0] == 'n'))
+        {
+            strcpy(line, last);
+        }
+
+        char command[16] = "";
+        char first[32] = "";
+        char second[32] = "";
+        int args = sscanf(line, "%15s %31s %31s", command, first, second);
+        if (args < 1)
+        {
+            continue;
+        }
+        strcpy(last, line);
+        uint32_t a = args > 1 ? (uint32_t)strtoul(first, NULL, 16) : 0;
+        uint32_t b = args > 2 ? (uint32_t)strtoul(second, NULL, 16) : 0;
+        uint64_t ran;
+
+        if (strcmp(command, "s") == 0)
+        {
+            Chip8DebugStop stop = RunChip8Debugger(debugger, args > 1 ? a : 1, &ran);
+            reportStop(debugger, stop, ran);
+        }
+        else if (strcmp(command, "n") == 0)
+        {
+            Chip8DebugStop stop = StepOverChip8(debugger, DEBUG_CONTINUE_LIMIT, &ran);
+            reportStop(debugger, stop, ran);
+        }
+        else if (strcmp(command, "c") == 0)
+        {
+            uint64_t limit = args > 1 ? a : DEBUG_CONTINUE_LIMIT;
+            Chip8DebugStop stop = RunChip8Debugger(debugger, limit, &ran);
+            if (stop == CHIP8_DEBUG_DONE && !state->halted)
+                printf("still running after %llu instructions\n", (unsigned long long)ran);
+            reportStop(debugger, stop, ran);
+        }
+        else if (strcmp(command, "b") == 0)
+        {
+            if (args > 1)
+                SetChip8Breakpoint(debugger, a, !Chip8HasBreakpoint(debugger, a));
+            listPoints(debugger, debugger->breakpoints, "breakpoints");
+        }
+        else if (strcmp(command, "w") == 0)
+        {
+            for (uint32_t i = 0; args > 1 && i < (args > 2 ? b : 1); ++i)
+            {
+                SetChip8Watchpoint(debugger, a + i, !Chip8HasWatchpoint(debugger, a + i));
+            }
+            listPoints(debugger, debugger->watchpoints, "watchpoints");
+        }
+        else if (strcmp(command, "r") == 0)
+        {
+            printRegisters(state);
+        }
+        else if (strcmp(command, "m") == 0)
+        {
+            dumpMemory(debugger, args > 1 ? a : state->I, args > 2 ? b : DEBUG_DUMP_LENGTH);
+        }
+        else if (strcmp(command, "l") == 0)
+        {
+            listCode(debugger, args > 1 ? a : state->PC, args > 2 ? b : DEBUG_LIST_LENGTH);
+        }
+        else if (strcmp(command, "k") == 0)
+        {
+            state->keys = (uint16_t)a;
+            printf("keys %04x\n", state->keys);
+        }
+        else if (strcmp(command, "reset") == 0)
+        {
+            ResetChip8(state);
+            listCode(debugger, state->PC, 1);
+        }
+        else if (strcmp(command, "q") == 0)
+        {
+            break;
+        }
+        else
+        {
+            printf("%s", DEBUG_HELP);
+        }
+    }
+
+    DetachChip8Debugger(debugger);
+    DestroyChip8(state);
+    DestroyChip8Image(image);
+    return 0;
+}
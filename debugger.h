@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// why RunChip8Debugger returned
+typedef enum Chip8DebugStop
+{
+    CHIP8_DEBUG_DONE,       // ran every instruction asked for
+    CHIP8_DEBUG_BREAKPOINT, // the PC reached a breakpoint (the instruction there hasn't run)
+    CHIP8_DEBUG_WATCHPOINT, // the last instruction wrote to a watched address
+} Chip8DebugStop;
+
+/**
+ * Debugger
+ * Breakpoints are one bit per address of the machine's memory (4096 bits,
+ *  or 65536 on XO-CHIP), and so are watchpoints; the pages watchpoints are
+ *  in are watched through Chip8Watch, so writes anywhere else stay on the
+ *  fast path. RunChip8Debugger picks its loop for what is set: with
+ *  nothing set it just calls the core, with breakpoints it adds one bit
+ *  test per instruction.
+ */
+typedef struct Chip8Debugger
+{
+    Chip8Watch watch; // first, so the watch callback's pointer is the debugger's
+    Chip8State *state;
+    Chip8Emulator emulate;
+    uint8_t *breakpoints; // bit per address
+    uint8_t *watchpoints; // bit per address
+    uint32_t breakpointCount;
+    uint32_t watchpointCount;
+    uint16_t pageWatchpoints[PAGE_COUNT]; // watchpoints in each page
+    // the write that stopped the last run
+    uint8_t watchHit;
+    uint8_t watchOld;
+    uint16_t watchPC; // the instruction that made it
+    uint32_t watchAddr;
+    uint32_t sinceTick; // instructions run since the timers last ticked
+} Chip8Debugger;
+
+// debug a machine; returns NULL if out of memory
+Chip8Debugger *AttachChip8Debugger(Chip8State *state);
+
+// remove every watch and free; the machine carries on as it was
+void DetachChip8Debugger(Chip8Debugger *debugger);
+
+void SetChip8Breakpoint(Chip8Debugger *debugger, uint32_t addr, int on);
+void SetChip8Watchpoint(Chip8Debugger *debugger, uint32_t addr, int on);
+
+static inline int Chip8HasBreakpoint(const Chip8Debugger *debugger, uint32_t addr)
+{
+    addr &= debugger->state->memorySize - 1;
+    return (debugger->breakpoints[addr >> 3] >> (addr & 7)) & 1;
+}
+
+static inline int Chip8HasWatchpoint(const Chip8Debugger *debugger, uint32_t addr)
+{
+    addr &= debugger->state->memorySize - 1;
+    return (debugger->watchpoints[addr >> 3] >> (addr & 7)) & 1;
+}
+
+// run up to `instructions`, stopping early at a breakpoint or watchpoint; a
+//  breakpoint on the first instruction doesn't stop it, so a run can carry
+//  on from one. *ran is set to the instructions run.
+Chip8DebugStop RunChip8Debugger(Chip8Debugger *debugger, uint64_t instructions, uint64_t *ran);
+
+// run one instruction, or a whole subroutine if it's a call (up to `instructions` in all)
+Chip8DebugStop StepOverChip8(Chip8Debugger *debugger, uint64_t instructions, uint64_t *ran);
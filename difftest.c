@@ -0,0 +1,568 @@
+#include <SDL/SDL.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "difftest.h"
+#include "tools.h"
+
+const uint64_t DIFFTEST_DEFAULT_INSTRUCTIONS = 10000000u;
+const uint64_t DIFFTEST_DEFAULT_EVERY = 1000u;
+const int DIFFTEST_CONTEXT = 5; // instructions shown either side of the one that differs
+
+uint64_t RunChip8Reference(Chip8State *state, uint64_t instructions)
+{
+    for (uint64_t i = 0; i < instructions; ++i)
+    {
+        EmulateChip8(state);
+    }
+    return instructions;
+}
+
+uint64_t RunChip8Runner(Chip8State *state, uint64_t instructions)
+{
+    // every event the frontends stop at, so their early returns get checked too
+    Chip8Until until = {0, CHIP8_UNTIL_DISPLAY | CHIP8_UNTIL_KEY_WAIT | CHIP8_UNTIL_TIMER_READ, 0};
+    uint64_t done = 0;
+    while (done < instructions)
+    {
+        uint64_t ran;
+        until.instructions = instructions - done;
+        Chip8Stop stop = RunChip8Until(state, &until, &ran);
+        done += ran;
+        if (stop == CHIP8_STOP_HALTED)
+        {
+            // the reference steps a halted machine on the spot, so count the rest as run
+            return instructions;
+        }
+    }
+    return done;
+}
+
+int LoadChip8Movie(Chip8Movie *movie, const char *path)
+{
+    movie->frames = NULL;
+    movie->count = 0;
+
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return 0;
+    }
+
+    uint32_t capacity = 0;
+    char line[256];
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), file))
+    {
+        char *text = line + strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\r' || *text == '\0')
+        {
+            continue;
+        }
+
+        unsigned long long at;
+        unsigned int keys;
+        if (sscanf(text, "%llu %x", &at, &keys) != 2 || (movie->count && at < movie->frames[movie->count - 1].at))
+        {
+            ok = 0;
+            break;
+        }
+
+        if (movie->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            Chip8MovieFrame *frames = realloc(movie->frames, capacity * sizeof(Chip8MovieFrame));
+            if (!frames)
+            {
+                ok = 0;
+                break;
+            }
+            movie->frames = frames;
+        }
+        movie->frames[movie->count].at = at;
+        movie->frames[movie->count].keys = (uint16_t)keys;
+        ++movie->count;
+    }
+    fclose(file);
+
+    if (!ok)
+    {
+        FreeChip8Movie(movie);
+    }
+    return ok;
+}
+
+void FreeChip8Movie(Chip8Movie *movie)
+{
+    free(movie->frames);
+    movie->frames = NULL;
+    movie->count = 0;
+}
+
+uint64_t RunChip8Movie(Chip8Engine engine, Chip8State *state, const Chip8Movie *movie, uint64_t from, uint64_t instructions)
+{
+    // the first key change at or after `from`
+    uint32_t next = 0;
+    if (movie)
+    {
+        uint32_t high = movie->count;
+        while (next < high)
+        {
+            uint32_t mid = next + (high - next) / 2;
+            if (movie->frames[mid].at < from)
+                next = mid + 1;
+            else
+                high = mid;
+        }
+    }
+
+    // run in spans between key changes
+    uint64_t done = 0;
+    while (done < instructions)
+    {
+        uint64_t now = from + done;
+        while (movie && next < movie->count && movie->frames[next].at <= now)
+        {
+            state->keys = movie->frames[next++].keys;
+        }
+
+        uint64_t span = instructions - done;
+        if (movie && next < movie->count && movie->frames[next].at - now < span)
+        {
+            span = movie->frames[next].at - now;
+        }
+        uint64_t toTick = CHIP8_TICK_INSTRUCTIONS - now % CHIP8_TICK_INSTRUCTIONS;
+        span = toTick < span ? toTick : span;
+
+        uint64_t ran = engine(state, span);
+        done += ran;
+        if (ran && (from + done) % CHIP8_TICK_INSTRUCTIONS == 0)
+        {
+            TickChip8Timers(state);
+        }
+        if (ran < span)
+        {
+            break;
+        }
+    }
+
+    return done;
+}
+
+#define DIFF_FIELD(field)                                                                        \
+    if (a->field != b->field)                                                                    \
+    {                                                                                            \
+        if (report)                                                                              \
+            printf("  %-12s %8x %8x\n", #field, (unsigned int)a->field, (unsigned int)b->field); \
+        ++differences;                                                                           \
+    }
+
+// count (and optionally print) the differences between two machines
+static int compareStates(const Chip8State *a, const Chip8State *b, int report)
+{
+    int differences = 0;
+    char name[16];
+
+    DIFF_FIELD(PC);
+    DIFF_FIELD(I);
+    DIFF_FIELD(SP);
+    DIFF_FIELD(delay);
+    DIFF_FIELD(sound);
+    DIFF_FIELD(awaitingKey);
+    DIFF_FIELD(hires);
+    DIFF_FIELD(planes);
+    DIFF_FIELD(halted);
+    DIFF_FIELD(pitch);
+    DIFF_FIELD(rng);
+    for (int r = 0; r < 0x10; ++r)
+    {
+        snprintf(name, sizeof(name), "V%X", r);
+        if (a->V[r] != b->V[r])
+        {
+            if (report)
+                printf("  %-12s %8x %8x\n", name, a->V[r], b->V[r]);
+            ++differences;
+        }
+        snprintf(name, sizeof(name), "flags[%X]", r);
+        if (a->flags[r] != b->flags[r])
+        {
+            if (report)
+                printf("  %-12s %8x %8x\n", name, a->flags[r], b->flags[r]);
+            ++differences;
+        }
+        snprintf(name, sizeof(name), "pattern[%X]", r);
+        if (a->audioPattern[r] != b->audioPattern[r])
+        {
+            if (report)
+                printf("  %-12s %8x %8x\n", name, a->audioPattern[r], b->audioPattern[r]);
+            ++differences;
+        }
+        // only the live stack counts, as in HashChip8Registers; held keys are input, the same for both
+        snprintf(name, sizeof(name), "stack[%X]", r);
+        if (r < a->SP && r < b->SP && a->stack[r] != b->stack[r])
+        {
+            if (report)
+                printf("  %-12s %8x %8x\n", name, a->stack[r], b->stack[r]);
+            ++differences;
+        }
+    }
+
+    int memory = 0;
+    for (uint32_t addr = 0; addr < a->memorySize; ++addr)
+    {
+        uint8_t byteA = Chip8ReadMemory(a, addr);
+        uint8_t byteB = Chip8ReadMemory(b, addr);
+        if (byteA != byteB)
+        {
+            if (report && memory < 8)
+                printf("  [%04x]       %8x %8x\n", addr, byteA, byteB);
+            ++memory;
+        }
+    }
+    if (report && memory > 8)
+        printf("  ...and %d more bytes of memory\n", memory - 8);
+
+    int rows = 0;
+    for (uint32_t p = 0; p < DISPLAY_PLANES; ++p)
+    {
+        for (uint32_t y = 0; y < HIRES_HEIGHT; ++y)
+        {
+            if (memcmp(a->display[p][y], b->display[p][y], sizeof(a->display[p][y])))
+            {
+                if (report && rows == 0)
+                    printf("  display      plane %u row %u first\n", p + 1, y);
+                ++rows;
+            }
+        }
+    }
+    if (report && rows)
+        printf("  display      %d rows differ\n", rows);
+
+    return differences + memory + rows;
+}
+
+// the code around the machine's PC, the instruction there marked
+static void printContext(const Chip8State *state)
+{
+    uint8_t *flat = malloc(state->memorySize);
+    if (!flat)
+    {
+        return;
+    }
+    for (uint32_t addr = 0; addr < state->memorySize; ++addr)
+    {
+        flat[addr] = Chip8ReadMemory(state, addr);
+    }
+
+    int pc = state->PC & (state->memorySize - 1);
+    for (int i = -DIFFTEST_CONTEXT; i <= DIFFTEST_CONTEXT; ++i)
+    {
+        int addr = pc + i * 2;
+        if (addr < 0 || addr + 1 >= (int)state->memorySize)
+        {
+            continue;
+        }
+        printf("%s", i ? "    " : " -> ");
+        disassembleChip8(flat, addr);
+        printf("\n");
+    }
+
+    free(flat);
+}
+
+/**
+ * Find the first instruction the engines disagree on
+ * Both engines agreed at the checkpoint, so each is rerun from a copy of
+ *  it for 1, 2, 3... instructions and the results compared in full. Each
+ *  rerun is a single call of `count` instructions rather than single
+ *  steps, so engines that only take their fast path with enough budget
+ *  (like recompiled blocks) behave as they did the first time round.
+ */
+static uint64_t findDivergence(Chip8Engine engineA, Chip8Engine engineB, const Chip8Movie *movie, const Chip8State *checkpoint, uint64_t from, uint64_t span)
+{
+    Chip8State *a = CloneChip8(checkpoint);
+    Chip8State *b = CloneChip8(checkpoint);
+    uint64_t found = 0;
+
+    for (uint64_t count = 1; count <= span && !found; ++count)
+    {
+        CopyChip8(a, checkpoint);
+        CopyChip8(b, checkpoint);
+        uint64_t ranA = RunChip8Movie(engineA, a, movie, from, count);
+        uint64_t ranB = RunChip8Movie(engineB, b, movie, from, count);
+        if (ranA == ranB && !compareStates(a, b, 0))
+        {
+            continue;
+        }
+
+        found = from + count;
+        printf("engines differ after instruction %llu\n", (unsigned long long)found);
+        if (ranA != ranB)
+        {
+            printf("  ran          %8llu %8llu\n", (unsigned long long)ranA, (unsigned long long)ranB);
+        }
+        printf("  %-12s %8s %8s\n", "", "A", "B");
+        compareStates(a, b, 1);
+
+        // where both were just before it
+        CopyChip8(a, checkpoint);
+        RunChip8Movie(engineA, a, movie, from, count - 1);
+        printf("\nrunning:\n");
+        printContext(a);
+    }
+
+    if (!found)
+    {
+        found = from + span;
+        printf("engines differ by instruction %llu, but not when rerun from %llu (is one of them nondeterministic?)\n",
+               (unsigned long long)found, (unsigned long long)from);
+    }
+
+    DestroyChip8(a);
+    DestroyChip8(b);
+    return found;
+}
+
+/**
+ * Incremental state hash
+ * Between checkpoints a machine usually writes a page or two and redraws
+ *  part of the screen, so each keeps a hash per page and per display row
+ *  and redoes only those that may have changed. A write watch on every
+ *  page drops each page at its first write, so a page traps at most once
+ *  per checkpoint; rows are found by comparing with the display as last
+ *  hashed, which is far cheaper than hashing it. Machines in the same
+ *  state hash the same, though not as HashChip8State.
+ */
+typedef struct HashTracker
+{
+    Chip8Watch watch; // first, so the watch callback's pointer is the tracker's
+    uint16_t written; // pages written since the last hash
+    uint64_t pages[PAGE_COUNT];
+    uint64_t rows[DISPLAY_PLANES][HIRES_HEIGHT];
+    Chip8Display display; // as last hashed
+} HashTracker;
+
+static void trackWrite(Chip8Watch *watch, Chip8State *state, uint32_t addr, uint8_t old)
+{
+    HashTracker *tracker = (HashTracker *)watch;
+    uint32_t page = addr >> state->pageShift;
+    tracker->written |= 1u << page;
+    // let the rest of this page's writes through until the next hash
+    watch->pages &= ~(1u << page);
+    SetChip8Watch(state, watch);
+}
+
+static uint64_t hashPage(const Chip8State *state, uint32_t page)
+{
+    // as HashChip8Memory does
+    return state->privatePages & (1u << page) ? HashChip8Bytes(page, state->pages[page], (size_t)1 << state->pageShift) : state->image->pageHashes[page];
+}
+
+static void startTracking(HashTracker *tracker, Chip8State *state)
+{
+    tracker->watch.pages = (uint16_t)((1u << PAGE_COUNT) - 1);
+    tracker->watch.written = trackWrite;
+    tracker->written = 0;
+    for (uint32_t page = 0; page < PAGE_COUNT; ++page)
+    {
+        tracker->pages[page] = hashPage(state, page);
+    }
+    for (uint32_t p = 0; p < DISPLAY_PLANES; ++p)
+    {
+        for (uint32_t y = 0; y < HIRES_HEIGHT; ++y)
+        {
+            tracker->rows[p][y] = HashChip8Bytes(y, state->display[p][y], sizeof(state->display[p][y]));
+        }
+    }
+    memcpy(tracker->display, state->display, sizeof(tracker->display));
+    SetChip8Watch(state, &tracker->watch);
+}
+
+static uint64_t trackedHash(HashTracker *tracker, Chip8State *state)
+{
+    for (uint32_t page = 0; page < PAGE_COUNT; ++page)
+    {
+        if (tracker->written & (1u << page))
+        {
+            tracker->pages[page] = hashPage(state, page);
+        }
+    }
+    tracker->watch.pages |= tracker->written;
+    tracker->written = 0;
+    SetChip8Watch(state, &tracker->watch);
+
+    for (uint32_t p = 0; p < DISPLAY_PLANES; ++p)
+    {
+        for (uint32_t y = 0; y < HIRES_HEIGHT; ++y)
+        {
+            const uint64_t *row = state->display[p][y];
+            uint64_t *last = tracker->display[p][y];
+            if (row[0] != last[0] || row[1] != last[1])
+            {
+                tracker->rows[p][y] = HashChip8Bytes(y, row, sizeof(state->display[p][y]));
+                last[0] = row[0];
+                last[1] = row[1];
+            }
+        }
+    }
+
+    uint64_t hash = HashChip8Bytes(HashChip8Registers(state), tracker->rows, sizeof(tracker->rows));
+    return HashChip8Bytes(hash, tracker->pages, sizeof(tracker->pages));
+}
+
+uint64_t RunChip8DiffTest(const Chip8Image *image, Chip8Engine engineA, Chip8Engine engineB, const Chip8Movie *movie, uint64_t instructions, uint64_t every)
+{
+    Chip8State *a = InitChip8(image);
+    Chip8State *b = InitChip8(image);
+    Chip8State *checkpoint = InitChip8(image);
+    if (!a || !b || !checkpoint)
+    {
+        printf("ERROR: Out of memory\n");
+        exit(3);
+    }
+
+    HashTracker trackA, trackB;
+    startTracking(&trackA, a);
+    startTracking(&trackB, b);
+
+    uint64_t done = 0;
+    uint64_t diverged = 0;
+    while (done < instructions && !diverged)
+    {
+        uint64_t span = instructions - done < every ? instructions - done : every;
+        CopyChip8(checkpoint, a);
+
+        uint64_t ranA = RunChip8Movie(engineA, a, movie, done, span);
+        uint64_t ranB = RunChip8Movie(engineB, b, movie, done, span);
+        if (ranA != span || ranB != span || trackedHash(&trackA, a) != trackedHash(&trackB, b))
+        {
+            diverged = findDivergence(engineA, engineB, movie, checkpoint, done, span);
+        }
+        done += span;
+    }
+
+    DestroyChip8(a);
+    DestroyChip8(b);
+    DestroyChip8(checkpoint);
+    return diverged;
+}
+
+/**
+ * Runs the reference interpreter against another engine on a ROM
+ * The other engine is RunChip8Until's loop, or a function loaded from a
+ *  shared library, e.g. a recompiled ROM built with
+ *  `cc -shared -fPIC rom.c` against this executable's exported symbols.
+ * usage: difftest [--profile name] [--every n] [--movie file] [--engine lib:function] <rom> [instructions]
+ */
+int difftest_main(int argc, char **argv)
+{
+    Chip8Profile profile = CHIP8_PROFILE_DEFAULT;
+    uint64_t every = DIFFTEST_DEFAULT_EVERY;
+    const char *moviePath = NULL;
+    const char *enginePath = NULL;
+    const char *rom = NULL;
+    uint64_t instructions = DIFFTEST_DEFAULT_INSTRUCTIONS;
+    int badArgs = 0;
+    for (int a = 1; a < argc && !badArgs; ++a)
+    {
+        if (strcmp(argv[a], "--profile") == 0 && a + 1 < argc)
+        {
+            profile = Chip8ProfileFromName(argv[++a]);
+            badArgs = profile == CHIP8_PROFILE_COUNT;
+        }
+        else if (strcmp(argv[a], "--every") == 0 && a + 1 < argc)
+        {
+            every = strtoull(argv[++a], NULL, 0);
+            badArgs = every == 0;
+        }
+        else if (strcmp(argv[a], "--movie") == 0 && a + 1 < argc)
+        {
+            moviePath = argv[++a];
+        }
+        else if (strcmp(argv[a], "--engine") == 0 && a + 1 < argc)
+        {
+            enginePath = argv[++a];
+        }
+        else if (!rom && argv[a][0] != '-')
+        {
+            rom = argv[a];
+        }
+        else if (rom && argv[a][0] != '-')
+        {
+            instructions = strtoull(argv[a], NULL, 0);
+        }
+        else
+        {
+            badArgs = 1;
+        }
+    }
+    if (!rom || badArgs)
+    {
+        printf("usage: difftest [--profile default|vip|chip48|schip|xochip] [--every n] [--movie file] [--engine lib:function] <rom> [instructions]\n");
+        return 1;
+    }
+
+    Chip8Image *image = LoadChip8Image(profile, rom);
+    if (!image)
+    {
+        printf("ERROR: Couldn't open %s\n", rom);
+        return 2;
+    }
+
+    Chip8Movie movie = {NULL, 0};
+    if (moviePath && !LoadChip8Movie(&movie, moviePath))
+    {
+        printf("ERROR: Couldn't read movie %s\n", moviePath);
+        return 2;
+    }
+
+    Chip8Engine engine = RunChip8Runner;
+    const char *engineName = "run-until";
+    void *library = NULL;
+    if (enginePath)
+    {
+        // lib:function
+        char path[1024];
+        const char *colon = strrchr(enginePath, ':');
+        size_t length = colon ? (size_t)(colon - enginePath) : 0;
+        if (!colon || length >= sizeof(path))
+        {
+            printf("ERROR: --engine takes library:function\n");
+            return 1;
+        }
+        memcpy(path, enginePath, length);
+        path[length] = '\0';
+
+        library = SDL_LoadObject(path);
+        engine = library ? (Chip8Engine)SDL_LoadFunction(library, colon + 1) : NULL;
+        if (!engine)
+        {
+            printf("ERROR: Couldn't load %s: %s\n", enginePath, SDL_GetError());
+            return 2;
+        }
+        engineName = colon + 1;
+    }
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    uint64_t diverged = RunChip8DiffTest(image, RunChip8Reference, engine, moviePath ? &movie : NULL, instructions, every);
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+
+    if (!diverged)
+    {
+        printf("reference and %s agree over %llu instructions (checked every %llu, %.2f s)\n",
+               engineName, (unsigned long long)instructions, (unsigned long long)every, seconds);
+    }
+
+    FreeChip8Movie(&movie);
+    if (library)
+    {
+        SDL_UnloadObject(library);
+    }
+    DestroyChip8Image(image);
+
+    return diverged ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+/**
+ * Execution engine
+ * Anything that can run a machine: the interpreter, a recompiled ROM, ...
+ *  Runs up to the given number of instructions and returns how many it ran.
+ *  Engines under test must be bit-exact with RunChip8Reference.
+ */
+typedef uint64_t (*Chip8Engine)(Chip8State *state, uint64_t instructions);
+
+// EmulateChip8 one instruction at a time
+uint64_t RunChip8Reference(Chip8State *state, uint64_t instructions);
+
+// RunChip8Until's loop instead, stopping at display changes, key waits and timer reads as frontends do
+uint64_t RunChip8Runner(Chip8State *state, uint64_t instructions);
+
+/**
+ * Input movie
+ * Key changes to replay, indexed by instruction rather than time so every
+ *  engine sees the same input at the same point: from instruction `at`
+ *  (counting from 0) on, the held keys are `keys`.
+ * As a file, one change per line: `<at> <keys in hex>`; # starts a comment.
+ */
+typedef struct Chip8MovieFrame
+{
+    uint64_t at;
+    uint16_t keys;
+} Chip8MovieFrame;
+
+typedef struct Chip8Movie
+{
+    Chip8MovieFrame *frames; // in order of at
+    uint32_t count;
+} Chip8Movie;
+
+// returns 0 if the file can't be read or isn't a movie
+int LoadChip8Movie(Chip8Movie *movie, const char *path);
+void FreeChip8Movie(Chip8Movie *movie);
+
+// run an engine on a machine that has already run `from` instructions, replaying the movie (may be NULL)
+//  and ticking the timers after every CHIP8_TICK_INSTRUCTIONS, counting from the start
+uint64_t RunChip8Movie(Chip8Engine engine, Chip8State *state, const Chip8Movie *movie, uint64_t from, uint64_t instructions);
+
+/**
+ * Lockstep differential test
+ * Runs both engines on their own machine from the image, comparing state
+ *  hashes every `every` instructions, rehashing only the pages and display
+ *  rows that changed since the last comparison. On a mismatch it goes back to the
+ *  last matching point to find the exact instruction and prints what
+ *  differs with the code around it. Returns 0 if the engines agreed
+ *  throughout, else the number of instructions after which they first
+ *  differed.
+ */
+uint64_t RunChip8DiffTest(const Chip8Image *image, Chip8Engine a, Chip8Engine b, const Chip8Movie *movie, uint64_t instructions, uint64_t every);
@@ -0,0 +1,597 @@
+#include <SDL/SDL.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "tools.h"
+
+const uint32_t EXPLORE_DEFAULT_DEPTH = 8u;
+const uint32_t EXPLORE_DEFAULT_FRAME = 10u;          // instructions run between inputs
+const uint32_t EXPLORE_DEFAULT_MAX_STATES = 1u << 20;
+const uint32_t EXPLORE_INPUTS = 17u;                 // no key, or one of the 16 held
+const uint32_t EXPLORE_CHUNK = 16u;                  // frontier states a worker claims at a time
+const uint32_t EXPLORE_NO_PARENT = 0xffffffffu;
+
+#define EXPLORE_STRIPES 1024u
+#define EXPLORE_MAX_THREADS 64
+
+// why the search stopped before its depth
+enum
+{
+    EXPLORE_RUNNING,
+    EXPLORE_GOAL,
+    EXPLORE_FULL,
+    EXPLORE_OUT_OF_MEMORY,
+};
+
+/**
+ * Visited set
+ * 64-bit state hashes in open-addressed stripes, each with its own spin
+ *  lock and its own cache line for the lock, so threads only contend when
+ *  two hashes land in the same stripe at once. The top bits of a hash pick
+ *  the stripe and the low bits the slot, probing linearly within the
+ *  stripe. A stripe takes no more than 3/4 of its slots, and a shared
+ *  count (only touched by new states) stops the set at its limit.
+ * Two different states with the same hash would wrongly prune the second;
+ *  with 64 bits and a million states that's about a 1 in 10^7 chance.
+ */
+typedef struct Stripe
+{
+    SDL_SpinLock lock;
+    uint32_t count;
+    uint8_t padding[56];
+} Stripe;
+
+typedef struct StateSet
+{
+    uint64_t *slots; // 0 is an empty slot
+    uint32_t stripeShift; // log2 of the slots per stripe
+    uint32_t limit;       // states it may hold
+    SDL_atomic_t count;
+    Stripe stripes[EXPLORE_STRIPES];
+} StateSet;
+
+// how each state was reached; the root's parent is EXPLORE_NO_PARENT
+typedef struct ExploreStep
+{
+    uint32_t parent;
+    uint8_t input; // 0 no key, k key k - 1 held
+    uint8_t seed;  // 0 the RNG as it was, n reseeded with n
+} ExploreStep;
+
+typedef struct ExploreWorker
+{
+    struct Explorer *explorer;
+    SDL_Thread *thread;
+    Chip8State *work; // a scratch machine; becomes a child when its state is new
+    Chip8State **children; // new states found this level, and how they were reached
+    ExploreStep *steps;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t goal; // index in children of one at the goal, or EXPLORE_NO_PARENT
+    uint64_t runs; // frames run, new state or not
+    uint64_t instructions;
+} ExploreWorker;
+
+/**
+ * Explorer
+ * Breadth-first, a level (frame) at a time: the workers claim the frontier
+ *  in chunks, run every input from each state for a frame, and keep the
+ *  states the visited set hasn't seen as the next level. A state reached
+ *  twice is only expanded once, so a ROM waiting on a key or idling in a
+ *  loop collapses to a handful of states instead of 17^depth.
+ * If a frame draws random numbers (the RNG moved), it is run again with
+ *  each of `seeds` - 1 reseeded RNGs, to branch on what CXNN gives too.
+ * Every state reached is recorded as a step (parent and input) in `trail`,
+ *  8 bytes each, so the inputs to any of them can be played back; only
+ *  the frontier keeps whole machines.
+ */
+typedef struct Explorer
+{
+    const Chip8Image *image;
+    Chip8Until until; // a frame, stopping early at the goal
+    uint32_t frame;
+    uint32_t seeds;
+    uint32_t goalPC; // or EXPLORE_NO_PARENT for none
+    StateSet *set;
+    Chip8State **frontier;
+    uint32_t frontierCount;
+    uint32_t frontierBase; // the trail index of frontier[0]
+    SDL_atomic_t next;     // the next frontier state to claim
+    SDL_atomic_t stop;     // EXPLORE_RUNNING, or why not
+    ExploreStep *trail;
+    uint32_t trailCount;
+    uint32_t trailCapacity;
+    uint32_t goal; // trail index of the state at the goal, or EXPLORE_NO_PARENT
+    ExploreWorker workers[EXPLORE_MAX_THREADS];
+    uint32_t threads;
+} Explorer;
+
+// room for at least `states` hashes; returns NULL if out of memory
+static StateSet *createStateSet(uint32_t states)
+{
+    StateSet *set = calloc(sizeof(StateSet), 1);
+    if (!set)
+    {
+        return NULL;
+    }
+
+    // at least 16 slots a stripe, and no more than 3/4 full
+    set->stripeShift = 4;
+    while (((uint64_t)EXPLORE_STRIPES << set->stripeShift) * 3 / 4 < states)
+    {
+        ++set->stripeShift;
+    }
+    set->limit = states;
+    set->slots = calloc(sizeof(uint64_t), (size_t)EXPLORE_STRIPES << set->stripeShift);
+    if (!set->slots)
+    {
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+static void destroyStateSet(StateSet *set)
+{
+    if (set)
+    {
+        free(set->slots);
+        free(set);
+    }
+}
+
+// returns 1 if the hash is new, 0 if it's been seen, -1 if the set is full
+static int insertState(StateSet *set, uint64_t hash)
+{
+    uint32_t s = (uint32_t)(hash >> 54) & (EXPLORE_STRIPES - 1);
+    uint32_t size = 1u << set->stripeShift;
+    uint64_t *slots = set->slots + ((size_t)s << set->stripeShift);
+    Stripe *stripe = &set->stripes[s];
+
+    SDL_AtomicLock(&stripe->lock);
+    uint32_t i = (uint32_t)hash & (size - 1);
+    while (slots[i] && slots[i] != hash)
+    {
+        i = (i + 1) & (size - 1);
+    }
+    int result = slots[i] ? 0 : -1;
+    if (!slots[i] && stripe->count < size - size / 4 && (uint32_t)SDL_AtomicAdd(&set->count, 1) < set->limit)
+    {
+        slots[i] = hash;
+        ++stripe->count;
+        result = 1;
+    }
+    SDL_AtomicUnlock(&stripe->lock);
+    return result;
+}
+
+static void stopExploring(Explorer *explorer, int reason)
+{
+    SDL_AtomicCAS(&explorer->stop, EXPLORE_RUNNING, reason);
+}
+
+// keep the worker's scratch machine as a child, and get a new one
+static int keepChild(ExploreWorker *worker, uint32_t parent, uint32_t input, uint32_t seed)
+{
+    if (worker->count == worker->capacity)
+    {
+        uint32_t capacity = worker->capacity ? worker->capacity * 2 : 256;
+        Chip8State **children = realloc(worker->children, sizeof(Chip8State *) * capacity);
+        if (children)
+            worker->children = children;
+        ExploreStep *steps = realloc(worker->steps, sizeof(ExploreStep) * capacity);
+        if (steps)
+            worker->steps = steps;
+        if (!children || !steps)
+        {
+            return 0;
+        }
+        worker->capacity = capacity;
+    }
+
+    Chip8State *work = InitChip8(worker->explorer->image);
+    if (!work)
+    {
+        return 0;
+    }
+    worker->children[worker->count] = worker->work;
+    worker->steps[worker->count] = (ExploreStep){parent, (uint8_t)input, (uint8_t)seed};
+    ++worker->count;
+    worker->work = work;
+    return 1;
+}
+
+// run every input (and RNG seed) from one frontier state for a frame
+static void expandState(ExploreWorker *worker, uint32_t index)
+{
+    Explorer *explorer = worker->explorer;
+    const Chip8State *parent = explorer->frontier[index];
+    if (parent->halted)
+    {
+        return;
+    }
+
+    for (uint32_t input = 0; input < EXPLORE_INPUTS; ++input)
+    {
+        uint32_t seeds = 1;
+        for (uint32_t seed = 0; seed < seeds; ++seed)
+        {
+            Chip8State *state = worker->work;
+            CopyChip8(state, parent);
+            state->keys = input ? (uint16_t)(1u << (input - 1)) : 0;
+            if (seed)
+            {
+                state->rng = (parent->rng ^ (seed * 0x9e3779b9u)) | 1;
+            }
+
+            uint64_t ran;
+            RunChip8Until(state, &explorer->until, &ran);
+            TickChip8Timers(state);
+            worker->instructions += ran;
+            ++worker->runs;
+            if (!seed && state->rng != parent->rng)
+            {
+                seeds = explorer->seeds;
+            }
+
+            int result = insertState(explorer->set, HashChip8State(state));
+            if (result < 0)
+            {
+                stopExploring(explorer, EXPLORE_FULL);
+                return;
+            }
+            if (!result)
+            {
+                continue;
+            }
+            if (state->PC == explorer->goalPC && worker->goal == EXPLORE_NO_PARENT)
+            {
+                worker->goal = worker->count;
+                stopExploring(explorer, EXPLORE_GOAL);
+            }
+            if (!keepChild(worker, explorer->frontierBase + index, input, seed))
+            {
+                stopExploring(explorer, EXPLORE_OUT_OF_MEMORY);
+                return;
+            }
+        }
+    }
+}
+
+static int exploreThread(void *data)
+{
+    ExploreWorker *worker = data;
+    Explorer *explorer = worker->explorer;
+    while (SDL_AtomicGet(&explorer->stop) == EXPLORE_RUNNING)
+    {
+        uint32_t start = (uint32_t)SDL_AtomicAdd(&explorer->next, (int)EXPLORE_CHUNK);
+        if (start >= explorer->frontierCount)
+        {
+            break;
+        }
+        uint32_t end = start + EXPLORE_CHUNK < explorer->frontierCount ? start + EXPLORE_CHUNK : explorer->frontierCount;
+        for (uint32_t index = start; index < end; ++index)
+        {
+            expandState(worker, index);
+        }
+    }
+    return 0;
+}
+
+// the workers' children become the frontier; returns 0 if out of memory
+static int nextLevel(Explorer *explorer)
+{
+    uint32_t total = 0;
+    for (uint32_t t = 0; t < explorer->threads; ++t)
+    {
+        total += explorer->workers[t].count;
+    }
+
+    Chip8State **frontier = malloc(sizeof(Chip8State *) * (total ? total : 1));
+    if (explorer->trailCount + total > explorer->trailCapacity)
+    {
+        uint32_t capacity = explorer->trailCapacity * 2 > explorer->trailCount + total ? explorer->trailCapacity * 2 : explorer->trailCount + total;
+        ExploreStep *trail = realloc(explorer->trail, sizeof(ExploreStep) * capacity);
+        if (!trail)
+        {
+            free(frontier);
+            return 0;
+        }
+        explorer->trail = trail;
+        explorer->trailCapacity = capacity;
+    }
+    if (!frontier)
+    {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < explorer->frontierCount; ++i)
+    {
+        DestroyChip8(explorer->frontier[i]);
+    }
+    free(explorer->frontier);
+
+    explorer->frontier = frontier;
+    explorer->frontierCount = total;
+    explorer->frontierBase = explorer->trailCount;
+    for (uint32_t t = 0; t < explorer->threads; ++t)
+    {
+        ExploreWorker *worker = &explorer->workers[t];
+        if (!worker->count)
+        {
+            continue;
+        }
+        if (worker->goal != EXPLORE_NO_PARENT && explorer->goal == EXPLORE_NO_PARENT)
+        {
+            explorer->goal = explorer->trailCount + worker->goal;
+        }
+        memcpy(frontier, worker->children, sizeof(Chip8State *) * worker->count);
+        memcpy(explorer->trail + explorer->trailCount, worker->steps, sizeof(ExploreStep) * worker->count);
+        frontier += worker->count;
+        explorer->trailCount += worker->count;
+        worker->count = 0;
+        worker->goal = EXPLORE_NO_PARENT;
+    }
+    return 1;
+}
+
+// one frame's worth of search from the frontier
+static void exploreLevel(Explorer *explorer)
+{
+    SDL_AtomicSet(&explorer->next, 0);
+    for (uint32_t t = 1; t < explorer->threads; ++t)
+    {
+        ExploreWorker *worker = &explorer->workers[t];
+        worker->thread = SDL_CreateThread(exploreThread, "explore", worker);
+        if (!worker->thread)
+        {
+            stopExploring(explorer, EXPLORE_OUT_OF_MEMORY);
+        }
+    }
+    // this thread is worker 0
+    exploreThread(&explorer->workers[0]);
+    for (uint32_t t = 1; t < explorer->threads; ++t)
+    {
+        if (explorer->workers[t].thread)
+        {
+            SDL_WaitThread(explorer->workers[t].thread, NULL);
+            explorer->workers[t].thread = NULL;
+        }
+    }
+}
+
+// the inputs that reach a state, first frame first
+static void printInputs(const Explorer *explorer, uint32_t id)
+{
+    uint32_t frames = 0;
+    for (uint32_t s = id; explorer->trail[s].parent != EXPLORE_NO_PARENT; s = explorer->trail[s].parent)
+    {
+        ++frames;
+    }
+    uint32_t *path = malloc(sizeof(uint32_t) * (frames ? frames : 1));
+    if (!path)
+    {
+        return;
+    }
+    uint32_t f = frames;
+    for (uint32_t s = id; explorer->trail[s].parent != EXPLORE_NO_PARENT; s = explorer->trail[s].parent)
+    {
+        path[--f] = s;
+    }
+
+    printf("inputs (%u frames):", frames);
+    for (f = 0; f < frames; ++f)
+    {
+        const ExploreStep *step = &explorer->trail[path[f]];
+        if (step->input)
+            printf(" %X", step->input - 1);
+        else
+            printf(" -");
+        if (step->seed)
+            printf("/%u", step->seed);
+    }
+    printf("\n");
+    free(path);
+}
+
+static void destroyExplorer(Explorer *explorer)
+{
+    for (uint32_t t = 0; t < explorer->threads; ++t)
+    {
+        ExploreWorker *worker = &explorer->workers[t];
+        for (uint32_t i = 0; i < worker->count; ++i)
+        {
+            DestroyChip8(worker->children[i]);
+        }
+        DestroyChip8(worker->work);
+        free(worker->children);
+        free(worker->steps);
+    }
+    for (uint32_t i = 0; i < explorer->frontierCount; ++i)
+    {
+        DestroyChip8(explorer->frontier[i]);
+    }
+    free(explorer->frontier);
+    free(explorer->trail);
+    destroyStateSet(explorer->set);
+    free(explorer);
+}
+
+/**
+ * Searches the states a ROM can reach from power-on, breadth-first over
+ *  every key (or none) held each frame, on every core. Reports how many
+ *  new states each frame finds and the rate; with --pc, stops at the
+ *  first state whose PC reaches an address and prints the inputs that get
+ *  there in the fewest frames.
+ * usage: explore [--profile name] [--depth frames] [--frame instructions] [--seeds n]
+ *                [--threads n] [--max-states n] [--pc addr] <rom>
+ */
+int explore_main(int argc, char **argv)
+{
+    Chip8Profile profile = CHIP8_PROFILE_DEFAULT;
+    uint32_t depth = EXPLORE_DEFAULT_DEPTH;
+    uint32_t frame = EXPLORE_DEFAULT_FRAME;
+    uint32_t seeds = 1;
+    uint32_t threads = (uint32_t)SDL_GetCPUCount();
+    uint32_t maxStates = EXPLORE_DEFAULT_MAX_STATES;
+    uint32_t goalPC = EXPLORE_NO_PARENT;
+    const char *rom = NULL;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (strcmp(argv[a], "--profile") == 0 && a + 1 < argc)
+        {
+            profile = Chip8ProfileFromName(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--depth") == 0 && a + 1 < argc)
+        {
+            depth = (uint32_t)strtoul(argv[++a], NULL, 0);
+        }
+        else if (strcmp(argv[a], "--frame") == 0 && a + 1 < argc)
+        {
+            frame = (uint32_t)strtoul(argv[++a], NULL, 0);
+        }
+        else if (strcmp(argv[a], "--seeds") == 0 && a + 1 < argc)
+        {
+            seeds = (uint32_t)strtoul(argv[++a], NULL, 0);
+        }
+        else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+        {
+            threads = (uint32_t)strtoul(argv[++a], NULL, 0);
+        }
+        else if (strcmp(argv[a], "--max-states") == 0 && a + 1 < argc)
+        {
+            maxStates = (uint32_t)strtoul(argv[++a], NULL, 0);
+        }
+        else if (strcmp(argv[a], "--pc") == 0 && a + 1 < argc)
+        {
+            goalPC = (uint32_t)strtoul(argv[++a], NULL, 16);
+        }
+        else if (argv[a][0] != '-' && !rom)
+        {
+            rom = argv[a];
+        }
+        else
+        {
+            rom = NULL;
+            break;
+        }
+    }
+    if (!rom || profile == CHIP8_PROFILE_COUNT || !frame || !seeds || seeds > 256 || !maxStates)
+    {
+        printf("usage: explore [--profile name] [--depth frames] [--frame instructions] [--seeds n]\n"
+               "               [--threads n] [--max-states n] [--pc addr] <rom>\n");
+        return 1;
+    }
+    threads = threads < 1 ? 1 : threads > EXPLORE_MAX_THREADS ? EXPLORE_MAX_THREADS : threads;
+
+    Chip8Image *image = LoadChip8Image(profile, rom);
+    if (!image)
+    {
+        printf("ERROR: Couldn't open %s\n", rom);
+        return 2;
+    }
+
+    Explorer *explorer = calloc(sizeof(Explorer), 1);
+    int ok = explorer != NULL;
+    if (ok)
+    {
+        explorer->image = image;
+        explorer->until.instructions = frame;
+        explorer->until.events = goalPC != EXPLORE_NO_PARENT ? CHIP8_UNTIL_PC : 0;
+        explorer->until.pc = goalPC;
+        explorer->frame = frame;
+        explorer->seeds = seeds;
+        explorer->goalPC = goalPC;
+        explorer->goal = EXPLORE_NO_PARENT;
+        explorer->threads = threads;
+        explorer->set = createStateSet(maxStates);
+        explorer->frontier = malloc(sizeof(Chip8State *));
+        explorer->trail = malloc(sizeof(ExploreStep));
+        ok = explorer->set && explorer->frontier && explorer->trail;
+        for (uint32_t t = 0; ok && t < threads; ++t)
+        {
+            explorer->workers[t].explorer = explorer;
+            explorer->workers[t].goal = EXPLORE_NO_PARENT;
+            explorer->workers[t].work = InitChip8(image);
+            ok = explorer->workers[t].work != NULL;
+        }
+    }
+    Chip8State *root = ok ? InitChip8(image) : NULL;
+    if (!root)
+    {
+        printf("ERROR: Out of memory\n");
+        if (explorer)
+            destroyExplorer(explorer);
+        DestroyChip8Image(image);
+        return 3;
+    }
+
+    insertState(explorer->set, HashChip8State(root));
+    explorer->frontier[0] = root;
+    explorer->frontierCount = 1;
+    explorer->trail[0] = (ExploreStep){EXPLORE_NO_PARENT, 0, 0};
+    explorer->trailCount = 1;
+    explorer->trailCapacity = 1;
+
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t start = SDL_GetPerformanceCounter();
+    uint32_t level;
+    for (level = 1; level <= depth && explorer->frontierCount; ++level)
+    {
+        uint64_t levelStart = SDL_GetPerformanceCounter();
+        exploreLevel(explorer);
+        if (!nextLevel(explorer))
+        {
+            stopExploring(explorer, EXPLORE_OUT_OF_MEMORY);
+        }
+        double elapsed = (double)(SDL_GetPerformanceCounter() - levelStart) / (double)frequency;
+        printf("frame %u: %u new states (%u in all), %.0f states/s\n", level, explorer->frontierCount, explorer->trailCount,
+               elapsed > 0 ? (double)explorer->frontierCount / elapsed : 0.0);
+        if (SDL_AtomicGet(&explorer->stop) != EXPLORE_RUNNING)
+        {
+            break;
+        }
+    }
+    double elapsed = (double)(SDL_GetPerformanceCounter() - start) / (double)frequency;
+
+    uint64_t runs = 0;
+    uint64_t instructions = 0;
+    for (uint32_t t = 0; t < threads; ++t)
+    {
+        runs += explorer->workers[t].runs;
+        instructions += explorer->workers[t].instructions;
+    }
+    elapsed = elapsed > 0 ? elapsed : 1e-9;
+    printf("%u states from %llu frames run in %.2f s on %u threads: %.0f frames/s, %.1f M instructions/s\n",
+           explorer->trailCount, (unsigned long long)runs, elapsed, threads, (double)runs / elapsed, (double)instructions / elapsed / 1e6);
+
+    int result = 0;
+    switch (SDL_AtomicGet(&explorer->stop))
+    {
+    case EXPLORE_GOAL:
+        printf("reached PC %03x\n", goalPC);
+        printInputs(explorer, explorer->goal);
+        break;
+    case EXPLORE_FULL:
+        printf("stopped: more than --max-states %u states\n", maxStates);
+        break;
+    case EXPLORE_OUT_OF_MEMORY:
+        printf("ERROR: Out of memory\n");
+        result = 3;
+        break;
+    default:
+        if (!explorer->frontierCount)
+            printf("every reachable state found\n");
+        if (goalPC != EXPLORE_NO_PARENT)
+            result = 4; // didn't get there
+        break;
+    }
+
+    destroyExplorer(explorer);
+    DestroyChip8Image(image);
+    return result;
+}
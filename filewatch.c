@@ -0,0 +1,129 @@
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+
+#include "filewatch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Chip8FileWatch
+{
+    char *path;
+    const char *name;  // the last component of path
+    int changed;       // a change hasn't been reported yet
+    uint32_t changedAt; // SDL_GetTicks() of the latest change
+#if defined(__linux__)
+    int inotify;
+#else
+    uint32_t polledAt;
+    struct stat last;
+#endif
+};
+
+Chip8FileWatch *OpenChip8FileWatch(const char *path)
+{
+    Chip8FileWatch *watch = calloc(sizeof(Chip8FileWatch), 1);
+    size_t length = strlen(path);
+    char *copy = malloc(length + 1);
+    if (!watch || !copy)
+    {
+        free(watch);
+        free(copy);
+        return NULL;
+    }
+    memcpy(copy, path, length + 1);
+    watch->path = copy;
+    const char *slash = strrchr(copy, '/');
+    const char *backslash = strrchr(copy, '\\');
+    if (backslash && (!slash || backslash > slash))
+    {
+        slash = backslash;
+    }
+    watch->name = slash ? slash + 1 : copy;
+
+#if defined(__linux__)
+    // the directory: everything before the last slash, "/" for a file in the root, "." for no slash
+    char directory[4096];
+    if (slash)
+        snprintf(directory, sizeof(directory), "%.*s", slash == copy ? 1 : (int)(slash - copy), copy);
+    else
+        snprintf(directory, sizeof(directory), ".");
+    watch->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->inotify < 0 ||
+        inotify_add_watch(watch->inotify, directory, IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE) < 0)
+    {
+        if (watch->inotify >= 0)
+            close(watch->inotify);
+        free(copy);
+        free(watch);
+        return NULL;
+    }
+#else
+    if (stat(copy, &watch->last) != 0)
+    {
+        memset(&watch->last, 0, sizeof(watch->last));
+    }
+    watch->polledAt = SDL_GetTicks();
+#endif
+    return watch;
+}
+
+void CloseChip8FileWatch(Chip8FileWatch *watch)
+{
+    if (!watch)
+    {
+        return;
+    }
+#if defined(__linux__)
+    close(watch->inotify);
+#endif
+    free(watch->path);
+    free(watch);
+}
+
+int Chip8FileChanged(Chip8FileWatch *watch)
+{
+    uint32_t now = SDL_GetTicks();
+#if defined(__linux__)
+    // events for everything in the directory; only ours count
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while ((length = read(watch->inotify, events, sizeof(events))) > 0)
+    {
+        for (char *e = events; e < events + length;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)e;
+            if (event->len && strcmp(event->name, watch->name) == 0)
+            {
+                watch->changed = 1;
+                watch->changedAt = now;
+            }
+            e += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#else
+    if (now - watch->polledAt >= FILE_WATCH_POLL_MS)
+    {
+        watch->polledAt = now;
+        struct stat current;
+        if (stat(watch->path, &current) == 0 &&
+            (current.st_mtime != watch->last.st_mtime || current.st_size != watch->last.st_size))
+        {
+            watch->last = current;
+            watch->changed = 1;
+            watch->changedAt = now;
+        }
+    }
+#endif
+
+    if (watch->changed && now - watch->changedAt >= FILE_WATCH_SETTLE_MS)
+    {
+        watch->changed = 0;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <SDL/SDL.h>
+
+#include <stdint.h>
+
+#define FILE_WATCH_SETTLE_MS 100u // how long a file must be left alone after a change before it's reported
+#define FILE_WATCH_POLL_MS 250u   // how often the fallback looks at the file
+
+/**
+ * File watch
+ * Tells whoever polls it when a file has changed, once the writing looks
+ *  finished: editors often truncate and write, or write a new file and
+ *  rename it over the old one, so a change is only reported once the file
+ *  has gone FILE_WATCH_SETTLE_MS without another.
+ * On Linux it watches the file's directory with inotify (watching the file
+ *  itself would lose it when it's replaced by a rename), so polling costs
+ *  one non-blocking read. Elsewhere it compares the file's modification
+ *  time and size every FILE_WATCH_POLL_MS.
+ */
+typedef struct Chip8FileWatch Chip8FileWatch;
+
+// returns NULL if the file's directory can't be watched or out of memory
+Chip8FileWatch *OpenChip8FileWatch(const char *path);
+void CloseChip8FileWatch(Chip8FileWatch *watch);
+
+// never blocks; returns 1 once per settled change
+int Chip8FileChanged(Chip8FileWatch *watch);
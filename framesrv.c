@@ -0,0 +1,467 @@
+#include "sockets.h" // before SDL, so windows.h doesn't bring in the old winsock.h
+
+#include "framesrv.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DISPLAY_WORDS (sizeof(Chip8Display) / sizeof(uint64_t))
+#define MESSAGE_CAPACITY (sizeof(Chip8FrameHeader) + FRAME_SERVER_MAX_PAYLOAD)
+
+const uint32_t FRAME_SERVER_ACCEPT_MS = 100u; // how often the sender looks for new viewers when there's nothing to send
+
+struct Chip8FrameServer
+{
+    Chip8Ring frames;
+    SDL_sem *queued;     // posted for each frame pushed
+    SDL_Thread *sender;
+    SDL_atomic_t clients; // viewers connected; nothing is queued while this is 0
+    SDL_atomic_t quit;
+    char *path;
+    // emulation side only
+    uint32_t served;     // frames offered, including those nobody was watching
+    Chip8Frame queuing;
+    // sender side only
+    Socket listener;
+    Socket viewers[FRAME_SERVER_MAX_CLIENTS];
+    uint8_t behind[FRAME_SERVER_MAX_CLIENTS]; // missed a frame, so the next one has to be a keyframe
+    uint8_t pending[FRAME_SERVER_MAX_CLIENTS][MESSAGE_CAPACITY]; // the rest of a message the socket only took part of
+    uint32_t pendingSize[FRAME_SERVER_MAX_CLIENTS];
+    uint32_t viewerCount;
+    Chip8Frame last;     // the last frame sent, which deltas are against
+    int lastCurrent;     // last was sent while someone was watching, so is still the emulator's display
+    Chip8Frame next;
+};
+
+struct Chip8FrameClient
+{
+    Socket socket;
+    uint32_t filled;
+    uint8_t buffer[MESSAGE_CAPACITY];
+};
+
+uint32_t EncodeChip8FrameDelta(const uint64_t *previous, const uint64_t *current, uint8_t *payload)
+{
+    uint32_t length = 0;
+    uint32_t w = 0;
+    while (w < DISPLAY_WORDS)
+    {
+        uint32_t start = w;
+        while (w < DISPLAY_WORDS && previous[w] == current[w])
+        {
+            ++w;
+        }
+        if (w == DISPLAY_WORDS)
+        {
+            break; // nothing after this changed
+        }
+        // a gap too long for one run's skip is bridged by empty runs
+        for (; w - start > 255; start += 255)
+        {
+            payload[length++] = 255;
+            payload[length++] = 0;
+        }
+
+        uint8_t *run = payload + length;
+        uint32_t count = 0;
+        run[0] = (uint8_t)(w - start);
+        length += 2;
+        while (w < DISPLAY_WORDS && count < 255 && previous[w] != current[w])
+        {
+            uint64_t changed = previous[w] ^ current[w];
+            memcpy(payload + length, &changed, sizeof(changed));
+            length += sizeof(changed);
+            ++w;
+            ++count;
+        }
+        run[1] = (uint8_t)count;
+    }
+    return length;
+}
+
+int ApplyChip8FrameDelta(uint64_t *display, const uint8_t *payload, uint32_t length)
+{
+    uint32_t w = 0;
+    uint32_t p = 0;
+    while (p < length)
+    {
+        if (length - p < 2)
+        {
+            return 0;
+        }
+        uint32_t skip = payload[p];
+        uint32_t count = payload[p + 1];
+        p += 2;
+        if (w + skip + count > DISPLAY_WORDS || length - p < count * sizeof(uint64_t))
+        {
+            return 0;
+        }
+
+        w += skip;
+        for (uint32_t c = 0; c < count; ++c, ++w, p += sizeof(uint64_t))
+        {
+            uint64_t changed;
+            memcpy(&changed, payload + p, sizeof(changed));
+            display[w] ^= changed;
+        }
+    }
+    return 1;
+}
+
+static uint32_t writeMessage(uint8_t *message, const Chip8Frame *frame, const uint64_t *against, uint8_t keyframe)
+{
+    Chip8FrameHeader header;
+    header.magic = FRAME_SERVER_MAGIC;
+    header.number = frame->number;
+    header.length = (uint16_t)EncodeChip8FrameDelta(against, &frame->display[0][0][0], message + sizeof(header));
+    header.hires = frame->hires;
+    header.keyframe = keyframe;
+    memcpy(message, &header, sizeof(header));
+    return sizeof(header) + header.length;
+}
+
+static void dropViewer(Chip8FrameServer *server, uint32_t v)
+{
+    closeSocket(server->viewers[v]);
+    --server->viewerCount;
+    server->viewers[v] = server->viewers[server->viewerCount];
+    server->behind[v] = server->behind[server->viewerCount];
+    server->pendingSize[v] = server->pendingSize[server->viewerCount];
+    memcpy(server->pending[v], server->pending[server->viewerCount], server->pendingSize[v]);
+    SDL_AtomicAdd(&server->clients, -1);
+    if (!server->viewerCount)
+    {
+        server->lastCurrent = 0; // nothing will be queued until someone connects
+    }
+}
+
+static void acceptViewers(Chip8FrameServer *server)
+{
+    for (;;)
+    {
+        Socket viewer = accept(server->listener, NULL, NULL);
+        if (viewer == INVALID_SOCKET)
+        {
+            return;
+        }
+        if (server->viewerCount == FRAME_SERVER_MAX_CLIENTS || !SetChip8SocketNonBlocking(viewer))
+        {
+            closeSocket(viewer);
+            continue;
+        }
+
+        server->viewers[server->viewerCount] = viewer;
+        server->behind[server->viewerCount] = 1; // has nothing to apply a delta to
+        server->pendingSize[server->viewerCount] = 0;
+        ++server->viewerCount;
+        SDL_AtomicAdd(&server->clients, 1);
+    }
+}
+
+// send as much of a viewer's pending message as its socket will take;
+//  returns 1 if it's all gone, 0 if some is still waiting, -1 if the viewer has
+static int flushViewer(Chip8FrameServer *server, uint32_t v)
+{
+    while (server->pendingSize[v])
+    {
+        int sent = send(server->viewers[v], (const char *)server->pending[v], (int)server->pendingSize[v], MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            return wouldBlock() ? 0 : -1;
+        }
+        server->pendingSize[v] -= (uint32_t)sent;
+        memmove(server->pending[v], server->pending[v] + sent, server->pendingSize[v]);
+    }
+    return 1;
+}
+
+// send server->next to every viewer: the delta from the last frame, or a
+//  keyframe (made at most once) to those that missed something
+static void sendFrame(Chip8FrameServer *server)
+{
+    static const Chip8Display blank;
+    uint8_t delta[MESSAGE_CAPACITY];
+    uint8_t keyframe[MESSAGE_CAPACITY];
+    uint32_t deltaSize = writeMessage(delta, &server->next, &server->last.display[0][0][0], 0);
+    uint32_t keyframeSize = 0;
+    // an identical display has to encode to nothing, or viewers are sent a message every frame
+    assert((deltaSize == sizeof(Chip8FrameHeader)) == (memcmp(server->next.display, server->last.display, sizeof(Chip8Display)) == 0));
+    int unchanged = deltaSize == sizeof(Chip8FrameHeader) && server->next.hires == server->last.hires;
+
+    for (uint32_t v = 0; v < server->viewerCount; ++v)
+    {
+        int flushed = flushViewer(server, v);
+        if (flushed < 0)
+        {
+            dropViewer(server, v--);
+            continue;
+        }
+        if (!flushed)
+        {
+            // still sending an older frame; this one is skipped
+            server->behind[v] = 1;
+            continue;
+        }
+
+        const uint8_t *message = delta;
+        uint32_t size = deltaSize;
+        if (server->behind[v])
+        {
+            if (!keyframeSize)
+                keyframeSize = writeMessage(keyframe, &server->next, &blank[0][0][0], 1);
+            message = keyframe;
+            size = keyframeSize;
+        }
+        else if (unchanged)
+        {
+            continue;
+        }
+
+        // whatever the socket doesn't take now goes with the next frame
+        memcpy(server->pending[v], message, size);
+        server->pendingSize[v] = size;
+        server->behind[v] = 0;
+        if (flushViewer(server, v) < 0)
+        {
+            dropViewer(server, v--);
+        }
+    }
+
+    memcpy(&server->last, &server->next, sizeof(Chip8Frame));
+    server->lastCurrent = 1;
+}
+
+static int senderThread(void *data)
+{
+    Chip8FrameServer *server = data;
+    while (!SDL_AtomicGet(&server->quit))
+    {
+        acceptViewers(server);
+        if (SDL_SemWaitTimeout(server->queued, FRAME_SERVER_ACCEPT_MS) != 0)
+        {
+            // the display hasn't changed, but viewers that missed a frame, are
+            //  part way through one or have just connected shouldn't have to
+            //  wait until it does
+            int behind = 0;
+            for (uint32_t v = 0; v < server->viewerCount; ++v)
+            {
+                behind |= server->behind[v] || server->pendingSize[v];
+            }
+            if (behind && server->lastCurrent)
+            {
+                memcpy(&server->next, &server->last, sizeof(Chip8Frame));
+                sendFrame(server);
+            }
+            continue;
+        }
+
+        // only the newest frame is worth sending
+        int fresh = 0;
+        while (PopChip8Ring(&server->frames, &server->next, 1))
+        {
+            fresh = 1;
+        }
+        if (fresh)
+        {
+            sendFrame(server);
+        }
+    }
+    return 0;
+}
+
+Chip8FrameServer *OpenChip8FrameServer(const char *path)
+{
+    struct sockaddr_un address;
+    if (!Chip8SocketAddress(&address, path) || !StartChip8Sockets())
+    {
+        return NULL;
+    }
+
+    Chip8FrameServer *server = calloc(sizeof(Chip8FrameServer), 1);
+    if (!server)
+    {
+        StopChip8Sockets();
+        return NULL;
+    }
+    server->listener = INVALID_SOCKET;
+    SDL_AtomicSet(&server->clients, 0);
+    SDL_AtomicSet(&server->quit, 0);
+
+    server->path = malloc(strlen(path) + 1);
+    server->queued = SDL_CreateSemaphore(0);
+    if (!server->path || !server->queued ||
+        !InitChip8Ring(&server->frames, sizeof(Chip8Frame), FRAME_SERVER_QUEUE_CAPACITY))
+    {
+        CloseChip8FrameServer(server);
+        return NULL;
+    }
+    strcpy(server->path, path);
+
+    if (!RemoveStaleChip8Socket(path))
+    {
+        // another instance is serving here
+        CloseChip8FrameServer(server);
+        return NULL;
+    }
+    server->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listener == INVALID_SOCKET ||
+        bind(server->listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(server->listener, FRAME_SERVER_MAX_CLIENTS) != 0 ||
+        !SetChip8SocketNonBlocking(server->listener))
+    {
+        CloseChip8FrameServer(server);
+        return NULL;
+    }
+
+    server->sender = SDL_CreateThread(senderThread, "framesrv", server);
+    if (!server->sender)
+    {
+        CloseChip8FrameServer(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+void ServeChip8Frame(Chip8FrameServer *server, const Chip8State *state)
+{
+    uint32_t number = server->served++;
+    if (!SDL_AtomicGet(&server->clients))
+    {
+        return;
+    }
+
+    Chip8Frame *frame = &server->queuing;
+    memcpy(frame->display, state->display, sizeof(Chip8Display));
+    frame->hires = state->hires;
+    frame->number = number;
+    frame->inputTime = 0;
+    if (PushChip8Ring(&server->frames, frame, 1))
+    {
+        SDL_SemPost(server->queued);
+    }
+}
+
+void CloseChip8FrameServer(Chip8FrameServer *server)
+{
+    if (!server)
+    {
+        return;
+    }
+
+    if (server->sender)
+    {
+        SDL_AtomicSet(&server->quit, 1);
+        SDL_SemPost(server->queued);
+        SDL_WaitThread(server->sender, NULL);
+    }
+
+    while (server->viewerCount)
+    {
+        dropViewer(server, 0);
+    }
+    if (server->listener != INVALID_SOCKET)
+    {
+        closeSocket(server->listener);
+        RemoveStaleChip8Socket(server->path);
+    }
+
+    FreeChip8Ring(&server->frames);
+    if (server->queued)
+        SDL_DestroySemaphore(server->queued);
+    free(server->path);
+    free(server);
+    StopChip8Sockets();
+}
+
+Chip8FrameClient *ConnectChip8FrameServer(const char *path)
+{
+    struct sockaddr_un address;
+    if (!Chip8SocketAddress(&address, path) || !StartChip8Sockets())
+    {
+        return NULL;
+    }
+
+    Chip8FrameClient *client = calloc(sizeof(Chip8FrameClient), 1);
+    if (!client)
+    {
+        StopChip8Sockets();
+        return NULL;
+    }
+    client->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (client->socket == INVALID_SOCKET ||
+        connect(client->socket, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        !SetChip8SocketNonBlocking(client->socket))
+    {
+        if (client->socket != INVALID_SOCKET)
+            closeSocket(client->socket);
+        free(client);
+        StopChip8Sockets();
+        return NULL;
+    }
+    return client;
+}
+
+int ReceiveChip8Frame(Chip8FrameClient *client, Chip8Frame *frame)
+{
+    int changed = 0;
+    for (;;)
+    {
+        // apply every whole message in the buffer
+        Chip8FrameHeader header;
+        while (client->filled >= sizeof(header))
+        {
+            memcpy(&header, client->buffer, sizeof(header));
+            if (header.magic != FRAME_SERVER_MAGIC || header.length > FRAME_SERVER_MAX_PAYLOAD)
+            {
+                return -1;
+            }
+            uint32_t size = sizeof(header) + header.length;
+            if (client->filled < size)
+            {
+                break;
+            }
+
+            if (header.keyframe)
+            {
+                memset(frame->display, 0, sizeof(Chip8Display));
+            }
+            if (!ApplyChip8FrameDelta(&frame->display[0][0][0], client->buffer + sizeof(header), header.length))
+            {
+                return -1;
+            }
+            frame->hires = header.hires;
+            frame->number = header.number;
+            changed = 1;
+
+            client->filled -= size;
+            memmove(client->buffer, client->buffer + size, client->filled);
+        }
+
+        int got = recv(client->socket, (char *)client->buffer + client->filled, (int)(sizeof(client->buffer) - client->filled), 0);
+        if (got > 0)
+        {
+            client->filled += (uint32_t)got;
+        }
+        else if (got < 0 && wouldBlock())
+        {
+            return changed;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+}
+
+void DisconnectChip8FrameServer(Chip8FrameClient *client)
+{
+    if (client)
+    {
+        closeSocket(client->socket);
+        free(client);
+        StopChip8Sockets();
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <SDL/SDL.h>
+
+#include <stdint.h>
+
+#include "chip8.h"
+#include "ring.h"
+#include "triplebuffer.h"
+
+#define FRAME_SERVER_MAX_CLIENTS 8u
+#define FRAME_SERVER_QUEUE_CAPACITY 8u // frames the sender can fall behind by; it only ever sends the newest
+#define FRAME_SERVER_MAGIC 0x38504843u // "CHP8"
+#define FRAME_SERVER_MAX_PAYLOAD (sizeof(Chip8Display) + sizeof(Chip8Display) / 4) // every word changed, in runs of one
+
+/**
+ * Frame stream
+ * Each message is a header followed by the display as runs against the
+ *  display of the message before it (or against a blank one for a
+ *  keyframe), treating it as the 256 64-bit words of a Chip8Display:
+ *
+ *   uint8_t skip    words unchanged
+ *   uint8_t count   words changed, then count words XORed with the old ones
+ *
+ *  repeated until the changed words run out. Everything is in the host's
+ *  byte order; the socket is local.
+ */
+typedef struct Chip8FrameHeader
+{
+    uint32_t magic;
+    uint32_t number;   // frames the server has seen before this one
+    uint16_t length;   // payload bytes
+    uint8_t hires;
+    uint8_t keyframe;  // the payload is against a blank display
+} Chip8FrameHeader;
+
+// runs turning previous into current; returns the payload length (0 if they're the same)
+uint32_t EncodeChip8FrameDelta(const uint64_t *previous, const uint64_t *current, uint8_t *payload);
+
+// apply a payload to a display; returns 0 if it's malformed
+int ApplyChip8FrameDelta(uint64_t *display, const uint8_t *payload, uint32_t length);
+
+typedef struct Chip8FrameServer Chip8FrameServer;
+typedef struct Chip8FrameClient Chip8FrameClient;
+
+/**
+ * Frame server
+ * Listens on a Unix domain socket; a sender thread accepts viewers and
+ *  sends each of them the frames. While no viewer is connected, serving a
+ *  frame is one atomic read, so leaving it on costs nothing. A viewer that
+ *  can't keep up misses frames and gets a keyframe once it can; one that
+ *  goes away is dropped.
+ */
+// returns NULL if the socket can't be made
+Chip8FrameServer *OpenChip8FrameServer(const char *path);
+
+// emulation side: offer the machine's display as the next frame; never waits
+void ServeChip8Frame(Chip8FrameServer *server, const Chip8State *state);
+
+void CloseChip8FrameServer(Chip8FrameServer *server);
+
+// viewer side: returns NULL if there is no server at path
+Chip8FrameClient *ConnectChip8FrameServer(const char *path);
+
+// read whatever has arrived into frame without waiting; returns 1 if it changed,
+//  0 if not, -1 if the server has gone (or sent something that isn't a frame)
+int ReceiveChip8Frame(Chip8FrameClient *client, Chip8Frame *frame);
+
+void DisconnectChip8FrameServer(Chip8FrameClient *client);
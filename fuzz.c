@@ -0,0 +1,296 @@
+#ifndef CHIP8_LIBFUZZER
+#include <SDL/SDL.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "pool.h"
+#include "tools.h"
+
+const uint32_t FUZZ_INSTRUCTIONS = 64u; // per input, at most
+const uint32_t FUZZ_KEY_SPAN = 16u;     // instructions each key mask in an input is held for
+const uint32_t FUZZ_MAX_ROM = 512u;     // largest ROM fuzz_main generates
+const double FUZZ_DEFAULT_SECONDS = 10.0;
+
+/**
+ * Fuzzer
+ * One machine per profile, made from an image with no ROM (just the
+ *  fonts). Each input resets its machine from that snapshot, which only
+ *  hands back the pages the last input wrote, and then copies the new ROM
+ *  into the pages it covers, so nothing is allocated or re-initialised
+ *  per input.
+ *
+ * Input layout:
+ *   byte 0      profile (mod CHIP8_PROFILE_COUNT)
+ *   bytes 1-2   ROM length, big-endian (clamped to what's there)
+ *   ROM bytes
+ *   the rest    held-key masks, 2 bytes each, each held for FUZZ_KEY_SPAN instructions
+ *
+ * Every address the core forms (PC, I + n, the stack, sprite rows) is
+ *  masked into the machine as part of looking up its page, so there is no
+ *  bounds check to add to the hot path; the fuzzer, run under
+ *  AddressSanitizer, is what keeps that true.
+ */
+typedef struct Fuzzer
+{
+    Chip8Image *images[CHIP8_PROFILE_COUNT];
+    Chip8Pool *pools[CHIP8_PROFILE_COUNT];
+    Chip8State *machines[CHIP8_PROFILE_COUNT];
+    uint64_t instructions; // run so far
+} Fuzzer;
+
+static Fuzzer *createFuzzer(void)
+{
+    Fuzzer *fuzzer = calloc(sizeof(Fuzzer), 1);
+    for (int p = 0; fuzzer && p < CHIP8_PROFILE_COUNT; ++p)
+    {
+        fuzzer->images[p] = CreateChip8Image((Chip8Profile)p, NULL, 0);
+        fuzzer->pools[p] = fuzzer->images[p] ? CreateChip8Pool(fuzzer->images[p], 1) : NULL;
+        fuzzer->machines[p] = fuzzer->pools[p] ? AcquireChip8(fuzzer->pools[p]) : NULL;
+        if (!fuzzer->machines[p])
+        {
+            printf("ERROR: Out of memory\n");
+            exit(3);
+        }
+    }
+    return fuzzer;
+}
+
+// copy a ROM in at PROGRAM_BUFFER a page at a time
+static void loadRom(Chip8State *state, const uint8_t *rom, uint32_t size)
+{
+    uint32_t pageSize = 1u << state->pageShift;
+    for (uint32_t addr = PROGRAM_BUFFER; size;)
+    {
+        uint32_t page = addr >> state->pageShift;
+        uint32_t offset = addr & (pageSize - 1);
+        uint32_t chunk = pageSize - offset < size ? pageSize - offset : size;
+        if (!(state->privatePages & (1u << page)))
+        {
+            PrivatizeChip8Page(state, page);
+        }
+        memcpy(state->pages[page] + offset, rom, chunk);
+        rom += chunk;
+        addr += chunk;
+        size -= chunk;
+    }
+}
+
+// what must hold after every instruction, whatever the ROM did
+static void checkInvariants(const Chip8State *state, const Chip8Image *image)
+{
+    const char *broken = NULL;
+    if (state->SP >= STACK_DEPTH)
+        broken = "SP out of range";
+    else if (state->planes > 3)
+        broken = "planes out of range";
+    else if (state->awaitingKey > 0x11)
+        broken = "awaitingKey out of range";
+    else if (state->memorySize != image->memorySize || state->pageShift != image->pageShift || state->image != image)
+        broken = "memory layout changed";
+
+    if (broken)
+    {
+        printf("ERROR: %s at PC %04x\n", broken, state->PC);
+        abort();
+    }
+}
+
+static void runInput(Fuzzer *fuzzer, const uint8_t *data, size_t size)
+{
+    if (size < 3)
+    {
+        return;
+    }
+
+    Chip8Profile profile = (Chip8Profile)(data[0] % CHIP8_PROFILE_COUNT);
+    Chip8State *state = fuzzer->machines[profile];
+    const Chip8Image *image = fuzzer->images[profile];
+    size_t romSize = ((size_t)data[1] << 8) | data[2];
+    if (romSize > size - 3)
+        romSize = size - 3;
+    if (romSize > image->memorySize - PROGRAM_BUFFER)
+        romSize = image->memorySize - PROGRAM_BUFFER;
+    const uint8_t *keys = data + 3 + romSize;
+    size_t keyBytes = size - 3 - romSize;
+
+    ResetChip8(state);
+    loadRom(state, data + 3, (uint32_t)romSize);
+
+    Chip8Emulator emulate = GetChip8Emulator(profile);
+    uint32_t i;
+    for (i = 0; i < FUZZ_INSTRUCTIONS && !state->halted; ++i)
+    {
+        if (i && i % CHIP8_TICK_INSTRUCTIONS == 0)
+        {
+            TickChip8Timers(state);
+        }
+        if (i % FUZZ_KEY_SPAN == 0)
+        {
+            size_t k = (i / FUZZ_KEY_SPAN) * 2;
+            state->keys = k + 1 < keyBytes ? (uint16_t)(keys[k] | (keys[k + 1] << 8)) : 0;
+        }
+        emulate(state);
+        checkInvariants(state, image);
+    }
+    fuzzer->instructions += i;
+}
+
+#ifdef CHIP8_LIBFUZZER
+// clang -fsanitize=fuzzer,address -DCHIP8_LIBFUZZER fuzz.c chip8.c pool.c
+//  (libFuzzer brings its own main, so fuzz_main and SDL are left out)
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static Fuzzer *fuzzer;
+    if (!fuzzer)
+    {
+        fuzzer = createFuzzer();
+    }
+    runInput(fuzzer, data, size);
+    return 0;
+}
+#else
+// libFuzzer never ends a run, so only fuzz_main frees its machines
+static void destroyFuzzer(Fuzzer *fuzzer)
+{
+    for (int p = 0; p < CHIP8_PROFILE_COUNT; ++p)
+    {
+        DestroyChip8Pool(fuzzer->pools[p]);
+        DestroyChip8Image(fuzzer->images[p]);
+    }
+    free(fuzzer);
+}
+
+// xorshift64*, for generating inputs
+static uint64_t nextRandom(uint64_t *seed)
+{
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 0x2545f4914f6cdd1dull;
+}
+
+// read a whole file; returns NULL if it can't be read
+static uint8_t *readInput(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+    fseek(file, 0L, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+    uint8_t *data = length > 0 ? malloc((size_t)length) : NULL;
+    *size = data ? fread(data, 1, (size_t)length, file) : 0;
+    fclose(file);
+    return data;
+}
+
+/**
+ * Runs inputs through the cores, checking invariants after every instruction
+ * With files, runs each once (to reproduce a crash, or under AFL as
+ *  `chip8 fuzz @@`); otherwise runs random inputs for a while and reports
+ *  the rate. Build with -fsanitize=address,undefined to catch anything
+ *  that gets out of bounds.
+ * usage: fuzz [--seconds s] [--seed n] [input files...]
+ */
+int fuzz_main(int argc, char **argv)
+{
+    double seconds = FUZZ_DEFAULT_SECONDS;
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    int files = 0;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (strcmp(argv[a], "--seconds") == 0 && a + 1 < argc)
+        {
+            seconds = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--seed") == 0 && a + 1 < argc)
+        {
+            seed = strtoull(argv[++a], NULL, 0) | 1;
+        }
+        else if (argv[a][0] == '-')
+        {
+            printf("usage: fuzz [--seconds s] [--seed n] [input files...]\n");
+            return 1;
+        }
+        else
+        {
+            ++files;
+        }
+    }
+
+    Fuzzer *fuzzer = createFuzzer();
+
+    if (files)
+    {
+        for (int a = 1; a < argc; ++a)
+        {
+            if (argv[a][0] == '-')
+            {
+                ++a;
+                continue;
+            }
+            size_t size;
+            uint8_t *data = readInput(argv[a], &size);
+            if (!data)
+            {
+                printf("ERROR: Couldn't open %s\n", argv[a]);
+                return 2;
+            }
+            runInput(fuzzer, data, size);
+            free(data);
+        }
+        printf("ran %d inputs, %llu instructions\n", files, (unsigned long long)fuzzer->instructions);
+        destroyFuzzer(fuzzer);
+        return 0;
+    }
+
+    // random profile, ROM and keys; generated 8 bytes at a time
+    size_t capacity = 3 + FUZZ_MAX_ROM + (FUZZ_INSTRUCTIONS / FUZZ_KEY_SPAN) * 2;
+    uint8_t *data = malloc(capacity + 8);
+    if (!data)
+    {
+        printf("ERROR: Out of memory\n");
+        destroyFuzzer(fuzzer);
+        return 3;
+    }
+    uint64_t executions = 0;
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t start = SDL_GetPerformanceCounter();
+    uint64_t limit = start + (uint64_t)(seconds * (double)frequency);
+    uint64_t now = start;
+    while (now < limit)
+    {
+        // check the clock every so often rather than every input
+        for (int batch = 0; batch < 256; ++batch, ++executions)
+        {
+            size_t romSize = 2 + nextRandom(&seed) % (FUZZ_MAX_ROM - 1);
+            size_t size = 3 + romSize + (FUZZ_INSTRUCTIONS / FUZZ_KEY_SPAN) * 2;
+            for (size_t b = 0; b < size; b += 8)
+            {
+                uint64_t r = nextRandom(&seed);
+                memcpy(data + b, &r, 8);
+            }
+            data[1] = (uint8_t)(romSize >> 8);
+            data[2] = (uint8_t)romSize;
+            runInput(fuzzer, data, size);
+        }
+        now = SDL_GetPerformanceCounter();
+    }
+    double elapsed = (double)(now - start) / (double)frequency;
+
+    printf("%llu executions in %.1f s: %.0f exec/s, %.1f M instructions/s\n",
+           (unsigned long long)executions, elapsed, (double)executions / elapsed,
+           (double)fuzzer->instructions / elapsed / 1e6);
+
+    free(data);
+    destroyFuzzer(fuzzer);
+    return 0;
+}
+#endif
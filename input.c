@@ -0,0 +1,122 @@
+#include "input.h"
+
+#include <ctype.h>
+#include <string.h>
+
+int ParseChip8Keymap(Chip8Keymap *keymap, const char *spec)
+{
+    if (strcmp(spec, "hex") == 0)
+    {
+        spec = "0123456789abcdef";
+    }
+    else if (strcmp(spec, "qwerty") == 0)
+    {
+        // 1 2 3 C     1 2 3 4
+        // 4 5 6 D  <- Q W E R
+        // 7 8 9 E     A S D F
+        // A 0 B F     Z X C V
+        spec = "x123qweasdzc4rfv";
+    }
+
+    if (strlen(spec) != 0x10)
+    {
+        return 0;
+    }
+
+    // printable keys' SDL keycodes are their (lower case) characters
+    for (uint8_t k = 0; k < 0x10; ++k)
+    {
+        keymap->keys[k] = (SDL_Keycode)tolower((unsigned char)spec[k]);
+    }
+
+    return 1;
+}
+
+int InitChip8Input(Chip8Input *input)
+{
+    memset(input, 0, sizeof(*input));
+    return InitChip8Ring(&input->events, sizeof(Chip8InputEvent), INPUT_QUEUE_CAPACITY);
+}
+
+void FreeChip8Input(Chip8Input *input)
+{
+    FreeChip8Ring(&input->events);
+}
+
+int HandleChip8KeyEvent(Chip8Input *input, const Chip8Keymap *keymap, const SDL_Event *event)
+{
+    if (event->type != SDL_KEYDOWN && event->type != SDL_KEYUP)
+    {
+        return 0;
+    }
+
+    for (uint8_t k = 0; k < 0x10; ++k)
+    {
+        if (keymap->keys[k] == event->key.keysym.sym)
+        {
+            // auto-repeat isn't a new press
+            if (!event->key.repeat)
+            {
+                Chip8InputEvent e;
+                e.time = SDL_GetPerformanceCounter();
+                e.key = k;
+                e.down = event->type == SDL_KEYDOWN;
+                PushChip8Ring(&input->events, &e, 1);
+            }
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void ApplyChip8Input(Chip8Input *input, Chip8State *state, uint64_t until)
+{
+    input->pressedSince = 0;
+
+    for (;;)
+    {
+        Chip8InputEvent e;
+        if (input->hasPending)
+        {
+            e = input->pending;
+        }
+        else if (!PopChip8Ring(&input->events, &e, 1))
+        {
+            break;
+        }
+
+        // not yet, or released before the ROM has had an instruction to see it
+        uint16_t bit = (uint16_t)(1u << e.key);
+        if (e.time > until || (!e.down && (input->pressedSince & bit)))
+        {
+            input->pending = e;
+            input->hasPending = 1;
+            break;
+        }
+        input->hasPending = 0;
+
+        if (e.down)
+        {
+            input->keys |= bit;
+            input->pressedSince |= bit;
+            if (!input->firstPressTime)
+            {
+                input->firstPressTime = e.time;
+            }
+        }
+        else
+        {
+            input->keys &= ~bit;
+        }
+    }
+
+    state->keys = input->keys;
+}
+
+uint64_t TakeChip8InputPressTime(Chip8Input *input)
+{
+    uint64_t time = input->firstPressTime;
+    input->firstPressTime = 0;
+    return time;
+}
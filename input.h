@@ -0,0 +1,63 @@
+#pragma once
+
+#include <SDL/SDL.h>
+
+#include <stdint.h>
+
+#include "chip8.h"
+#include "ring.h"
+
+#define INPUT_QUEUE_CAPACITY 256u
+
+// which keyboard key stands for each CHIP-8 key
+typedef struct Chip8Keymap
+{
+    SDL_Keycode keys[0x10];
+} Chip8Keymap;
+
+// a key going down or up, stamped with SDL_GetPerformanceCounter when it happened
+typedef struct Chip8InputEvent
+{
+    uint64_t time;
+    uint8_t key;  // CHIP-8 key, 0-F
+    uint8_t down; // 1 pressed, 0 released
+} Chip8InputEvent;
+
+/**
+ * Input queue
+ * The event thread stamps each CHIP-8 key press and release and pushes it
+ *  onto a ring; the emulation thread applies them in order, each one just
+ *  before the first instruction emulated at or after its time, so a tap
+ *  lands where it happened in the frame rather than at the frame boundary.
+ *  A key is always held for at least one instruction, so a press and
+ *  release between two instructions still reaches the ROM.
+ */
+typedef struct Chip8Input
+{
+    Chip8Ring events;
+    // consumer side only
+    uint16_t keys;           // held keys, bit n = key n
+    uint16_t pressedSince;   // keys pressed since the last instruction
+    Chip8InputEvent pending; // an event popped too early to apply
+    uint8_t hasPending;
+    uint64_t firstPressTime; // time of the oldest press applied since it was last taken, 0 if none
+} Chip8Input;
+
+// keymap by name ("hex": keys 0-9 and A-F, "qwerty": 1234/QWER/ASDF/ZXCV like the
+//  COSMAC VIP keypad), or 16 characters giving the keyboard key for 0-F in order;
+//  returns 0 if it's neither
+int ParseChip8Keymap(Chip8Keymap *keymap, const char *spec);
+
+// returns 0 on failure
+int InitChip8Input(Chip8Input *input);
+void FreeChip8Input(Chip8Input *input);
+
+// producer: queue a keyboard event if it's a CHIP-8 key; returns 1 if it was
+int HandleChip8KeyEvent(Chip8Input *input, const Chip8Keymap *keymap, const SDL_Event *event);
+
+// consumer: apply the events that happened by the given time and copy the held
+//  keys into the machine; call before each instruction
+void ApplyChip8Input(Chip8Input *input, Chip8State *state, uint64_t until);
+
+// consumer: the time of the oldest press applied since the last call, or 0
+uint64_t TakeChip8InputPressTime(Chip8Input *input);
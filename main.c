@@ -3,155 +3,455 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "audio.h"
+#include "capture.h"
 #include "chip8.h"
+#include "filewatch.h"
+#include "framesrv.h"
+#include "input.h"
+#include "render.h"
+#include "stats.h"
+#include "timing.h"
+#include "tools.h"
+#include "trace.h"
+#include "triplebuffer.h"
 
 #define DEBUG 0
 
-// 64x32 pixels; 16x16 (256) pixels per pixel
+// 64x32 pixels; 16x16 (256) pixels per pixel (8x8 in 128x64 high resolution mode)
 const uint32_t PIXEL_SIZE = 16u;                  // 16u;
 const uint16_t SCREEN_WIDTH = 1024u;              // 64 * 16
 const uint16_t SCREEN_HEIGHT = 512u;              // 32 * 16
 const uint16_t SCREEN_TICKS_PER_OP = 1000u / 60u; // 1000ms / OPS_PER_SECOND
+const double FAST_FRAME_SHARE = 0.75; // of each frame, spent emulating in fast mode without --ipf
+const uint32_t CAPTURE_SCALE = 4u; // recordings are 512x256
+const uint32_t TRACE_EVENTS = 65536u; // spans kept per thread: a few minutes of frames
+const uint32_t OVERLAY_SCALE = 2u;    // statistics overlay font pixels are 2x2
+const uint32_t OVERLAY_TEXT = 0xFFFFFFFF;
+const uint32_t OVERLAY_BACKGROUND = 0xFF000000;
 
 //                        0xAARRGGBB
 const uint32_t PIXEL_ON = 0xFF2051A9;  // darker cornflower blue
 const uint32_t PIXEL_OFF = 0xFF6495ED; // cornflower blue
+const uint32_t PIXEL_PLANE2 = 0xFFB0C8F5; // pale cornflower blue (XO-CHIP second plane)
+const uint32_t PIXEL_BOTH = 0xFF10285A;   // navy (XO-CHIP both planes)
 
-// individual pixels
-static void setPixel(SDL_Surface *surface, uint16_t x, uint16_t y, uint8_t on)
+// draw the chip8 display onto the surface, its pixels scaled up to fill it
+//  (16x16 in low resolution, 8x8 in high)
+static void renderScreen(Chip8Renderer *renderer, SDL_Surface *surface, const Chip8Frame *frame)
 {
-    uint32_t startX = x;
-    uint32_t startY = y;
-    uint32_t *const targetPixel = (uint32_t *)(((uint8_t *)surface->pixels) + (startY * surface->pitch) + (startX * surface->format->BytesPerPixel));
-    *targetPixel = on ? PIXEL_ON : PIXEL_OFF;
+    uint32_t width = frame->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+    RenderChip8Frame(renderer, frame, SCREEN_WIDTH / width, (uint32_t *)surface->pixels, (uint32_t)surface->pitch);
 }
 
-// big pixels
-static void setPixelA(SDL_Surface *surface, uint16_t x, uint16_t y, uint8_t on)
+// parse "off,on[,plane2,both]" colours as RRGGBB hex; returns 0 if malformed
+static int parsePalette(uint32_t palette[4], const char *spec)
 {
-    uint32_t startX = x * PIXEL_SIZE;
-    uint32_t startY = y * PIXEL_SIZE;
-    uint32_t *const targetPixel = (uint32_t *)(((uint8_t *)surface->pixels) + (startY * surface->pitch) + (startX * surface->format->BytesPerPixel));
-    // *targetPixel = on ? PIXEL_ON : PIXEL_OFF;
+    uint32_t colours[4];
+    int count = 0;
+    for (const char *c = spec; count < 4;)
+    {
+        char *end;
+        unsigned long colour = strtoul(c, &end, 16);
+        if (end - c != 6)
+        {
+            return 0;
+        }
+        colours[count++] = 0xFF000000u | (uint32_t)colour;
+        if (*end != ',')
+        {
+            if (*end)
+                return 0;
+            break;
+        }
+        c = end + 1;
+    }
+    if (count != 2 && count != 4)
+    {
+        return 0;
+    }
+    palette[0] = colours[0];
+    palette[1] = colours[1];
+    if (count == 4)
+    {
+        palette[2] = colours[2];
+        palette[3] = colours[3];
+    }
+    return 1;
+}
 
-    // for PIXEL_SIZE rows ...
-    for (uint32_t Y = 0; Y < PIXEL_SIZE; ++Y)
+// the statistics in the top left corner of the window
+static void drawOverlay(SDL_Surface *surface, Chip8Stats *stats)
+{
+    Chip8StatsSnapshot snapshot;
+    GetChip8Stats(stats, &snapshot);
+    char text[256];
+    snprintf(text, sizeof(text),
+             "IPS %.0f  HZ %.1f\nFRAME %.2f MS  P99 %.2f MS\nLATE %llu  DROPPED %llu\nDRAWS %.1f/FRAME  KEY WAIT %.0f%%\nLATENCY %.1f MS  MAX %.1f MS",
+             snapshot.ips, snapshot.hz, snapshot.frameP50Ms, snapshot.frameP99Ms,
+             (unsigned long long)snapshot.lateFrames, (unsigned long long)snapshot.dropped,
+             snapshot.drawsPerFrame, snapshot.keyWaitFraction * 100.0, snapshot.latencyMs, snapshot.latencyMaxMs);
+    DrawChip8Text((uint32_t *)surface->pixels, (uint32_t)surface->pitch, (uint32_t)surface->w, (uint32_t)surface->h,
+                  OVERLAY_SCALE * 4, OVERLAY_SCALE * 4, OVERLAY_SCALE, OVERLAY_TEXT, OVERLAY_BACKGROUND, text);
+}
+
+// write the trace so far; hotkey dumps are numbered (trace-1.json, ...) so the one at exit doesn't replace them
+static void dumpTrace(Chip8Tracer *tracer, const char *path, uint32_t number)
+{
+    char numbered[1024];
+    if (number)
     {
-        // ... set PIXEL_SIZE bytes to the desired colour
-        // memset(targetPixel + (surface->pitch * (Y - startY)), on ? PIXEL_ON : PIXEL_OFF, PIXEL_SIZE);
+        const char *dot = strrchr(path, '.');
+        const char *slash = strrchr(path, '/');
+        if (!dot || (slash && slash > dot))
+            dot = path + strlen(path);
+        snprintf(numbered, sizeof(numbered), "%.*s-%u%s", (int)(dot - path), path, number, dot);
+        path = numbered;
+    }
+    if (DumpChip8Trace(tracer, path))
+        printf("trace written to %s\n", path);
+    else
+        printf("ERROR: Couldn't write trace to %s\n", path);
+}
 
-        for (uint32_t X = 0; X < PIXEL_SIZE; ++X)
+// shared between the event/render thread and the emulation thread
+typedef struct Emulation
+{
+    Chip8State *state;
+    Chip8Scheduler scheduler; // the emulation thread's
+    Chip8Image *image;   // what the machine is running; the emulation thread's once it starts
+    void *reload;        // a new image for it, or NULL; set by the event thread, taken by the emulation thread
+    int keepState;       // reloads keep registers, display and written memory
+    Chip8Audio *audio;
+    Chip8TripleBuffer frames;
+    Chip8Capture *capture; // NULL unless recording
+    Chip8FrameServer *server; // NULL unless serving
+    Chip8Tracer *tracer;      // NULL unless tracing
+    Chip8Stats *stats;
+    Chip8Input input;
+    SDL_atomic_t paused;
+    SDL_atomic_t reset;  // set by the event thread, cleared once the machine is reset
+    SDL_atomic_t quit;
+} Emulation;
+
+// a frame's key events, spread over its instructions in proportion to when they happened
+typedef struct FrameInput
+{
+    Chip8Input *input;
+    uint64_t from;     // events up to here have been applied
+    uint64_t to;       // the frame's start; events up to here are applied by its end
+    uint64_t deadline; // fast mode without a fixed count: stop here (0: the scheduler decides)
+} FrameInput;
+
+static int applyFrameInput(void *context, Chip8State *state, double done)
+{
+    FrameInput *frame = context;
+    if (frame->deadline)
+    {
+        uint64_t now = SDL_GetPerformanceCounter();
+        if (now >= frame->deadline)
         {
-            targetPixel[X + (Y * SCREEN_WIDTH)] = on ? PIXEL_ON : PIXEL_OFF;
+            return 0;
         }
+        done = (double)(now - frame->to) / (double)(frame->deadline - frame->to);
     }
+    ApplyChip8Input(frame->input, state, frame->from + (uint64_t)((double)(frame->to - frame->from) * done));
+    return 1;
 }
 
-// draw the chip8 display buffer onto the surface
-// each bit represents a screen pixel (on or off)
-// from 0xF00 to 0xFFF, 32 rows of 64, total 2048 (0x800) pixels
-//  in 32*(64/8)=128=0x100 bytes
-static void renderScreen(SDL_Surface *surface, Chip8State *chip8State)
+// runs the machine at 60 frames a second, publishing each finished frame
+static int emulationThread(void *data)
 {
-    uint8_t x;
-    // 32 rows of screen
-    for (uint8_t y = 0; y < 32; ++y)
+    Emulation *emulation = data;
+    Chip8State *chip8State = emulation->state;
+    Chip8TraceBuffer *trace = Chip8TraceThread(emulation->tracer, "emulation");
+    uint32_t prevTime = SDL_GetTicks();
+    uint64_t inputTime = SDL_GetPerformanceCounter(); // key events up to here have been applied
+
+    while (!SDL_AtomicGet(&emulation->quit))
     {
-        // 64 columns of screen, stored in 64 bits across 8 bytes
-        for (uint8_t xByte = 0; xByte < 8; ++xByte)
+        uint64_t now = SDL_GetPerformanceCounter();
+        uint64_t frameStart = Chip8TraceBegin(trace);
+
+        if (SDL_AtomicSet(&emulation->reset, 0))
         {
-            // y*8 because the screen is 8 bytes across
-            uint8_t byteIdx = xByte + (y * 8);
-            uint8_t byte = chip8State->screen[byteIdx];
+            ResetChip8(chip8State);
+        }
 
-            // for each bit of the byte
-            for (uint8_t pixel = 0; pixel < 8; ++pixel)
+        // the ROM was edited: move onto the new image and let the old one go
+        Chip8Image *reloaded = SDL_AtomicSetPtr(&emulation->reload, NULL);
+        if (reloaded)
+        {
+            ReloadChip8(chip8State, reloaded, emulation->keepState);
+            DestroyChip8Image(emulation->image);
+            emulation->image = reloaded;
+            if (SDL_AtomicGet(&emulation->paused))
             {
-                // determine x coordinate of the pixel in the screen
-                x = (xByte * 8) + pixel;
-                // determine the status of the bit
-                uint8_t bit = byte & (128 >> pixel);
-                setPixelA(surface, x, y, bit > 0);
+                PublishChip8Frame(&emulation->frames, chip8State, 0);
             }
         }
+
+        if (!SDL_AtomicGet(&emulation->paused))
+        {
+            // run emulator; execute a frame of the program
+            uint64_t spanStart = Chip8TraceBegin(trace);
+            uint32_t draws = chip8State->draws;
+            FrameInput frameInput = {&emulation->input, inputTime, now, 0};
+            if (emulation->scheduler.timing == CHIP8_TIMING_FAST && !emulation->scheduler.instructionsPerFrame)
+            {
+                frameInput.deadline = now + (uint64_t)((double)SDL_GetPerformanceFrequency() * SCREEN_TICKS_PER_OP / 1000.0 * FAST_FRAME_SHARE);
+            }
+            uint32_t instructions = RunChip8Frame(&emulation->scheduler, chip8State, applyFrameInput, &frameInput);
+            ApplyChip8Input(&emulation->input, chip8State, now); // any the frame ended before
+            Chip8TraceEnd(trace, "emulate", spanStart);
+            RecordChip8EmulatedFrame(emulation->stats, now, instructions, chip8State->draws - draws, chip8State->awaitingKey != 0, 1);
+
+#if DEBUG
+            // output register values
+            printf("0:%02x 1:%02x 2:%02x 3:%02x 4:%02x 5:%02x 6:%02x 7:%02x 8:%02x 9:%02x A:%02x B:%02x C:%02x D:%02x E:%02x F:%02x I:%03x PC:%03x instr:%04x\n",
+                   chip8State->V[0x0],
+                   chip8State->V[0x1],
+                   chip8State->V[0x2],
+                   chip8State->V[0x3],
+                   chip8State->V[0x4],
+                   chip8State->V[0x5],
+                   chip8State->V[0x6],
+                   chip8State->V[0x7],
+                   chip8State->V[0x8],
+                   chip8State->V[0x9],
+                   chip8State->V[0xA],
+                   chip8State->V[0xB],
+                   chip8State->V[0xC],
+                   chip8State->V[0xD],
+                   chip8State->V[0xE],
+                   chip8State->V[0xF],
+                   chip8State->I,
+                   chip8State->PC,
+                   (Chip8ReadMemory(chip8State, chip8State->PC) << 8) | Chip8ReadMemory(chip8State, chip8State->PC + 1));
+#endif
+
+            // one frame's worth of sound for the timer as it now stands
+            spanStart = Chip8TraceBegin(trace);
+            QueueChip8Audio(emulation->audio, chip8State, AUDIO_SAMPLES_PER_FRAME);
+            Chip8TraceEnd(trace, "audio", spanStart);
+
+            spanStart = Chip8TraceBegin(trace);
+            PublishChip8Frame(&emulation->frames, chip8State, TakeChip8InputPressTime(&emulation->input));
+            if (emulation->capture)
+            {
+                CaptureChip8Frame(emulation->capture, chip8State);
+            }
+            if (emulation->server)
+            {
+                ServeChip8Frame(emulation->server, chip8State);
+            }
+            Chip8TraceEnd(trace, "publish", spanStart);
+        }
+        else
+        {
+            // keep the held keys current, but presses made while paused have no latency to measure
+            ApplyChip8Input(&emulation->input, chip8State, now);
+            TakeChip8InputPressTime(&emulation->input);
+            RecordChip8EmulatedFrame(emulation->stats, now, 0, 0, 0, 0);
+        }
+        inputTime = now;
+
+        // time at end of frame
+        uint64_t delayStart = Chip8TraceBegin(trace);
+        uint32_t timeDiff = (SDL_GetTicks() - prevTime);
+        if (timeDiff < SCREEN_TICKS_PER_OP)
+        {
+            SDL_Delay(SCREEN_TICKS_PER_OP - timeDiff);
+        }
+        prevTime = SDL_GetTicks();
+        Chip8TraceEnd(trace, "delay", delayStart);
+        Chip8TraceEnd(trace, "frame", frameStart);
     }
+
+    return 0;
 }
 
-static void interpretKeyPress(Chip8State *chip8State, SDL_Keycode key)
+// `chip8 <tool> ...` runs one of these instead of the emulator
+static const struct
 {
-    uint8_t keyValue = 0x10;
-    switch (key)
+    const char *name;
+    int (*run)(int argc, char **argv);
+} tools[] = {
+    {"disassemble", disassemble_main},
+    {"bench", bench_main},
+    {"recompile", recompile_main},
+    {"difftest", difftest_main},
+    {"fuzz", fuzz_main},
+    {"viewer", viewer_main},
+    {"debug", debug_main},
+    {"explore", explore_main},
+    {"regress", regress_main},
+};
+
+int main(int argc, char **argv)
+{
+    for (size_t t = 0; argc >= 2 && t < sizeof(tools) / sizeof(tools[0]); ++t)
     {
-    case SDLK_0:
-    case SDLK_1:
-    case SDLK_2:
-    case SDLK_3:
-    case SDLK_4:
-    case SDLK_5:
-    case SDLK_6:
-    case SDLK_7:
-    case SDLK_8:
-    case SDLK_9:
-        keyValue = key - 48;
-        break;
-    case SDLK_a:
-    case SDLK_b:
-    case SDLK_c:
-    case SDLK_d:
-    case SDLK_e:
-    case SDLK_f:
-        keyValue = key - 97;
-        break;
-    default:
-        break;
+        if (strcmp(argv[1], tools[t].name) == 0)
+        {
+            return tools[t].run(argc - 1, argv + 1);
+        }
     }
 
-    if (keyValue > 0xF)
-        return;
-
-    chip8State->keys[keyValue] = 1;
-}
-
-static void clearKeys(Chip8State *chip8State)
-{
-    for (uint8_t k = 0; k < 16; ++k)
+    // options: chip8 [--profile vip] [--palette 000000,ffffff] [--smooth scale2x] [--mute | --wav out.wav] [--keymap qwerty] [--latency] [--record out.gif] [--serve sock] [--headless] [--trace out.json] [--stats out.prom] [--stats-listen 9100] [--overlay] [--watch [--keep-state]] [--timing vip|fast] [--ipf 1000] rom.ch8
+    Chip8Profile profile = CHIP8_PROFILE_DEFAULT;
+    Chip8Keymap keymap;
+    ParseChip8Keymap(&keymap, "hex");
+    int showLatency = 0;
+    const char *recordPath = NULL;
+    uint32_t palette[4] = {PIXEL_OFF, PIXEL_ON, PIXEL_PLANE2, PIXEL_BOTH};
+    Chip8Smoothing smoothing = CHIP8_SMOOTH_NONE;
+    const char *servePath = NULL;
+    int headless = 0;
+    const char *tracePath = NULL;
+    const char *statsPath = NULL;
+    const char *statsEndpoint = NULL;
+    int overlay = 0;
+    Chip8Timing timing = CHIP8_TIMING_VIP;
+    uint32_t instructionsPerFrame = 0;
+    int watchRom = 0;
+    int keepState = 0;
+    Chip8AudioBackend audioBackend = CHIP8_AUDIO_SDL;
+    const char *wavPath = NULL;
+    const char *romPath = NULL;
+    int badArgs = 0;
+    for (int a = 1; a < argc && !badArgs; ++a)
     {
-        chip8State->keys[k] = 0;
+        if (strcmp(argv[a], "--profile") == 0 && a + 1 < argc)
+        {
+            profile = Chip8ProfileFromName(argv[++a]);
+            if (profile == CHIP8_PROFILE_COUNT)
+            {
+                printf("ERROR: Unknown profile %s (default, vip, chip48, schip, xochip)\n", argv[a]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[a], "--mute") == 0)
+        {
+            audioBackend = CHIP8_AUDIO_NULL;
+        }
+        else if (strcmp(argv[a], "--wav") == 0 && a + 1 < argc)
+        {
+            audioBackend = CHIP8_AUDIO_WAV;
+            wavPath = argv[++a];
+        }
+        else if (strcmp(argv[a], "--keymap") == 0 && a + 1 < argc)
+        {
+            if (!ParseChip8Keymap(&keymap, argv[++a]))
+            {
+                printf("ERROR: Unknown keymap %s (hex, qwerty, or 16 keys for 0-F)\n", argv[a]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[a], "--latency") == 0)
+        {
+            showLatency = 1;
+        }
+        else if (strcmp(argv[a], "--record") == 0 && a + 1 < argc)
+        {
+            recordPath = argv[++a];
+            if (Chip8CaptureFormatFromPath(recordPath) == CHIP8_CAPTURE_FORMAT_COUNT)
+            {
+                printf("ERROR: Can't record to %s (.y4m, .gif or .png)\n", recordPath);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[a], "--palette") == 0 && a + 1 < argc)
+        {
+            if (!parsePalette(palette, argv[++a]))
+            {
+                printf("ERROR: Bad palette %s (off,on or off,on,plane2,both as RRGGBB)\n", argv[a]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[a], "--smooth") == 0 && a + 1 < argc)
+        {
+            smoothing = Chip8SmoothingFromName(argv[++a]);
+            if (smoothing == CHIP8_SMOOTH_COUNT)
+            {
+                printf("ERROR: Unknown smoothing %s (none, scale2x, scale3x)\n", argv[a]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[a], "--serve") == 0 && a + 1 < argc)
+        {
+            servePath = argv[++a];
+        }
+        else if (strcmp(argv[a], "--headless") == 0)
+        {
+            headless = 1;
+        }
+        else if (strcmp(argv[a], "--trace") == 0 && a + 1 < argc)
+        {
+            tracePath = argv[++a];
+        }
+        else if (strcmp(argv[a], "--stats") == 0 && a + 1 < argc)
+        {
+            statsPath = argv[++a];
+        }
+        else if (strcmp(argv[a], "--stats-listen") == 0 && a + 1 < argc)
+        {
+            statsEndpoint = argv[++a];
+        }
+        else if (strcmp(argv[a], "--overlay") == 0)
+        {
+            overlay = 1;
+        }
+        else if (strcmp(argv[a], "--timing") == 0 && a + 1 < argc)
+        {
+            timing = Chip8TimingFromName(argv[++a]);
+            if (timing == CHIP8_TIMING_COUNT)
+            {
+                printf("ERROR: Unknown timing %s (vip, fast)\n", argv[a]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[a], "--ipf") == 0 && a + 1 < argc)
+        {
+            instructionsPerFrame = (uint32_t)strtoul(argv[++a], NULL, 0);
+        }
+        else if (strcmp(argv[a], "--watch") == 0)
+        {
+            watchRom = 1;
+        }
+        else if (strcmp(argv[a], "--keep-state") == 0)
+        {
+            keepState = 1;
+        }
+        else if (!romPath && argv[a][0] != '-')
+        {
+            romPath = argv[a];
+        }
+        else
+        {
+            badArgs = 1;
+        }
     }
-}
 
-int main(int argc, char **argv)
-{
     // check args
-    if (argc != 2)
+    if (!romPath || badArgs || (keepState && !watchRom))
     {
-        printf("ERROR: Must specify file to disassemble\n");
+        printf("usage: chip8 [--profile default|vip|chip48|schip|xochip] [--mute | --wav <file>] [--keymap hex|qwerty|<keys>] [--palette <colours>] [--smooth none|scale2x|scale3x] [--latency] [--record <file>] [--serve <socket>] [--headless] [--trace <file>] [--stats <file>] [--stats-listen <port|socket>] [--overlay] [--watch [--keep-state]] [--timing vip|fast] [--ipf <n>] <rom>\n");
         return -1;
     }
 
-    // read file
-    FILE *file = fopen(argv[1], "rb");
-    if (!file)
+    // read the file into an image with the ROM at 0x200
+    Chip8Image *image = LoadChip8Image(profile, romPath);
+    if (!image)
     {
-        printf("ERROR: Couldn't open %s\n", argv[1]);
+        printf("ERROR: Couldn't open %s\n", romPath);
         return -2;
     }
 
-    // get file size
-    fseek(file, 0L, SEEK_END);
-    int fsize = ftell(file);
-    fseek(file, 0L, SEEK_SET);
-
     // init CHIP8
-    Chip8State *chip8State = InitChip8();
-
-    // CHIP-8 convention puts programs into RAM at 0x200
-    // ROMs will be hardcoded to expect that
-
-    // read the file into RAM at 0x200 and close it
-    fread(chip8State->memory + 0x200, fsize, 1, file);
-    fclose(file);
+    Chip8State *chip8State = InitChip8(image);
 
 #if DEBUG
     // output register values
@@ -174,117 +474,276 @@ int main(int argc, char **argv)
            chip8State->V[0xF],
            chip8State->I,
            chip8State->PC,
-           (chip8State->memory[chip8State->PC] << 8) | chip8State->memory[chip8State->PC + 1]);
+           (Chip8ReadMemory(chip8State, chip8State->PC) << 8) | Chip8ReadMemory(chip8State, chip8State->PC + 1));
 #endif
 
-    // initialise sdl and video subsystem
+    // initialise sdl and video subsystem (just events without a window, so the process can still be told to quit)
     SDL_Window *window = NULL;
     SDL_Surface *surface = NULL;
-    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    Chip8Renderer *renderer = NULL;
+    if (SDL_Init(headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO) < 0)
     {
         printf("SDL initialisation failed: %s\n", SDL_GetError());
         return -3;
     }
 
+    // open audio; carry on silently if there's no device
+    Chip8Audio *audio = OpenChip8Audio(audioBackend, wavPath);
+    if (!audio)
+    {
+        audio = OpenChip8Audio(CHIP8_AUDIO_NULL, NULL);
+    }
+
     // create a window
-    window = SDL_CreateWindow("Chip 8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_RESIZABLE); // | SDL_WINDOW_BORDERLESS
-    if (window == NULL)
+    if (!headless)
     {
-        printf("SDL failed to create window: %s\n", SDL_GetError());
-        return -4;
+        window = SDL_CreateWindow("Chip 8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_RESIZABLE); // | SDL_WINDOW_BORDERLESS
+        if (window == NULL)
+        {
+            printf("SDL failed to create window: %s\n", SDL_GetError());
+            return -4;
+        }
+
+        // get the window surface
+        surface = SDL_GetWindowSurface(window);
+        // fill it with a colour
+        // SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 0x64, 0x95, 0xED));
+        // update the surface
+        // SDL_UpdateWindowSurface(window);
+
+        renderer = malloc(sizeof(Chip8Renderer));
+        if (!renderer)
+        {
+            printf("ERROR: Out of memory\n");
+            return -4;
+        }
+        InitChip8Renderer(renderer, palette, smoothing);
     }
 
-    // get the window surface
-    surface = SDL_GetWindowSurface(window);
-    // fill it with a colour
-    // SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 0x64, 0x95, 0xED));
-    // update the surface
-    // SDL_UpdateWindowSurface(window);
+    // start the machine on its own thread; this one handles events and drawing
+    Emulation emulation;
+    emulation.state = chip8State;
+    emulation.image = image;
+    emulation.reload = NULL;
+    emulation.keepState = keepState;
+    InitChip8Scheduler(&emulation.scheduler, timing, instructionsPerFrame);
+    emulation.audio = audio;
+    emulation.capture = NULL;
+    emulation.server = NULL;
+    emulation.tracer = NULL;
+    emulation.stats = CreateChip8Stats(SCREEN_TICKS_PER_OP, statsPath, statsEndpoint);
+    if (!emulation.stats)
+    {
+        printf("ERROR: Couldn't start statistics%s%s\n", statsEndpoint ? " on " : "", statsEndpoint ? statsEndpoint : "");
+        return -10;
+    }
+    InitChip8TripleBuffer(&emulation.frames);
+    if (recordPath)
+    {
+        emulation.capture = OpenChip8Capture(Chip8CaptureFormatFromPath(recordPath), recordPath, palette, CAPTURE_SCALE);
+        if (!emulation.capture)
+        {
+            printf("ERROR: Couldn't record to %s\n", recordPath);
+            return -5;
+        }
+    }
+    if (servePath)
+    {
+        emulation.server = OpenChip8FrameServer(servePath);
+        if (!emulation.server)
+        {
+            printf("ERROR: Couldn't serve frames on %s\n", servePath);
+            return -6;
+        }
+    }
+    if (tracePath)
+    {
+        emulation.tracer = CreateChip8Tracer(TRACE_EVENTS);
+        if (!emulation.tracer)
+        {
+            printf("ERROR: Out of memory\n");
+            return -9;
+        }
+    }
+    Chip8FileWatch *romWatch = NULL;
+    if (watchRom)
+    {
+        romWatch = OpenChip8FileWatch(romPath);
+        if (!romWatch)
+        {
+            printf("ERROR: Couldn't watch %s for changes\n", romPath);
+            return -11;
+        }
+    }
+    Chip8TraceBuffer *trace = Chip8TraceThread(emulation.tracer, "events and drawing");
+    uint32_t traceDumps = 0;
+    if (!InitChip8Input(&emulation.input))
+    {
+        printf("ERROR: Out of memory\n");
+        return -7;
+    }
+    SDL_AtomicSet(&emulation.paused, 0);
+    SDL_AtomicSet(&emulation.reset, 0);
+    SDL_AtomicSet(&emulation.quit, 0);
 
-    renderScreen(surface, chip8State);
-    SDL_UpdateWindowSurface(window);
+    PublishChip8Frame(&emulation.frames, chip8State, 0);
+    if (window)
+    {
+        renderScreen(renderer, surface, AcquireChip8Frame(&emulation.frames));
+        SDL_UpdateWindowSurface(window);
+    }
+
+    SDL_Thread *emulator = SDL_CreateThread(emulationThread, "chip8", &emulation);
+    if (!emulator)
+    {
+        printf("SDL failed to create emulation thread: %s\n", SDL_GetError());
+        return -8;
+    }
 
     // force window to stay open until closed
     SDL_Event e;
     int quit = 0;
-    int advanceFrame = 0;
     uint32_t prevTime = SDL_GetTicks();
+    // input-to-photon latency: key press to the first frame showing it on screen
+    uint64_t latencyTotal = 0, latencyMax = 0;
+    uint32_t latencyCount = 0;
     // loop frames until we want to quit
     while (!quit)
     {
+        uint64_t frameStart = Chip8TraceBegin(trace);
+
         // poll for an event
+        uint64_t spanStart = Chip8TraceBegin(trace);
         while (SDL_PollEvent(&e))
         {
-            // clear the key states before processing
-            clearKeys(chip8State);
-
             if (e.type == SDL_QUIT)
             {
                 quit = 1;
             }
+            else if (HandleChip8KeyEvent(&emulation.input, &keymap, &e))
+            {
+                // a CHIP-8 key, queued for the emulation thread
+            }
             else if (e.type == SDL_KEYDOWN)
             {
                 switch (e.key.keysym.sym)
                 {
                 case SDLK_SPACE:
-                    advanceFrame = 1;
+                    // pause/resume
+                    SDL_AtomicSet(&emulation.paused, !SDL_AtomicGet(&emulation.paused));
+                    break;
+                case SDLK_F5:
+                    SDL_AtomicSet(&emulation.reset, 1);
+                    break;
+                case SDLK_F3:
+                    overlay = !overlay;
+                    break;
+                case SDLK_F9:
+                    if (emulation.tracer)
+                    {
+                        dumpTrace(emulation.tracer, tracePath, ++traceDumps);
+                    }
                     break;
                 case SDLK_ESCAPE:
                     quit = 1;
                     break;
                 default:
-                    interpretKeyPress(chip8State, e.key.keysym.sym);
                     break;
                 }
             }
         }
+        Chip8TraceEnd(trace, "events", spanStart);
 
-        if (!advanceFrame)
+        // load an edited ROM here, so the emulation thread only has to swap it in
+        if (romWatch && Chip8FileChanged(romWatch))
         {
-            // run emulator; execute program
-            EmulateChip8(chip8State);
-
-#if DEBUG
-            // output register values
-            printf("0:%02x 1:%02x 2:%02x 3:%02x 4:%02x 5:%02x 6:%02x 7:%02x 8:%02x 9:%02x A:%02x B:%02x C:%02x D:%02x E:%02x F:%02x I:%03x PC:%03x instr:%04x\n",
-                   chip8State->V[0x0],
-                   chip8State->V[0x1],
-                   chip8State->V[0x2],
-                   chip8State->V[0x3],
-                   chip8State->V[0x4],
-                   chip8State->V[0x5],
-                   chip8State->V[0x6],
-                   chip8State->V[0x7],
-                   chip8State->V[0x8],
-                   chip8State->V[0x9],
-                   chip8State->V[0xA],
-                   chip8State->V[0xB],
-                   chip8State->V[0xC],
-                   chip8State->V[0xD],
-                   chip8State->V[0xE],
-                   chip8State->V[0xF],
-                   chip8State->I,
-                   chip8State->PC,
-                   (chip8State->memory[chip8State->PC] << 8) | chip8State->memory[chip8State->PC + 1]);
-#endif
+            Chip8Image *edited = LoadChip8Image(profile, romPath);
+            if (edited)
+            {
+                // replacing a reload the emulation thread hasn't taken yet
+                DestroyChip8Image(SDL_AtomicSetPtr(&emulation.reload, edited));
+                printf("reloaded %s\n", romPath);
+            }
+            else
+            {
+                printf("ERROR: Couldn't reload %s\n", romPath);
+            }
+        }
 
-            renderScreen(surface, chip8State);
+        // draw the newest frame the emulator has finished, if there is one
+        const Chip8Frame *frame = window ? AcquireChip8Frame(&emulation.frames) : NULL;
+        if (frame)
+        {
+            spanStart = Chip8TraceBegin(trace);
+            renderScreen(renderer, surface, frame);
+            if (overlay)
+            {
+                drawOverlay(surface, emulation.stats);
+            }
+            Chip8TraceEnd(trace, "render", spanStart);
+            spanStart = Chip8TraceBegin(trace);
             SDL_UpdateWindowSurface(window);
+            Chip8TraceEnd(trace, "update window", spanStart);
 
-            advanceFrame = 0;
+            uint64_t latency = 0;
+            if (frame->inputTime)
+            {
+                latency = SDL_GetPerformanceCounter() - frame->inputTime;
+                latencyTotal += latency;
+                latencyMax = latency > latencyMax ? latency : latencyMax;
+                ++latencyCount;
+            }
+            RecordChip8RenderedFrame(emulation.stats, frame->number, latency);
         }
 
         // time at end of frame
+        spanStart = Chip8TraceBegin(trace);
         uint32_t timeDiff = (SDL_GetTicks() - prevTime);
         if (timeDiff < SCREEN_TICKS_PER_OP)
         {
             SDL_Delay(SCREEN_TICKS_PER_OP - timeDiff);
         }
         prevTime = SDL_GetTicks();
+        Chip8TraceEnd(trace, "delay", spanStart);
+        Chip8TraceEnd(trace, "frame", frameStart);
+    }
+
+    SDL_AtomicSet(&emulation.quit, 1);
+    SDL_WaitThread(emulator, NULL);
+
+    if (emulation.tracer)
+    {
+        dumpTrace(emulation.tracer, tracePath, 0);
+        DestroyChip8Tracer(emulation.tracer);
+    }
+
+    if (showLatency && latencyCount)
+    {
+        double msPerCount = 1000.0 / (double)SDL_GetPerformanceFrequency();
+        printf("input latency: %.1f ms average, %.1f ms worst, over %u presses\n",
+               (double)latencyTotal / latencyCount * msPerCount, (double)latencyMax * msPerCount, latencyCount);
     }
 
+    if (emulation.capture && !CloseChip8Capture(emulation.capture))
+    {
+        printf("ERROR: Recording to %s failed\n", recordPath);
+    }
+    CloseChip8FrameServer(emulation.server);
+    DestroyChip8Stats(emulation.stats);
+
     // destroy the window and quit the subsystems
-    SDL_DestroyWindow(window);
+    CloseChip8Audio(audio);
+    FreeChip8Input(&emulation.input);
+    CloseChip8FileWatch(romWatch);
+    DestroyChip8(chip8State);
+    DestroyChip8Image(SDL_AtomicSetPtr(&emulation.reload, NULL));
+    DestroyChip8Image(emulation.image);
+    if (window)
+    {
+        FreeChip8Renderer(renderer);
+        free(renderer);
+        SDL_DestroyWindow(window);
+    }
     SDL_Quit();
 
     return 0;
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+#define CACHE_LINE 64u
+#define POOL_PAGES_PER_CHUNK 64u
+
+// page chunks are kept in a list so the pool can free them
+typedef struct PageChunk
+{
+    struct PageChunk *next;
+} PageChunk;
+
+struct Chip8Pool
+{
+    const Chip8Image *image;
+    void *allocation;   // what malloc returned for the slots
+    uint8_t *slots;     // cache-line aligned
+    size_t slotSize;    // sizeof(Chip8State) rounded up to a cache line
+    uint32_t capacity;
+    uint32_t *freeSlots; // stack of free slot indices
+    uint32_t freeCount;
+    uint8_t *freePages;  // free list threaded through the pages themselves
+    PageChunk *chunks;
+    size_t pageSize;
+};
+
+Chip8Pool *CreateChip8Pool(const Chip8Image *image, uint32_t capacity)
+{
+    Chip8Pool *pool = calloc(sizeof(Chip8Pool), 1);
+    if (!pool)
+    {
+        return NULL;
+    }
+
+    pool->image = image;
+    pool->capacity = capacity;
+    pool->pageSize = (size_t)1 << image->pageShift;
+    pool->slotSize = (sizeof(Chip8State) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    pool->allocation = malloc(pool->slotSize * capacity + CACHE_LINE);
+    pool->freeSlots = malloc(sizeof(uint32_t) * capacity);
+    if (!pool->allocation || !pool->freeSlots)
+    {
+        free(pool->allocation);
+        free(pool->freeSlots);
+        free(pool);
+        return NULL;
+    }
+    pool->slots = (uint8_t *)(((uintptr_t)pool->allocation + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1));
+
+    // hand out low slots first
+    for (uint32_t i = 0; i < capacity; ++i)
+    {
+        pool->freeSlots[i] = capacity - 1 - i;
+    }
+    pool->freeCount = capacity;
+
+    return pool;
+}
+
+void DestroyChip8Pool(Chip8Pool *pool)
+{
+    if (!pool)
+    {
+        return;
+    }
+
+    while (pool->chunks)
+    {
+        PageChunk *next = pool->chunks->next;
+        free(pool->chunks);
+        pool->chunks = next;
+    }
+    free(pool->allocation);
+    free(pool->freeSlots);
+    free(pool);
+}
+
+Chip8State *AcquireChip8(Chip8Pool *pool)
+{
+    if (!pool->freeCount)
+    {
+        return NULL;
+    }
+
+    Chip8State *state = (Chip8State *)(pool->slots + pool->slotSize * pool->freeSlots[--pool->freeCount]);
+    memcpy(state, pool->image->pristine, sizeof(Chip8State));
+    state->pool = pool;
+    return state;
+}
+
+void ReleaseChip8(Chip8Pool *pool, Chip8State *state)
+{
+    for (uint32_t page = 0; page < PAGE_COUNT; ++page)
+    {
+        if (state->privatePages & (1u << page))
+        {
+            FreeChip8PoolPage(pool, state->pages[page]);
+        }
+    }
+    state->privatePages = 0;
+    state->writablePages = 0;
+
+    pool->freeSlots[pool->freeCount++] = (uint32_t)(((uint8_t *)state - pool->slots) / pool->slotSize);
+}
+
+uint8_t *AllocChip8PoolPage(Chip8Pool *pool)
+{
+    if (!pool->freePages)
+    {
+        // grow by a chunk of pages; the header is padded out to a cache line
+        PageChunk *chunk = malloc(CACHE_LINE + pool->pageSize * POOL_PAGES_PER_CHUNK);
+        if (!chunk)
+        {
+            return NULL;
+        }
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+
+        uint8_t *pages = (uint8_t *)chunk + CACHE_LINE;
+        for (uint32_t i = 0; i < POOL_PAGES_PER_CHUNK; ++i)
+        {
+            FreeChip8PoolPage(pool, pages + pool->pageSize * i);
+        }
+    }
+
+    uint8_t *page = pool->freePages;
+    memcpy(&pool->freePages, page, sizeof(uint8_t *));
+    return page;
+}
+
+void FreeChip8PoolPage(Chip8Pool *pool, uint8_t *page)
+{
+    memcpy(page, &pool->freePages, sizeof(uint8_t *));
+    pool->freePages = page;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+/**
+ * Machine pool
+ * A fixed number of Chip8State slots, each on its own cache lines, plus a
+ *  free list of RAM pages for the machines' private copies. Acquiring,
+ *  resetting and releasing machines never touches malloc once the pool's
+ *  page chunks have grown to the working set. Not thread-safe: give each
+ *  thread its own pool.
+ */
+typedef struct Chip8Pool Chip8Pool;
+
+// a pool of `capacity` machines running the image; the image must outlive it
+Chip8Pool *CreateChip8Pool(const Chip8Image *image, uint32_t capacity);
+
+// frees every slot and page; machines still acquired become invalid
+void DestroyChip8Pool(Chip8Pool *pool);
+
+// a machine in its post-load state, or NULL if every slot is in use
+Chip8State *AcquireChip8(Chip8Pool *pool);
+
+// hand a machine (and its private pages) back; DestroyChip8 does this for pool machines
+void ReleaseChip8(Chip8Pool *pool, Chip8State *state);
+
+// used by PrivatizeChip8Page/ResetChip8 for machines that came from a pool
+uint8_t *AllocChip8PoolPage(Chip8Pool *pool);
+void FreeChip8PoolPage(Chip8Pool *pool, uint8_t *page);
@@ -0,0 +1,106 @@
+"""Batched CHIP-8 environments for reinforcement learning, over rl.h.
+
+Build the shared library first (see README), then:
+
+    env = Chip8Batch("pong.ch8", count=64)
+    env.add_reward(memory=0x2F0, size=1)  # reward is how much this byte went up
+    env.add_done(register=0xE, value=0)   # episode over when VE is 0
+    obs = env.reset(seed=1)
+    obs, rewards, dones = env.step(actions)
+
+The arrays returned are the batch's own: every step writes straight into
+them, so copy anything you want to keep past the next step.
+"""
+
+import ctypes
+import os
+
+import numpy as np
+
+PROFILES = {"default": 0, "vip": 1, "chip48": 2, "schip": 3, "xochip": 4}
+OBSERVE_PIXELS = 0  # (64, 128) uint8, plane 1 | plane 2 << 1
+OBSERVE_PACKED = 1  # the raw display words plus a high resolution byte
+HOOK_MEMORY = 0
+HOOK_REGISTER = 1
+
+
+def _load(path=None):
+    if path is None:
+        here = os.path.dirname(os.path.abspath(__file__))
+        name = "chip8rl.dll" if os.name == "nt" else "libchip8rl.so"
+        path = os.path.join(here, name)
+    lib = ctypes.CDLL(path)
+    p = ctypes.c_void_p
+    u32 = ctypes.c_uint32
+    lib.CreateChip8Batch.restype = p
+    lib.CreateChip8Batch.argtypes = [ctypes.c_int, ctypes.c_char_p, u32, u32, u32, ctypes.c_int]
+    lib.DestroyChip8Batch.argtypes = [p]
+    lib.Chip8BatchObservationSize.restype = u32
+    lib.Chip8BatchObservationSize.argtypes = [p]
+    lib.SetChip8BatchOutputs.argtypes = [p, p, p, p]
+    lib.AddChip8RewardHook.argtypes = [p, ctypes.c_int, u32, u32, ctypes.c_float]
+    lib.AddChip8DoneHook.argtypes = [p, ctypes.c_int, u32, u32, u32]
+    lib.SetChip8BatchMaxSteps.argtypes = [p, u32]
+    lib.ResetChip8Batch.argtypes = [p, u32]
+    lib.StepChip8Batch.argtypes = [p, p]
+    return lib
+
+
+class Chip8Batch:
+    """`count` copies of a ROM stepped together, `frame` instructions a step."""
+
+    def __init__(self, rom, count, frame=10, profile="default", observation=OBSERVE_PIXELS, library=None):
+        self._lib = _load(library)
+        with open(rom, "rb") as f:
+            data = f.read()
+        self._batch = self._lib.CreateChip8Batch(PROFILES[profile], data, len(data), count, frame, observation)
+        if not self._batch:
+            raise MemoryError("couldn't create the batch")
+
+        self.count = count
+        size = self._lib.Chip8BatchObservationSize(self._batch)
+        shape = (count, 64, 128) if observation == OBSERVE_PIXELS else (count, size)
+        self.observations = np.zeros(shape, dtype=np.uint8)
+        self.rewards = np.zeros(count, dtype=np.float32)
+        self.dones = np.zeros(count, dtype=np.uint8)
+        self._actions = np.zeros(count, dtype=np.uint16)
+        self._lib.SetChip8BatchOutputs(self._batch, self.observations.ctypes.data, self.rewards.ctypes.data, self.dones.ctypes.data)
+
+    def close(self):
+        if self._batch:
+            self._lib.DestroyChip8Batch(self._batch)
+            self._batch = None
+
+    def __del__(self):
+        self.close()
+
+    @staticmethod
+    def _source(memory, register, size):
+        if (memory is None) == (register is None):
+            raise ValueError("give one of memory= or register=")
+        return (HOOK_MEMORY, memory, size) if register is None else (HOOK_REGISTER, register, 1)
+
+    def add_reward(self, memory=None, register=None, size=1, scale=1.0):
+        """Reward scale * how much a value (big-endian in memory, or a V register) went up each step."""
+        source, at, size = self._source(memory, register, size)
+        if not self._lib.AddChip8RewardHook(self._batch, source, at, size, scale):
+            raise ValueError("too many reward hooks, or a bad one")
+
+    def add_done(self, value, memory=None, register=None, size=1):
+        """End the episode when a value reads `value` (halting always ends it)."""
+        source, at, size = self._source(memory, register, size)
+        if not self._lib.AddChip8DoneHook(self._batch, source, at, size, value):
+            raise ValueError("too many done hooks, or a bad one")
+
+    def set_max_steps(self, steps):
+        self._lib.SetChip8BatchMaxSteps(self._batch, steps)
+
+    def reset(self, seed=0):
+        self._lib.ResetChip8Batch(self._batch, seed)
+        return self.observations
+
+    def step(self, actions):
+        """actions: a held-key bitmask (bit n = key n) for each environment."""
+        np.copyto(self._actions, actions, casting="unsafe")
+        self._lib.StepChip8Batch(self._batch, self._actions.ctypes.data)
+        return self.observations, self.rewards, self.dones
@@ -0,0 +1,557 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "tools.h"
+
+/**
+ * Static recompiler
+ * Translates a ROM into C: one function per basic block, and a dispatcher
+ *  that switches on PC to pick the block to run next. Anything it can't
+ *  translate ahead of time is handed to the interpreter one instruction at
+ *  a time: draws, key waits, memory writes and the rarer extension
+ *  instructions, PCs that were never found statically (computed BNNN
+ *  jumps, data run as code) and blocks whose bytes have been overwritten
+ *  since loading. So the generated code always does exactly what
+ *  EmulateChip8 would, instruction for instruction, only faster.
+ */
+
+// what is known about an address in the ROM
+#define RECOMPILE_REACHED 1 // decoded as an instruction
+#define RECOMPILE_LEADER 2  // a block starts here
+
+// how an instruction affects the block it's in
+typedef enum RecompileKind
+{
+    RECOMPILE_INLINE,   // straight-line code; the block carries on
+    RECOMPILE_BRANCH,   // translated, and ends the block (jumps, calls, skips, returns)
+    RECOMPILE_FALLBACK, // ends the block, run by the interpreter
+} RecompileKind;
+
+typedef struct Recompiler
+{
+    const Chip8Image *image;
+    Chip8Profile profile;
+    const Chip8Quirks *quirks; // the profile's, as its core has them
+    uint32_t start; // ROM bytes are [start, end)
+    uint32_t end;
+    uint8_t *marks;      // RECOMPILE_* per address
+    uint16_t *blockSize; // instructions in the block starting at each leader
+} Recompiler;
+
+static uint8_t romByte(const Recompiler *rc, uint32_t addr)
+{
+    return rc->image->memory[addr & (rc->image->memorySize - 1)];
+}
+
+static int inRom(const Recompiler *rc, uint32_t pc)
+{
+    return pc >= rc->start && pc + 2 <= rc->end;
+}
+
+/**
+ * Decode one instruction: what kind it is and where control can go next
+ * Successors of branches and fallbacks start blocks; the successor of an
+ *  inline instruction is just the next one in the same block.
+ */
+static RecompileKind classify(const Recompiler *rc, uint32_t pc, uint32_t *next, int *count)
+{
+    uint8_t hi = romByte(rc, pc);
+    uint8_t lo = romByte(rc, pc + 1);
+    uint8_t X = hi & 0x0f;
+    uint16_t NNN = ((hi & 0x0f) << 8) | lo;
+    int xo = rc->quirks->xochip;
+
+    // a skip can step over 2 bytes, or 4 if XO-CHIP finds an F000 NNNN next
+    uint32_t skipNext[3] = {pc + 2, pc + 4, pc + 6};
+    int skipCount = xo ? 3 : 2;
+
+    *count = 0;
+    switch (hi >> 4)
+    {
+    case 0x0:
+        if (hi == 0x00 && lo == 0xee)
+        {
+            return RECOMPILE_BRANCH; // RET: wherever the stack says
+        }
+        if (rc->quirks->schip && hi == 0x00 && lo == 0xfd)
+        {
+            return RECOMPILE_FALLBACK; // EXIT stays put
+        }
+        next[(*count)++] = pc + 2;
+        return RECOMPILE_FALLBACK;
+    case 0x1:
+        next[(*count)++] = NNN;
+        return RECOMPILE_BRANCH;
+    case 0x2:
+        next[(*count)++] = NNN;
+        next[(*count)++] = pc + 2; // where RET comes back to
+        return RECOMPILE_BRANCH;
+    case 0x3:
+    case 0x4:
+    case 0x9:
+        memcpy(next, skipNext, sizeof(skipNext));
+        *count = skipCount;
+        return RECOMPILE_BRANCH;
+    case 0x5:
+        if (!xo || (lo & 0x0f) == 0x0)
+        {
+            memcpy(next, skipNext, sizeof(skipNext));
+            *count = skipCount;
+            return RECOMPILE_BRANCH;
+        }
+        next[(*count)++] = pc + 2;
+        return (lo & 0x0f) == 0x2 || (lo & 0x0f) == 0x3 ? RECOMPILE_FALLBACK : RECOMPILE_INLINE;
+    case 0xb:
+        return RECOMPILE_BRANCH; // computed; found at run time
+    case 0xd:
+        next[(*count)++] = pc + 2;
+        return RECOMPILE_FALLBACK;
+    case 0xe:
+        if (lo == 0x9e || lo == 0xa1)
+        {
+            memcpy(next, skipNext, sizeof(skipNext));
+            *count = skipCount;
+            return RECOMPILE_BRANCH;
+        }
+        next[(*count)++] = pc + 2;
+        return RECOMPILE_INLINE;
+    case 0xf:
+        switch (lo)
+        {
+        case 0x00:
+            if (xo && X == 0)
+            {
+                next[(*count)++] = pc + 4; // F000 NNNN is 4 bytes long
+                return RECOMPILE_FALLBACK;
+            }
+            break;
+        case 0x02:
+            if (xo && X == 0)
+            {
+                next[(*count)++] = pc + 2;
+                return RECOMPILE_FALLBACK;
+            }
+            break;
+        case 0x0a:
+            next[(*count)++] = pc + 2;
+            return RECOMPILE_FALLBACK;
+        case 0x33:
+        case 0x55:
+        case 0x75:
+        case 0x85:
+            next[(*count)++] = pc + 2;
+            return RECOMPILE_FALLBACK;
+        }
+        next[(*count)++] = pc + 2;
+        return RECOMPILE_INLINE;
+    default:
+        next[(*count)++] = pc + 2;
+        return RECOMPILE_INLINE;
+    }
+}
+
+// follow every statically known path from PROGRAM_BUFFER, marking instructions and block starts; 0 if out of memory
+static int discover(Recompiler *rc)
+{
+    uint32_t *work = malloc(sizeof(uint32_t) * (rc->end - rc->start + 1) * 4);
+    uint32_t pending = 0;
+    if (!work)
+    {
+        return 0;
+    }
+
+    rc->marks[PROGRAM_BUFFER] |= RECOMPILE_LEADER;
+    work[pending++] = PROGRAM_BUFFER;
+    while (pending)
+    {
+        uint32_t pc = work[--pending];
+        if (!inRom(rc, pc) || (rc->marks[pc] & RECOMPILE_REACHED))
+        {
+            continue;
+        }
+        rc->marks[pc] |= RECOMPILE_REACHED;
+
+        uint32_t next[3];
+        int count;
+        RecompileKind kind = classify(rc, pc, next, &count);
+        for (int n = 0; n < count; ++n)
+        {
+            if (!inRom(rc, next[n]))
+            {
+                continue;
+            }
+            if (kind != RECOMPILE_INLINE)
+            {
+                rc->marks[next[n]] |= RECOMPILE_LEADER;
+            }
+            work[pending++] = next[n];
+        }
+    }
+
+    free(work);
+    return 1;
+}
+
+// instructions from a leader up to and including the one that ends its block
+static uint16_t measureBlock(const Recompiler *rc, uint32_t pc)
+{
+    uint16_t size = 0;
+    for (;;)
+    {
+        uint32_t next[3];
+        int count;
+        RecompileKind kind = classify(rc, pc, next, &count);
+        ++size;
+        if (kind != RECOMPILE_INLINE)
+        {
+            return size;
+        }
+        pc += 2;
+        if (!inRom(rc, pc) || (rc->marks[pc] & RECOMPILE_LEADER))
+        {
+            return size;
+        }
+    }
+}
+
+// the bytes for a skip, decided at run time on XO-CHIP
+static const char *skipWidth(const Recompiler *rc, uint32_t pc)
+{
+    static char width[96];
+    if (!rc->quirks->xochip)
+    {
+        return "2";
+    }
+    snprintf(width, sizeof(width), "SKIP_WIDTH(0x%04x)", pc);
+    return width;
+}
+
+// emit the C for one instruction
+static void emitInstruction(const Recompiler *rc, uint32_t pc, RecompileKind kind)
+{
+    uint8_t hi = romByte(rc, pc);
+    uint8_t lo = romByte(rc, pc + 1);
+    uint8_t X = hi & 0x0f;
+    uint8_t Y = lo >> 4;
+    uint8_t N = lo & 0x0f;
+    uint16_t NNN = ((hi & 0x0f) << 8) | lo;
+    uint16_t after = (uint16_t)(pc + 2);
+
+    if (kind == RECOMPILE_FALLBACK)
+    {
+        printf("    state->PC = 0x%04x;\n", pc);
+        printf("    EmulateChip8(state);\n");
+        return;
+    }
+
+    switch (hi >> 4)
+    {
+    case 0x0: // RET
+        printf("    state->SP = (state->SP - 1) & (STACK_DEPTH - 1);\n");
+        printf("    state->PC = state->stack[state->SP];\n");
+        break;
+    case 0x1:
+        printf("    state->PC = 0x%04x;\n", NNN);
+        break;
+    case 0x2:
+        printf("    state->stack[state->SP] = 0x%04x;\n", after);
+        printf("    state->SP = (state->SP + 1) & (STACK_DEPTH - 1);\n");
+        printf("    state->PC = 0x%04x;\n", NNN);
+        break;
+    case 0x3:
+        printf("    state->PC = V[0x%x] == 0x%02x ? 0x%04x + %s : 0x%04x;\n", X, lo, after, skipWidth(rc, pc), after);
+        break;
+    case 0x4:
+        printf("    state->PC = V[0x%x] != 0x%02x ? 0x%04x + %s : 0x%04x;\n", X, lo, after, skipWidth(rc, pc), after);
+        break;
+    case 0x5:
+        if (kind == RECOMPILE_BRANCH)
+        {
+            printf("    state->PC = V[0x%x] == V[0x%x] ? 0x%04x + %s : 0x%04x;\n", X, Y, after, skipWidth(rc, pc), after);
+        }
+        break;
+    case 0x6:
+        printf("    V[0x%x] = 0x%02x;\n", X, lo);
+        break;
+    case 0x7:
+        printf("    V[0x%x] += 0x%02x;\n", X, lo);
+        break;
+    case 0x8:
+    {
+        uint8_t src = rc->quirks->shiftVy ? Y : X;
+        switch (N)
+        {
+        case 0x0:
+            printf("    V[0x%x] = V[0x%x];\n", X, Y);
+            break;
+        case 0x1:
+        case 0x2:
+        case 0x3:
+            printf("    V[0x%x] %s= V[0x%x];\n", X, N == 1 ? "|" : N == 2 ? "&" : "^", Y);
+            if (rc->quirks->vfReset)
+            {
+                printf("    V[0xf] = 0;\n");
+            }
+            break;
+        case 0x4:
+            printf("    { uint16_t r = V[0x%x] + V[0x%x]; V[0x%x] = (uint8_t)r; V[0xf] = r > 0xff; }\n", X, Y, X);
+            break;
+        case 0x5:
+            printf("    { uint8_t f = V[0x%x] >= V[0x%x]; V[0x%x] -= V[0x%x]; V[0xf] = f; }\n", X, Y, X, Y);
+            break;
+        case 0x6:
+            printf("    { uint8_t s = V[0x%x]; V[0x%x] = s >> 1; V[0xf] = s & 1; }\n", src, X);
+            break;
+        case 0x7:
+            printf("    { uint8_t f = V[0x%x] >= V[0x%x]; V[0x%x] = V[0x%x] - V[0x%x]; V[0xf] = f; }\n", Y, X, X, Y, X);
+            break;
+        case 0xe:
+            printf("    { uint8_t s = V[0x%x]; V[0x%x] = s << 1; V[0xf] = s >> 7; }\n", src, X);
+            break;
+        }
+    }
+    break;
+    case 0x9:
+        printf("    state->PC = V[0x%x] != V[0x%x] ? 0x%04x + %s : 0x%04x;\n", X, Y, after, skipWidth(rc, pc), after);
+        break;
+    case 0xa:
+        printf("    state->I = 0x%03x;\n", NNN);
+        break;
+    case 0xb:
+        printf("    state->PC = 0x%03x + (uint16_t)V[0x%x];\n", NNN, rc->quirks->jumpVx ? X : 0);
+        break;
+    case 0xc:
+        printf("    V[0x%x] = Chip8Random(state) & 0x%02x;\n", X, lo);
+        break;
+    case 0xe:
+        if (lo == 0x9e || lo == 0xa1)
+        {
+            printf("    state->PC = %s((state->keys >> (V[0x%x] & 0xf)) & 1) ? 0x%04x + %s : 0x%04x;\n",
+                   lo == 0xa1 ? "!" : "", X, after, skipWidth(rc, pc), after);
+        }
+        break;
+    case 0xf:
+        switch (lo)
+        {
+        case 0x01:
+            if (rc->quirks->xochip)
+            {
+                printf("    state->planes = 0x%x;\n", X & 0x3);
+            }
+            break;
+        case 0x07:
+            printf("    V[0x%x] = state->delay;\n", X);
+            break;
+        case 0x15:
+            printf("    state->delay = V[0x%x];\n", X);
+            break;
+        case 0x18:
+            printf("    state->sound = V[0x%x];\n", X);
+            break;
+        case 0x1e:
+            printf("    state->I += V[0x%x];\n", X);
+            break;
+        case 0x29:
+            printf("    state->I = (V[0x%x] & 0xf) * 5;\n", X);
+            break;
+        case 0x30:
+            if (rc->quirks->schip)
+            {
+                printf("    state->I = BIGFONT_BUFFER + (V[0x%x] & 0xf) * 10;\n", X);
+            }
+            break;
+        case 0x3a:
+            if (rc->quirks->xochip)
+            {
+                printf("    state->pitch = V[0x%x];\n", X);
+            }
+            break;
+        case 0x65:
+            printf("    for (int v = 0; v <= 0x%x; ++v)\n", X);
+            printf("        V[v] = Chip8ReadMemory(state, state->I + v);\n");
+            if (rc->quirks->loadStoreInc)
+            {
+                printf("    state->I += %d;\n", X + (rc->quirks->loadStoreInc == 1));
+            }
+            break;
+        }
+        break;
+    }
+}
+
+// one function per block: run and account for each instruction in it
+static void emitBlock(const Recompiler *rc, uint32_t leader)
+{
+    uint16_t size = rc->blockSize[leader];
+    uint32_t pc = leader;
+
+    printf("static uint32_t block%04x(Chip8State *state)\n{\n", leader);
+    for (uint16_t i = 0; i < size; ++i, pc += 2)
+    {
+        uint32_t next[3];
+        int count;
+        RecompileKind kind = classify(rc, pc, next, &count);
+
+        printf("    // ");
+        disassembleChip8(rc->image->memory, (int)pc);
+        printf("\n");
+        emitInstruction(rc, pc, kind);
+
+        // ran into the next block, or off the end of what was found
+        if (i + 1 == size && kind == RECOMPILE_INLINE)
+        {
+            printf("    state->PC = 0x%04x;\n", (uint16_t)(pc + 2));
+        }
+    }
+    printf("    return %u;\n}\n\n", size);
+}
+
+// pages a block's bytes live in, so the dispatcher only checks them once one has been written
+static uint32_t blockPages(const Recompiler *rc, uint32_t leader)
+{
+    uint32_t last = leader + rc->blockSize[leader] * 2 - 1;
+    uint32_t pages = 0;
+    for (uint32_t page = leader >> rc->image->pageShift; page <= (last >> rc->image->pageShift); ++page)
+    {
+        pages |= 1u << (page & (PAGE_COUNT - 1));
+    }
+    return pages;
+}
+
+static void emitProgram(const Recompiler *rc, const char *rom, const char *name)
+{
+    const char *profile = Chip8ProfileName(rc->profile);
+    uint32_t romSize = rc->end - rc->start;
+
+    printf("/**\n");
+    printf(" * Generated by `chip8 recompile` from %s (profile %s); don't edit.\n", rom, profile);
+    printf(" * %s(state, n) runs n instructions of a machine made from this ROM\n", name);
+    printf(" *  and returns how many it ran. Link it with chip8.c.\n");
+    printf(" */\n\n");
+    printf("#include \"chip8.h\"\n\n");
+    printf("#define V state->V\n");
+    printf("#define SKIP_WIDTH(pc) (Chip8ReadMemory(state, (pc) + 2) == 0xf0 && Chip8ReadMemory(state, (pc) + 3) == 0x00 ? 4 : 2)\n\n");
+
+    // the ROM as compiled, to spot blocks that have since been overwritten
+    printf("static const uint8_t rom[%u] = {", romSize);
+    for (uint32_t b = 0; b < romSize; ++b)
+    {
+        printf("%s0x%02x,", b % 16 ? " " : "\n    ", romByte(rc, rc->start + b));
+    }
+    printf("\n};\n\n");
+    printf("static int intact(const Chip8State *state, uint32_t addr, uint32_t size)\n{\n");
+    printf("    uint32_t offset = addr & ((1u << state->pageShift) - 1);\n");
+    printf("    if (offset + size <= (1u << state->pageShift))\n");
+    printf("        return memcmp(&state->pages[addr >> state->pageShift][offset], &rom[addr - 0x%04x], size) == 0;\n", rc->start);
+    printf("    for (uint32_t b = 0; b < size; ++b)\n    {\n");
+    printf("        if (Chip8ReadMemory(state, addr + b) != rom[addr + b - 0x%04x])\n", rc->start);
+    printf("            return 0;\n    }\n    return 1;\n}\n\n");
+
+    for (uint32_t pc = rc->start; pc < rc->end; ++pc)
+    {
+        if (rc->marks[pc] & RECOMPILE_LEADER)
+        {
+            emitBlock(rc, pc);
+        }
+    }
+
+    printf("uint64_t %s(Chip8State *state, uint64_t instructions)\n{\n", name);
+    printf("    uint64_t done = 0;\n");
+    printf("    if (state->profile != %d)\n    {\n", rc->profile);
+    printf("        // built for another profile; only the interpreter can run it\n");
+    printf("        for (; done < instructions; ++done)\n            EmulateChip8(state);\n");
+    printf("        return done;\n    }\n\n");
+    printf("    while (done < instructions)\n    {\n");
+    printf("        uint64_t left = instructions - done;\n");
+    printf("        uint32_t ran = 0;\n");
+    printf("        switch (state->PC)\n        {\n");
+    for (uint32_t pc = rc->start; pc < rc->end; ++pc)
+    {
+        if (!(rc->marks[pc] & RECOMPILE_LEADER))
+        {
+            continue;
+        }
+        uint16_t size = rc->blockSize[pc];
+        printf("        case 0x%04x:\n", pc);
+        printf("            if (left >= %u && (!(state->privatePages & 0x%04x) || intact(state, 0x%04x, %u)))\n",
+               size, blockPages(rc, pc), pc, size * 2);
+        printf("                ran = block%04x(state);\n", pc);
+        printf("            break;\n");
+    }
+    printf("        }\n\n");
+    printf("        // no block here (computed jump, data run as code, rewritten code), or not enough budget for it\n");
+    printf("        if (!ran)\n        {\n");
+    printf("            EmulateChip8(state);\n");
+    printf("            ran = 1;\n        }\n");
+    printf("        done += ran;\n    }\n\n");
+    printf("    return done;\n}\n");
+}
+
+/**
+ * Writes a ROM out as C on stdout
+ * usage: recompile [--profile name] <rom> [function name]
+ */
+int recompile_main(int argc, char **argv)
+{
+    Chip8Profile profile = CHIP8_PROFILE_DEFAULT;
+    int a = 1;
+    if (argc > 2 && strcmp(argv[1], "--profile") == 0)
+    {
+        profile = Chip8ProfileFromName(argv[2]);
+        a = 3;
+    }
+    if (profile == CHIP8_PROFILE_COUNT || a >= argc)
+    {
+        printf("usage: recompile [--profile default|vip|chip48|schip|xochip] <rom> [function name]\n");
+        return 1;
+    }
+    const char *rom = argv[a];
+    const char *name = a + 1 < argc ? argv[a + 1] : "RunRecompiledChip8";
+
+    Chip8Image *image = LoadChip8Image(profile, rom);
+    if (!image)
+    {
+        printf("ERROR: Couldn't open %s\n", rom);
+        return 2;
+    }
+
+    Recompiler rc;
+    rc.image = image;
+    rc.profile = profile;
+    rc.quirks = GetChip8Quirks(profile);
+    rc.start = PROGRAM_BUFFER;
+    rc.end = PROGRAM_BUFFER + image->romSize;
+    rc.marks = calloc(image->memorySize, 1);
+    rc.blockSize = calloc(image->memorySize, sizeof(uint16_t));
+    if (!rc.marks || !rc.blockSize)
+    {
+        printf("ERROR: Out of memory\n");
+        return 3;
+    }
+
+    if (!discover(&rc))
+    {
+        printf("ERROR: Out of memory\n");
+        free(rc.marks);
+        free(rc.blockSize);
+        DestroyChip8Image(image);
+        return 3;
+    }
+    for (uint32_t pc = rc.start; pc < rc.end; ++pc)
+    {
+        if (rc.marks[pc] & RECOMPILE_LEADER)
+        {
+            rc.blockSize[pc] = measureBlock(&rc, pc);
+        }
+    }
+    emitProgram(&rc, rom, name);
+
+    free(rc.marks);
+    free(rc.blockSize);
+    DestroyChip8Image(image);
+
+    return 0;
+}
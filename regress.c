@@ -0,0 +1,453 @@
+#include <SDL/SDL.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "difftest.h"
+#include "tools.h"
+
+#define REGRESS_MAX_NAME 64
+#define REGRESS_MAX_PATH 1024
+#define REGRESS_MAX_CHECKPOINTS 64u
+#define REGRESS_MAX_THREADS 64
+
+// how a ROM's run went
+enum
+{
+    REGRESS_PASS,
+    REGRESS_FAIL,    // a hash differs from its golden one
+    REGRESS_NEW,     // no goldens, or goldens for other checkpoints
+    REGRESS_ERROR,   // the ROM or movie couldn't be loaded
+};
+
+// the hashes at one checkpoint
+typedef struct RegressCheckpoint
+{
+    uint64_t at; // instructions run
+    uint64_t display;
+    uint64_t registers;
+} RegressCheckpoint;
+
+/**
+ * Catalogue entry
+ * One ROM to run: a line `<name> <profile> <rom> <instructions> <checkpoints> [movie]`,
+ *  paths relative to the catalogue. The run is hashed at `checkpoints`
+ *  evenly spaced points, the last after `instructions`.
+ */
+typedef struct RegressEntry
+{
+    char name[REGRESS_MAX_NAME];
+    char rom[REGRESS_MAX_PATH];
+    char movie[REGRESS_MAX_PATH]; // "" for none
+    Chip8Profile profile;
+    uint64_t instructions;
+    uint32_t checkpoints;
+    // filled in by the run
+    RegressCheckpoint hashes[REGRESS_MAX_CHECKPOINTS];
+    int result;
+    uint32_t failed; // first checkpoint that differs
+    double seconds;
+} RegressEntry;
+
+// a line of the golden file: `<name> <at> <display hash> <register hash>`
+typedef struct RegressGolden
+{
+    char name[REGRESS_MAX_NAME];
+    RegressCheckpoint hashes;
+} RegressGolden;
+
+typedef struct Regression
+{
+    RegressEntry *entries;
+    uint32_t count;
+    const RegressGolden *goldens;
+    uint32_t goldenCount;
+    Chip8Engine engine; // RunChip8Runner, or RunChip8Reference with --reference
+    SDL_atomic_t next; // the next entry to claim
+} Regression;
+
+// compare an entry's hashes with its goldens, which are consecutive lines of the golden file
+static void checkEntry(const Regression *regression, RegressEntry *entry)
+{
+    uint32_t g = 0;
+    while (g < regression->goldenCount && strcmp(regression->goldens[g].name, entry->name) != 0)
+    {
+        ++g;
+    }
+    for (uint32_t c = 0; c < entry->checkpoints; ++c, ++g)
+    {
+        if (g >= regression->goldenCount || strcmp(regression->goldens[g].name, entry->name) != 0 ||
+            regression->goldens[g].hashes.at != entry->hashes[c].at)
+        {
+            entry->result = REGRESS_NEW;
+            return;
+        }
+        if (regression->goldens[g].hashes.display != entry->hashes[c].display ||
+            regression->goldens[g].hashes.registers != entry->hashes[c].registers)
+        {
+            entry->result = REGRESS_FAIL;
+            entry->failed = c;
+            return;
+        }
+    }
+    entry->result = REGRESS_PASS;
+}
+
+static void runEntry(const Regression *regression, RegressEntry *entry)
+{
+    uint64_t start = SDL_GetPerformanceCounter();
+    Chip8Image *image = LoadChip8Image(entry->profile, entry->rom);
+    Chip8Movie movie = {NULL, 0};
+    Chip8State *state = image ? InitChip8(image) : NULL;
+    if (!state || (entry->movie[0] && !LoadChip8Movie(&movie, entry->movie)))
+    {
+        entry->result = REGRESS_ERROR;
+    }
+    else
+    {
+        uint64_t done = 0;
+        for (uint32_t c = 0; c < entry->checkpoints; ++c)
+        {
+            uint64_t at = entry->instructions * (c + 1) / entry->checkpoints;
+            // a halted machine stays as it is, so later checkpoints just hash it again
+            done += RunChip8Movie(regression->engine, state, entry->movie[0] ? &movie : NULL, done, at - done);
+            entry->hashes[c].at = at;
+            entry->hashes[c].display = HashChip8Display(state);
+            entry->hashes[c].registers = HashChip8Registers(state);
+            done = at;
+        }
+        checkEntry(regression, entry);
+    }
+
+    FreeChip8Movie(&movie);
+    DestroyChip8(state);
+    DestroyChip8Image(image);
+    entry->seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+}
+
+// workers claim ROMs one at a time until there are none left
+static int regressThread(void *data)
+{
+    Regression *regression = data;
+    for (;;)
+    {
+        uint32_t e = (uint32_t)SDL_AtomicAdd(&regression->next, 1);
+        if (e >= regression->count)
+        {
+            return 0;
+        }
+        runEntry(regression, &regression->entries[e]);
+    }
+}
+
+// a path in the catalogue is relative to the catalogue's directory
+static void resolvePath(char *out, const char *catalogue, const char *path)
+{
+    const char *slash = strrchr(catalogue, '/');
+    const char *backslash = strrchr(catalogue, '\\');
+    if (backslash && (!slash || backslash > slash))
+    {
+        slash = backslash;
+    }
+    int absolute = path[0] == '/' || path[0] == '\\' || (path[0] && path[1] == ':');
+    if (absolute || !slash)
+    {
+        snprintf(out, REGRESS_MAX_PATH, "%s", path);
+    }
+    else
+    {
+        snprintf(out, REGRESS_MAX_PATH, "%.*s%s", (int)(slash - catalogue + 1), catalogue, path);
+    }
+}
+
+// returns the number of entries, or -1 (having said why) if the catalogue can't be read or has a bad line
+static int loadCatalogue(const char *path, RegressEntry **entries)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        printf("ERROR: Couldn't open %s\n", path);
+        return -1;
+    }
+
+    int count = 0;
+    int capacity = 0;
+    int lineNumber = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), file))
+    {
+        ++lineNumber;
+        char *hash = strchr(line, '#');
+        if (hash)
+        {
+            *hash = '\0';
+        }
+        char name[REGRESS_MAX_NAME], profile[32], rom[REGRESS_MAX_PATH], movie[REGRESS_MAX_PATH];
+        unsigned long long instructions;
+        unsigned checkpoints;
+        movie[0] = '\0';
+        int fields = sscanf(line, "%63s %31s %1023s %llu %u %1023s", name, profile, rom, &instructions, &checkpoints, movie);
+        if (fields <= 0)
+        {
+            continue;
+        }
+        Chip8Profile p = fields >= 2 ? Chip8ProfileFromName(profile) : CHIP8_PROFILE_COUNT;
+        if (fields < 5 || p == CHIP8_PROFILE_COUNT || !checkpoints || checkpoints > REGRESS_MAX_CHECKPOINTS || instructions < checkpoints)
+        {
+            printf("ERROR: %s:%d: expected <name> <profile> <rom> <instructions> <checkpoints (1-%u)> [movie]\n", path, lineNumber, REGRESS_MAX_CHECKPOINTS);
+            fclose(file);
+            free(*entries);
+            *entries = NULL;
+            return -1;
+        }
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            RegressEntry *grown = realloc(*entries, sizeof(RegressEntry) * capacity);
+            if (!grown)
+            {
+                printf("ERROR: Out of memory\n");
+                fclose(file);
+                free(*entries);
+                *entries = NULL;
+                return -1;
+            }
+            *entries = grown;
+        }
+        RegressEntry *entry = &(*entries)[count++];
+        memset(entry, 0, sizeof(RegressEntry));
+        snprintf(entry->name, sizeof(entry->name), "%s", name);
+        resolvePath(entry->rom, path, rom);
+        if (movie[0])
+        {
+            resolvePath(entry->movie, path, movie);
+        }
+        entry->profile = p;
+        entry->instructions = instructions;
+        entry->checkpoints = checkpoints;
+    }
+    fclose(file);
+    return count;
+}
+
+// returns the number of goldens; a missing file has none
+static uint32_t loadGoldens(const char *path, RegressGolden **goldens)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return 0;
+    }
+
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        RegressGolden golden;
+        unsigned long long at, display, registers;
+        if (line[0] == '#' || sscanf(line, "%63s %llu %llx %llx", golden.name, &at, &display, &registers) != 4)
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            RegressGolden *grown = realloc(*goldens, sizeof(RegressGolden) * capacity);
+            if (!grown)
+            {
+                break;
+            }
+            *goldens = grown;
+        }
+        golden.hashes.at = at;
+        golden.hashes.display = display;
+        golden.hashes.registers = registers;
+        (*goldens)[count++] = golden;
+    }
+    fclose(file);
+    return count;
+}
+
+static int writeGoldens(const char *path, const RegressEntry *entries, uint32_t count)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        return 0;
+    }
+    fprintf(file, "# <name> <instructions> <display hash> <register hash>, written by `chip8 regress --update`\n");
+    for (uint32_t e = 0; e < count; ++e)
+    {
+        for (uint32_t c = 0; entries[e].result != REGRESS_ERROR && c < entries[e].checkpoints; ++c)
+        {
+            fprintf(file, "%s %llu %016llx %016llx\n", entries[e].name, (unsigned long long)entries[e].hashes[c].at,
+                    (unsigned long long)entries[e].hashes[c].display, (unsigned long long)entries[e].hashes[c].registers);
+        }
+    }
+    return fclose(file) == 0;
+}
+
+/**
+ * Golden-image regression suite
+ * Runs every ROM in a catalogue headlessly for a fixed number of
+ *  instructions, replaying its movie if it has one, and hashes the
+ *  display and registers at its checkpoints. The hashes are compared
+ *  with the golden file (the catalogue's path plus `.golden`), or with
+ *  --update written to it. ROMs are shared out over every core.
+ * ROMs run through RunChip8Until's loop; --reference steps the core one
+ *  instruction per call instead, so goldens written by either way of
+ *  running the core check the other.
+ * Returns 0 if everything matched, 1 if anything didn't or had no goldens
+ *  and 2 if a ROM or movie couldn't be loaded.
+ * usage: regress [--update] [--reference] [--threads n] [--golden file] <catalogue>
+ */
+int regress_main(int argc, char **argv)
+{
+    int update = 0;
+    Chip8Engine engine = RunChip8Runner;
+    uint32_t threads = (uint32_t)SDL_GetCPUCount();
+    const char *goldenPath = NULL;
+    const char *catalogue = NULL;
+    int badArgs = 0;
+    for (int a = 1; a < argc && !badArgs; ++a)
+    {
+        if (strcmp(argv[a], "--update") == 0)
+        {
+            update = 1;
+        }
+        else if (strcmp(argv[a], "--reference") == 0)
+        {
+            engine = RunChip8Reference;
+        }
+        else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+        {
+            threads = (uint32_t)strtoul(argv[++a], NULL, 0);
+        }
+        else if (strcmp(argv[a], "--golden") == 0 && a + 1 < argc)
+        {
+            goldenPath = argv[++a];
+        }
+        else if (!catalogue && argv[a][0] != '-')
+        {
+            catalogue = argv[a];
+        }
+        else
+        {
+            badArgs = 1;
+        }
+    }
+    if (!catalogue || badArgs)
+    {
+        printf("usage: regress [--update] [--reference] [--threads n] [--golden file] <catalogue>\n");
+        return 1;
+    }
+
+    char defaultGolden[REGRESS_MAX_PATH];
+    if (!goldenPath)
+    {
+        snprintf(defaultGolden, sizeof(defaultGolden), "%s.golden", catalogue);
+        goldenPath = defaultGolden;
+    }
+
+    Regression regression;
+    memset(&regression, 0, sizeof(regression));
+    int count = loadCatalogue(catalogue, &regression.entries);
+    if (count < 0)
+    {
+        return 2;
+    }
+    regression.count = (uint32_t)count;
+    RegressGolden *goldens = NULL;
+    regression.goldenCount = update ? 0 : loadGoldens(goldenPath, &goldens);
+    regression.goldens = goldens;
+    regression.engine = engine;
+    SDL_AtomicSet(&regression.next, 0);
+
+    // this thread is worker 0
+    threads = threads < 1 ? 1 : threads > REGRESS_MAX_THREADS ? REGRESS_MAX_THREADS : threads;
+    threads = threads > regression.count ? (regression.count ? regression.count : 1) : threads;
+    SDL_Thread *workers[REGRESS_MAX_THREADS] = {NULL};
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (uint32_t t = 1; t < threads; ++t)
+    {
+        workers[t] = SDL_CreateThread(regressThread, "regress", &regression);
+    }
+    regressThread(&regression);
+    for (uint32_t t = 1; t < threads; ++t)
+    {
+        if (workers[t])
+        {
+            SDL_WaitThread(workers[t], NULL);
+        }
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+
+    uint32_t totals[4] = {0, 0, 0, 0};
+    for (uint32_t e = 0; e < regression.count; ++e)
+    {
+        const RegressEntry *entry = &regression.entries[e];
+        ++totals[entry->result];
+        switch (entry->result)
+        {
+        case REGRESS_PASS:
+            printf("ok    %-24s %8.3f s\n", entry->name, entry->seconds);
+            break;
+        case REGRESS_FAIL:
+        {
+            const RegressCheckpoint *got = &entry->hashes[entry->failed];
+            const RegressCheckpoint *want = &regression.goldens[0].hashes;
+            for (uint32_t g = 0; g < regression.goldenCount; ++g)
+            {
+                if (strcmp(regression.goldens[g].name, entry->name) == 0 && regression.goldens[g].hashes.at == got->at)
+                {
+                    want = &regression.goldens[g].hashes;
+                    break;
+                }
+            }
+            int display = got->display != want->display;
+            int registers = got->registers != want->registers;
+            printf("FAIL  %-24s %s after %llu instructions (checkpoint %u of %u)\n", entry->name,
+                   display && registers ? "display and registers differ" : display ? "display differs" : "registers differ",
+                   (unsigned long long)got->at, entry->failed + 1, entry->checkpoints);
+            break;
+        }
+        case REGRESS_NEW:
+            if (!update)
+            {
+                printf("NEW   %-24s no goldens for these checkpoints; run with --update\n", entry->name);
+            }
+            break;
+        case REGRESS_ERROR:
+            printf("ERROR %-24s couldn't load %s%s%s\n", entry->name, entry->rom, entry->movie[0] ? " or " : "", entry->movie);
+            break;
+        }
+    }
+
+    int status = totals[REGRESS_ERROR] ? 2 : totals[REGRESS_FAIL] || (!update && totals[REGRESS_NEW]) ? 1 : 0;
+    if (update)
+    {
+        if (!writeGoldens(goldenPath, regression.entries, regression.count))
+        {
+            printf("ERROR: Couldn't write %s\n", goldenPath);
+            status = 2;
+        }
+        else
+        {
+            printf("wrote goldens for %u ROMs to %s (%.2f s)\n", regression.count - totals[REGRESS_ERROR], goldenPath, seconds);
+        }
+    }
+    else
+    {
+        printf("%u passed, %u failed, %u without goldens, %u errors in %.2f s on %u thread%s\n",
+               totals[REGRESS_PASS], totals[REGRESS_FAIL], totals[REGRESS_NEW], totals[REGRESS_ERROR], seconds, threads, threads == 1 ? "" : "s");
+    }
+
+    free(goldens);
+    free(regression.entries);
+    return status;
+}
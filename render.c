@@ -0,0 +1,347 @@
+#include "render.h"
+
+#include <SDL/SDL.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RENDER_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__)
+// the rest of the build needn't be compiled for AVX2; these functions are only called if the CPU has it
+#define RENDER_TARGET(isa) __attribute__((target(isa)))
+#else
+#define RENDER_TARGET(isa)
+#endif
+#endif
+
+#define RENDER_SLACK 8u // pixels a vector store can run past the end of a scaled row
+
+Chip8RenderPath Chip8BestRenderPath(void)
+{
+#if RENDER_X86
+    if (SDL_HasAVX2())
+        return CHIP8_RENDER_AVX2;
+    if (SDL_HasSSE2())
+        return CHIP8_RENDER_SSE2;
+#endif
+    return CHIP8_RENDER_SCALAR;
+}
+
+static const char *const SMOOTHING_NAMES[CHIP8_SMOOTH_COUNT] = {"none", "scale2x", "scale3x"};
+
+Chip8Smoothing Chip8SmoothingFromName(const char *name)
+{
+    for (int s = 0; s < CHIP8_SMOOTH_COUNT; ++s)
+    {
+        if (strcmp(name, SMOOTHING_NAMES[s]) == 0)
+        {
+            return (Chip8Smoothing)s;
+        }
+    }
+    return CHIP8_SMOOTH_COUNT;
+}
+
+void InitChip8Renderer(Chip8Renderer *renderer, const uint32_t palette[4], Chip8Smoothing smoothing)
+{
+    memset(renderer, 0, sizeof(*renderer));
+    memcpy(renderer->palette, palette, sizeof(renderer->palette));
+    renderer->smoothing = smoothing < CHIP8_SMOOTH_COUNT ? smoothing : CHIP8_SMOOTH_NONE;
+    renderer->path = Chip8BestRenderPath();
+
+    for (uint32_t b = 0; b < 256; ++b)
+    {
+        for (uint32_t x = 0; x < 8; ++x)
+        {
+            renderer->single[b][x] = palette[(b >> (7 - x)) & 1];
+        }
+        for (uint32_t x = 0; x < 4; ++x)
+        {
+            uint32_t plane1 = (b >> (7 - x)) & 1;
+            uint32_t plane2 = (b >> (3 - x)) & 1;
+            renderer->dual[b][x] = palette[plane1 | (plane2 << 1)];
+        }
+    }
+}
+
+void FreeChip8Renderer(Chip8Renderer *renderer)
+{
+    free(renderer->scaled);
+    renderer->scaled = NULL;
+    renderer->scaledCapacity = 0;
+}
+
+// a display row into renderer->line through the lookup tables
+static void expandRow(Chip8Renderer *renderer, const Chip8Frame *frame, uint32_t y, uint32_t width)
+{
+    const uint64_t *plane1 = frame->display[0][y];
+    const uint64_t *plane2 = frame->display[1][y];
+    for (uint32_t w = 0; w < width >> 6; ++w)
+    {
+        uint32_t *line = renderer->line + w * 64;
+        uint64_t a = plane1[w];
+        uint64_t b = plane2[w];
+        if (!b)
+        {
+            for (uint32_t i = 0; i < 8; ++i)
+            {
+                memcpy(line + i * 8, renderer->single[(a >> (56 - i * 8)) & 0xff], 8 * sizeof(uint32_t));
+            }
+        }
+        else
+        {
+            for (uint32_t i = 0; i < 16; ++i)
+            {
+                uint32_t shift = 60 - i * 4;
+                uint32_t index = (uint32_t)(((a >> shift) & 0xf) << 4 | ((b >> shift) & 0xf));
+                memcpy(line + i * 4, renderer->dual[index], 4 * sizeof(uint32_t));
+            }
+        }
+    }
+}
+
+/**
+ * Stretching
+ * Pixel i of src fills dst[starts[i]] up to dst[starts[i + 1]]. The vector
+ *  versions store whole vectors, running into the next pixel (which
+ *  overwrites it) and past the end of the row (into the slack).
+ */
+static void stretchScalar(uint32_t *dst, const uint32_t *src, uint32_t count, const uint32_t *starts)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t colour = src[i];
+        for (uint32_t x = starts[i]; x < starts[i + 1]; ++x)
+        {
+            dst[x] = colour;
+        }
+    }
+}
+
+#if RENDER_X86
+RENDER_TARGET("sse2")
+static void stretchSse2(uint32_t *dst, const uint32_t *src, uint32_t count, const uint32_t *starts)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        __m128i colour = _mm_set1_epi32((int)src[i]);
+        for (uint32_t x = starts[i]; x < starts[i + 1]; x += 4)
+        {
+            _mm_storeu_si128((__m128i *)(dst + x), colour);
+        }
+    }
+}
+
+RENDER_TARGET("avx2")
+static void stretchAvx2(uint32_t *dst, const uint32_t *src, uint32_t count, const uint32_t *starts)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        __m256i colour = _mm256_set1_epi32((int)src[i]);
+        for (uint32_t x = starts[i]; x < starts[i + 1]; x += 8)
+        {
+            _mm256_storeu_si256((__m256i *)(dst + x), colour);
+        }
+    }
+}
+#endif
+
+static void stretch(Chip8RenderPath path, uint32_t *dst, const uint32_t *src, uint32_t count, const uint32_t *starts)
+{
+    switch (path)
+    {
+#if RENDER_X86
+    case CHIP8_RENDER_AVX2:
+        stretchAvx2(dst, src, count, starts);
+        break;
+    case CHIP8_RENDER_SSE2:
+        stretchSse2(dst, src, count, starts);
+        break;
+#endif
+    default:
+        stretchScalar(dst, src, count, starts);
+        break;
+    }
+}
+
+// palette indices of the whole display into renderer->grid
+static void indexDisplay(Chip8Renderer *renderer, const Chip8Frame *frame, uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            uint32_t bit = 63 - (x & 63);
+            renderer->grid[y][x] = (uint8_t)(((frame->display[0][y][x >> 6] >> bit) & 1) | (((frame->display[1][y][x >> 6] >> bit) & 1) << 1));
+        }
+    }
+}
+
+// neighbours off the edge of the display count as the pixel itself
+#define GRID(dx, dy) (x + (dx) < width && y + (dy) < height ? grid[y + (dy)][x + (dx)] : grid[y][x])
+
+static void scale2x(Chip8Renderer *renderer, uint32_t width, uint32_t height)
+{
+    const uint8_t(*grid)[HIRES_WIDTH] = renderer->grid;
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            uint8_t p = grid[y][x];
+            uint8_t a = GRID(0, -1), b = GRID(1, 0), c = GRID(-1, 0), d = GRID(0, 1);
+            uint8_t *top = &renderer->smooth[y * 2][x * 2];
+            uint8_t *bottom = &renderer->smooth[y * 2 + 1][x * 2];
+            top[0] = c == a && c != d && a != b ? a : p;
+            top[1] = a == b && a != c && b != d ? b : p;
+            bottom[0] = d == c && d != b && c != a ? c : p;
+            bottom[1] = b == d && b != a && d != c ? d : p;
+        }
+    }
+}
+
+static void scale3x(Chip8Renderer *renderer, uint32_t width, uint32_t height)
+{
+    const uint8_t(*grid)[HIRES_WIDTH] = renderer->grid;
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            uint8_t a = GRID(-1, -1), b = GRID(0, -1), c = GRID(1, -1);
+            uint8_t d = GRID(-1, 0), e = grid[y][x], f = GRID(1, 0);
+            uint8_t g = GRID(-1, 1), h = GRID(0, 1), i = GRID(1, 1);
+            uint8_t out[9] = {e, e, e, e, e, e, e, e, e};
+            if (b != h && d != f)
+            {
+                out[0] = d == b ? d : e;
+                out[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+                out[2] = b == f ? f : e;
+                out[3] = (d == b && e != g) || (d == h && e != a) ? d : e;
+                out[5] = (b == f && e != i) || (h == f && e != c) ? f : e;
+                out[6] = d == h ? d : e;
+                out[7] = (d == h && e != i) || (h == f && e != g) ? h : e;
+                out[8] = h == f ? f : e;
+            }
+            for (uint32_t row = 0; row < 3; ++row)
+            {
+                memcpy(&renderer->smooth[y * 3 + row][x * 3], out + row * 3, 3);
+            }
+        }
+    }
+}
+
+#undef GRID
+
+int RenderChip8Frame(Chip8Renderer *renderer, const Chip8Frame *frame, uint32_t scale, uint32_t *pixels, uint32_t pitch)
+{
+    uint32_t width = frame->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+    uint32_t height = frame->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+    uint32_t factor = renderer->smoothing == CHIP8_SMOOTH_SCALE3X ? 3 : renderer->smoothing == CHIP8_SMOOTH_SCALE2X ? 2 : 1;
+    if (scale < factor)
+    {
+        factor = 1; // not enough room to show it
+    }
+    uint32_t columns = width * factor;
+    uint32_t rows = height * factor;
+
+    // rows scale the same as columns, so one table does for both
+    for (uint32_t i = 0; i <= columns; ++i)
+    {
+        renderer->starts[i] = i * scale / factor;
+    }
+    uint32_t scaledWidth = renderer->starts[columns];
+    if (renderer->scaledCapacity < scaledWidth + RENDER_SLACK)
+    {
+        free(renderer->scaled);
+        renderer->scaledCapacity = scaledWidth + RENDER_SLACK;
+        renderer->scaled = malloc(renderer->scaledCapacity * sizeof(uint32_t));
+        if (!renderer->scaled)
+        {
+            renderer->scaledCapacity = 0;
+            return 0;
+        }
+    }
+
+    if (factor > 1)
+    {
+        indexDisplay(renderer, frame, width, height);
+        if (factor == 2)
+            scale2x(renderer, width, height);
+        else
+            scale3x(renderer, width, height);
+    }
+
+    for (uint32_t y = 0; y < rows; ++y)
+    {
+        if (factor == 1)
+        {
+            expandRow(renderer, frame, y, width);
+        }
+        else
+        {
+            for (uint32_t x = 0; x < columns; ++x)
+            {
+                renderer->line[x] = renderer->palette[renderer->smooth[y][x]];
+            }
+        }
+
+        const uint32_t *line = renderer->line;
+        if (scaledWidth != columns)
+        {
+            stretch(renderer->path, renderer->scaled, renderer->line, columns, renderer->starts);
+            line = renderer->scaled;
+        }
+
+        // the rest of this pixel's rows are the same
+        for (uint32_t Y = renderer->starts[y]; Y < renderer->starts[y + 1]; ++Y)
+        {
+            memcpy((uint8_t *)pixels + (size_t)Y * pitch, line, scaledWidth * sizeof(uint32_t));
+        }
+    }
+    return 1;
+}
+
+// 3x5 glyphs for ' ' to '_', a row of 3 bits per octal digit, top row first
+static const uint16_t FONT[64] = {
+    ['0' - ' '] = 075557, ['1' - ' '] = 026227, ['2' - ' '] = 071747, ['3' - ' '] = 071317,
+    ['4' - ' '] = 055711, ['5' - ' '] = 074717, ['6' - ' '] = 074757, ['7' - ' '] = 071111,
+    ['8' - ' '] = 075757, ['9' - ' '] = 075717, ['A' - ' '] = 025755, ['B' - ' '] = 065656,
+    ['C' - ' '] = 034443, ['D' - ' '] = 065556, ['E' - ' '] = 074647, ['F' - ' '] = 074644,
+    ['G' - ' '] = 034553, ['H' - ' '] = 055755, ['I' - ' '] = 072227, ['J' - ' '] = 011152,
+    ['K' - ' '] = 055655, ['L' - ' '] = 044447, ['M' - ' '] = 057755, ['N' - ' '] = 065555,
+    ['O' - ' '] = 025552, ['P' - ' '] = 065644, ['Q' - ' '] = 025563, ['R' - ' '] = 065655,
+    ['S' - ' '] = 034216, ['T' - ' '] = 072222, ['U' - ' '] = 055557, ['V' - ' '] = 055552,
+    ['W' - ' '] = 055775, ['X' - ' '] = 055255, ['Y' - ' '] = 055222, ['Z' - ' '] = 071247,
+    ['.' - ' '] = 000002, ['/' - ' '] = 011244, ['%' - ' '] = 051245, [':' - ' '] = 002020,
+    ['-' - ' '] = 000700,
+};
+
+void DrawChip8Text(uint32_t *pixels, uint32_t pitch, uint32_t width, uint32_t height, uint32_t x, uint32_t y,
+                   uint32_t scale, uint32_t colour, uint32_t background, const char *text)
+{
+    // each character is a 4x6 cell: the glyph, a column and a row of background
+    uint32_t left = x;
+    for (const char *c = text; *c; ++c)
+    {
+        if (*c == '\n')
+        {
+            x = left;
+            y += 6 * scale;
+            continue;
+        }
+        char upper = *c >= 'a' && *c <= 'z' ? (char)(*c - 'a' + 'A') : *c;
+        uint16_t glyph = upper >= ' ' && upper <= '_' ? FONT[upper - ' '] : 0;
+        for (uint32_t py = 0; py < 6 * scale && y + py < height; ++py)
+        {
+            uint32_t *row = (uint32_t *)((uint8_t *)pixels + (size_t)(y + py) * pitch);
+            uint32_t glyphRow = py / scale;
+            for (uint32_t px = 0; px < 4 * scale && x + px < width; ++px)
+            {
+                uint32_t glyphColumn = px / scale;
+                int on = glyphRow < 5 && glyphColumn < 3 && ((glyph >> ((4 - glyphRow) * 3 + (2 - glyphColumn))) & 1);
+                row[x + px] = on ? colour : background;
+            }
+        }
+        x += 4 * scale;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+#include "triplebuffer.h"
+
+// the widest instruction set RenderChip8Frame uses
+typedef enum Chip8RenderPath
+{
+    CHIP8_RENDER_SCALAR,
+    CHIP8_RENDER_SSE2,
+    CHIP8_RENDER_AVX2,
+    CHIP8_RENDER_PATH_COUNT
+} Chip8RenderPath;
+
+// edge smoothing applied at the display's own resolution before scaling up
+typedef enum Chip8Smoothing
+{
+    CHIP8_SMOOTH_NONE,
+    CHIP8_SMOOTH_SCALE2X, // EPX
+    CHIP8_SMOOTH_SCALE3X, // AdvMAME3x
+    CHIP8_SMOOTH_COUNT
+} Chip8Smoothing;
+
+/**
+ * Software renderer
+ * A display row becomes ARGB a byte (8 pixels) at a time through a lookup
+ *  table: one for a lone plane, the common case, and one taking a nibble
+ *  of each plane for XO-CHIP. Each pixel is then stored across its width
+ *  with 4- or 8-wide vector stores, and the finished line copied down for
+ *  the rest of its height.
+ * Any integer scale works. Smoothing draws the display 2 or 3 times bigger
+ *  first and shares the scale out over that, so with a scale that isn't a
+ *  multiple of the factor the pixels are a column or row uneven.
+ */
+typedef struct Chip8Renderer
+{
+    uint32_t palette[4]; // 0xAARRGGBB for neither plane/plane 1/plane 2/both planes
+    Chip8Smoothing smoothing;
+    Chip8RenderPath path;
+    uint32_t single[256][8]; // a byte of plane 1 alone as 8 pixels
+    uint32_t dual[256][4];   // a nibble of plane 1 (high bits) and of plane 2 (low bits) as 4 pixels
+    uint32_t line[HIRES_WIDTH * 3]; // a row at the display's resolution (times the smoothing)
+    uint32_t starts[HIRES_WIDTH * 3 + 1]; // where each pixel of a row starts once scaled
+    uint8_t grid[HIRES_HEIGHT][HIRES_WIDTH]; // palette indices, for smoothing
+    uint8_t smooth[HIRES_HEIGHT * 3][HIRES_WIDTH * 3];
+    uint32_t *scaled;    // a scaled row, with room for the last vector store to run over
+    uint32_t scaledCapacity;
+} Chip8Renderer;
+
+// set up for a palette; picks the best path the CPU supports
+void InitChip8Renderer(Chip8Renderer *renderer, const uint32_t palette[4], Chip8Smoothing smoothing);
+void FreeChip8Renderer(Chip8Renderer *renderer);
+
+// the best path this CPU supports
+Chip8RenderPath Chip8BestRenderPath(void);
+
+// look up a smoothing by name ("none", "scale2x", "scale3x"); returns CHIP8_SMOOTH_COUNT if unknown
+Chip8Smoothing Chip8SmoothingFromName(const char *name);
+
+// draw a frame with each of its pixels scale x scale (in its own resolution)
+//  at pixels, rows pitch bytes apart; returns 0 if out of memory
+int RenderChip8Frame(Chip8Renderer *renderer, const Chip8Frame *frame, uint32_t scale, uint32_t *pixels, uint32_t pitch);
+
+// text for overlays in a 3x5 font (digits, letters, space and . / % : -; other characters are blank),
+//  each font pixel scale x scale, on a box of background; '\n' starts a new line. Clipped to width x height.
+void DrawChip8Text(uint32_t *pixels, uint32_t pitch, uint32_t width, uint32_t height, uint32_t x, uint32_t y,
+                   uint32_t scale, uint32_t colour, uint32_t background, const char *text);
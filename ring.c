@@ -0,0 +1,92 @@
+#include "ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int InitChip8Ring(Chip8Ring *ring, uint32_t elementSize, uint32_t capacity)
+{
+    uint32_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    ring->buffer = malloc((size_t)size * elementSize);
+    ring->elementSize = elementSize;
+    ring->capacity = size;
+    SDL_AtomicSet(&ring->head, 0);
+    SDL_AtomicSet(&ring->tail, 0);
+
+    return ring->buffer != NULL;
+}
+
+void FreeChip8Ring(Chip8Ring *ring)
+{
+    free(ring->buffer);
+    ring->buffer = NULL;
+}
+
+// copy count elements between a ring slot range and a flat buffer, splitting at the wrap
+static void copyElements(Chip8Ring *ring, uint32_t index, uint8_t *flat, uint32_t count, int intoRing)
+{
+    uint32_t start = index & (ring->capacity - 1);
+    uint32_t first = ring->capacity - start;
+    if (first > count)
+    {
+        first = count;
+    }
+
+    uint8_t *slot = ring->buffer + (size_t)start * ring->elementSize;
+    size_t firstBytes = (size_t)first * ring->elementSize;
+    size_t restBytes = (size_t)(count - first) * ring->elementSize;
+
+    if (intoRing)
+    {
+        memcpy(slot, flat, firstBytes);
+        memcpy(ring->buffer, flat + firstBytes, restBytes);
+    }
+    else
+    {
+        memcpy(flat, slot, firstBytes);
+        memcpy(flat + firstBytes, ring->buffer, restBytes);
+    }
+}
+
+uint32_t PushChip8Ring(Chip8Ring *ring, const void *elements, uint32_t count)
+{
+    uint32_t head = (uint32_t)SDL_AtomicGet(&ring->head);
+    uint32_t tail = (uint32_t)SDL_AtomicGet(&ring->tail);
+    uint32_t space = ring->capacity - (head - tail);
+    if (count > space)
+    {
+        count = space;
+    }
+
+    copyElements(ring, head, (uint8_t *)elements, count, 1);
+
+    // publish the elements only once they are written
+    SDL_AtomicSet(&ring->head, (int)(head + count));
+    return count;
+}
+
+uint32_t PopChip8Ring(Chip8Ring *ring, void *elements, uint32_t count)
+{
+    uint32_t tail = (uint32_t)SDL_AtomicGet(&ring->tail);
+    uint32_t head = (uint32_t)SDL_AtomicGet(&ring->head);
+    uint32_t available = head - tail;
+    if (count > available)
+    {
+        count = available;
+    }
+
+    copyElements(ring, tail, (uint8_t *)elements, count, 0);
+
+    // hand the slots back only once they are read
+    SDL_AtomicSet(&ring->tail, (int)(tail + count));
+    return count;
+}
+
+uint32_t Chip8RingCount(Chip8Ring *ring)
+{
+    return (uint32_t)SDL_AtomicGet(&ring->head) - (uint32_t)SDL_AtomicGet(&ring->tail);
+}
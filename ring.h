@@ -0,0 +1,34 @@
+#pragma once
+
+#include <SDL/SDL.h>
+
+#include <stdint.h>
+
+/**
+ * Single-producer/single-consumer ring of fixed-size elements
+ * One thread pushes and one thread pops, neither ever waits on the other:
+ *  a push into a full ring or a pop from an empty one just moves fewer
+ *  elements. head and tail only ever increase; the capacity is a power of
+ *  two so they wrap by masking.
+ */
+typedef struct Chip8Ring
+{
+    uint8_t *buffer;
+    uint32_t elementSize;
+    uint32_t capacity;  // elements, power of two
+    SDL_atomic_t head;  // next element to write; only the producer stores it
+    SDL_atomic_t tail;  // next element to read; only the consumer stores it
+} Chip8Ring;
+
+// capacity is rounded up to a power of two; returns 0 on failure
+int InitChip8Ring(Chip8Ring *ring, uint32_t elementSize, uint32_t capacity);
+void FreeChip8Ring(Chip8Ring *ring);
+
+// producer side: copies up to count elements in, returns how many fit
+uint32_t PushChip8Ring(Chip8Ring *ring, const void *elements, uint32_t count);
+
+// consumer side: copies up to count elements out, returns how many there were
+uint32_t PopChip8Ring(Chip8Ring *ring, void *elements, uint32_t count);
+
+// elements waiting to be popped (exact from either side's own point of view)
+uint32_t Chip8RingCount(Chip8Ring *ring);
@@ -0,0 +1,290 @@
+#include "rl.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+// a byte of a plane as 8 pixel bytes of 0 or 1, leftmost first
+static uint64_t SPREAD[256];
+// a nibble as 8 pixel bytes, each bit twice (low resolution)
+static uint64_t SPREAD_DOUBLE[16];
+
+static void initSpread(void)
+{
+    for (uint32_t b = 0; b < 256; ++b)
+    {
+        uint8_t pixels[8];
+        for (uint32_t x = 0; x < 8; ++x)
+        {
+            pixels[x] = (b >> (7 - x)) & 1;
+        }
+        memcpy(&SPREAD[b], pixels, 8);
+    }
+    for (uint32_t n = 0; n < 16; ++n)
+    {
+        uint8_t pixels[8];
+        for (uint32_t x = 0; x < 8; ++x)
+        {
+            pixels[x] = (n >> (3 - x / 2)) & 1;
+        }
+        memcpy(&SPREAD_DOUBLE[n], pixels, 8);
+    }
+}
+
+uint32_t Chip8BatchObservationSize(const Chip8Batch *batch)
+{
+    return batch->observation == CHIP8_OBSERVE_PACKED ? (uint32_t)sizeof(Chip8Display) + 1 : HIRES_WIDTH * HIRES_HEIGHT;
+}
+
+// the display as pixel bytes, 8 at a time through the tables
+static void observePixels(const Chip8State *state, uint8_t *out)
+{
+    if (state->hires)
+    {
+        for (uint32_t y = 0; y < HIRES_HEIGHT; ++y)
+        {
+            uint8_t *row = out + y * HIRES_WIDTH;
+            for (uint32_t w = 0; w < 2; ++w)
+            {
+                uint64_t plane1 = state->display[0][y][w];
+                uint64_t plane2 = state->display[1][y][w];
+                for (uint32_t i = 0; i < 8; ++i)
+                {
+                    uint32_t shift = 56 - i * 8;
+                    uint64_t pixels = SPREAD[(plane1 >> shift) & 0xff] | SPREAD[(plane2 >> shift) & 0xff] << 1;
+                    memcpy(row + w * 64 + i * 8, &pixels, 8);
+                }
+            }
+        }
+        return;
+    }
+
+    for (uint32_t y = 0; y < DISPLAY_HEIGHT; ++y)
+    {
+        uint8_t *row = out + y * 2 * HIRES_WIDTH;
+        uint64_t plane1 = state->display[0][y][0];
+        uint64_t plane2 = state->display[1][y][0];
+        for (uint32_t i = 0; i < 16; ++i)
+        {
+            uint32_t shift = 60 - i * 4;
+            uint64_t pixels = SPREAD_DOUBLE[(plane1 >> shift) & 0xf] | SPREAD_DOUBLE[(plane2 >> shift) & 0xf] << 1;
+            memcpy(row + i * 8, &pixels, 8);
+        }
+        memcpy(row + HIRES_WIDTH, row, HIRES_WIDTH);
+    }
+}
+
+static void observe(Chip8Batch *batch, uint32_t env)
+{
+    if (!batch->observations)
+    {
+        return;
+    }
+    uint8_t *out = batch->observations + (size_t)env * Chip8BatchObservationSize(batch);
+    const Chip8State *state = batch->machines[env];
+    if (batch->observation == CHIP8_OBSERVE_PACKED)
+    {
+        memcpy(out, state->display, sizeof(Chip8Display));
+        out[sizeof(Chip8Display)] = state->hires;
+    }
+    else
+    {
+        observePixels(state, out);
+    }
+}
+
+static uint32_t readHook(const Chip8State *state, const Chip8Hook *hook)
+{
+    if (hook->source == CHIP8_HOOK_REGISTER)
+    {
+        return state->V[hook->at & 0xf];
+    }
+    uint32_t value = 0;
+    for (uint32_t b = 0; b < hook->size; ++b)
+    {
+        value = value << 8 | Chip8ReadMemory(state, hook->at + b);
+    }
+    return value;
+}
+
+static void startEpisode(Chip8Batch *batch, uint32_t env)
+{
+    Chip8State *state = batch->machines[env];
+    ResetChip8(state);
+    if (batch->seed)
+    {
+        // splitmix32-style, so consecutive episodes get unrelated generators
+        uint32_t x = batch->seed + 0x9e3779b9u * ++batch->episodes;
+        x = (x ^ (x >> 16)) * 0x85ebca6bu;
+        x = (x ^ (x >> 13)) * 0xc2b2ae35u;
+        state->rng = (x ^ (x >> 16)) | 1;
+    }
+    batch->steps[env] = 0;
+    for (uint32_t h = 0; h < batch->rewardCount; ++h)
+    {
+        batch->last[env * CHIP8_BATCH_MAX_HOOKS + h] = readHook(state, &batch->rewards[h]);
+    }
+}
+
+Chip8Batch *CreateChip8Batch(Chip8Profile profile, const uint8_t *rom, uint32_t romSize, uint32_t count, uint32_t frame, Chip8Observation observation)
+{
+    if (profile >= CHIP8_PROFILE_COUNT || observation >= CHIP8_OBSERVE_COUNT || !count || !frame)
+    {
+        return NULL;
+    }
+    initSpread();
+
+    Chip8Batch *batch = calloc(sizeof(Chip8Batch), 1);
+    if (!batch)
+    {
+        return NULL;
+    }
+    batch->count = count;
+    batch->frame = frame;
+    batch->observation = observation;
+    batch->image = CreateChip8Image(profile, rom, romSize);
+    batch->pool = batch->image ? CreateChip8Pool(batch->image, count) : NULL;
+    batch->machines = calloc(sizeof(Chip8State *), count);
+    batch->last = calloc(sizeof(uint32_t), (size_t)count * CHIP8_BATCH_MAX_HOOKS);
+    batch->steps = calloc(sizeof(uint32_t), count);
+    if (!batch->pool || !batch->machines || !batch->last || !batch->steps)
+    {
+        DestroyChip8Batch(batch);
+        return NULL;
+    }
+    for (uint32_t env = 0; env < count; ++env)
+    {
+        batch->machines[env] = AcquireChip8(batch->pool);
+    }
+    return batch;
+}
+
+void DestroyChip8Batch(Chip8Batch *batch)
+{
+    if (!batch)
+    {
+        return;
+    }
+    // the pool takes its machines with it
+    DestroyChip8Pool(batch->pool);
+    DestroyChip8Image(batch->image);
+    free(batch->machines);
+    free(batch->last);
+    free(batch->steps);
+    free(batch);
+}
+
+void SetChip8BatchOutputs(Chip8Batch *batch, uint8_t *observations, float *rewards, uint8_t *dones)
+{
+    batch->observations = observations;
+    batch->rewardsOut = rewards;
+    batch->donesOut = dones;
+}
+
+static int makeHook(Chip8Hook *hook, Chip8HookSource source, uint32_t at, uint32_t size)
+{
+    if (source == CHIP8_HOOK_REGISTER ? at > 0xf : (size < 1 || size > 4 || at > 0xffff))
+    {
+        return 0;
+    }
+    memset(hook, 0, sizeof(*hook));
+    hook->source = (uint8_t)source;
+    hook->size = (uint8_t)(source == CHIP8_HOOK_REGISTER ? 1 : size);
+    hook->at = (uint16_t)at;
+    return 1;
+}
+
+int AddChip8RewardHook(Chip8Batch *batch, Chip8HookSource source, uint32_t at, uint32_t size, float scale)
+{
+    if (batch->rewardCount == CHIP8_BATCH_MAX_HOOKS)
+    {
+        return 0;
+    }
+    Chip8Hook *hook = &batch->rewards[batch->rewardCount];
+    if (!makeHook(hook, source, at, size))
+    {
+        return 0;
+    }
+    hook->scale = scale;
+    for (uint32_t env = 0; env < batch->count; ++env)
+    {
+        batch->last[env * CHIP8_BATCH_MAX_HOOKS + batch->rewardCount] = readHook(batch->machines[env], hook);
+    }
+    ++batch->rewardCount;
+    return 1;
+}
+
+int AddChip8DoneHook(Chip8Batch *batch, Chip8HookSource source, uint32_t at, uint32_t size, uint32_t value)
+{
+    if (batch->doneCount == CHIP8_BATCH_MAX_HOOKS)
+    {
+        return 0;
+    }
+    Chip8Hook *hook = &batch->dones[batch->doneCount];
+    if (!makeHook(hook, source, at, size))
+    {
+        return 0;
+    }
+    hook->value = value;
+    ++batch->doneCount;
+    return 1;
+}
+
+void SetChip8BatchMaxSteps(Chip8Batch *batch, uint32_t maxSteps)
+{
+    batch->maxSteps = maxSteps;
+}
+
+void ResetChip8Batch(Chip8Batch *batch, uint32_t seed)
+{
+    batch->seed = seed;
+    batch->episodes = 0;
+    for (uint32_t env = 0; env < batch->count; ++env)
+    {
+        startEpisode(batch, env);
+        observe(batch, env);
+        if (batch->rewardsOut)
+            batch->rewardsOut[env] = 0.0f;
+        if (batch->donesOut)
+            batch->donesOut[env] = 0;
+    }
+}
+
+void StepChip8Batch(Chip8Batch *batch, const uint16_t *actions)
+{
+    Chip8Until until = {batch->frame, 0, 0};
+    for (uint32_t env = 0; env < batch->count; ++env)
+    {
+        Chip8State *state = batch->machines[env];
+        state->keys = actions ? actions[env] : 0;
+        uint64_t ran;
+        RunChip8Until(state, &until, &ran);
+        TickChip8Timers(state);
+
+        float reward = 0.0f;
+        uint32_t *last = batch->last + (size_t)env * CHIP8_BATCH_MAX_HOOKS;
+        for (uint32_t h = 0; h < batch->rewardCount; ++h)
+        {
+            uint32_t value = readHook(state, &batch->rewards[h]);
+            reward += batch->rewards[h].scale * (float)((int64_t)value - (int64_t)last[h]);
+            last[h] = value;
+        }
+
+        int done = state->halted || (batch->maxSteps && ++batch->steps[env] >= batch->maxSteps);
+        for (uint32_t h = 0; h < batch->doneCount && !done; ++h)
+        {
+            done = readHook(state, &batch->dones[h]) == batch->dones[h].value;
+        }
+        if (done)
+        {
+            startEpisode(batch, env);
+        }
+
+        observe(batch, env);
+        if (batch->rewardsOut)
+            batch->rewardsOut[env] = reward;
+        if (batch->donesOut)
+            batch->donesOut[env] = (uint8_t)done;
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// exported from the shared library (see README); nothing special in the emulator itself
+#if defined(_WIN32) && defined(CHIP8_RL_SHARED)
+#define CHIP8_RL_API __declspec(dllexport)
+#else
+#define CHIP8_RL_API
+#endif
+
+#define CHIP8_BATCH_MAX_HOOKS 8u
+
+// what each environment's observation is
+typedef enum Chip8Observation
+{
+    CHIP8_OBSERVE_PIXELS, // HIRES_HEIGHT x HIRES_WIDTH bytes, each plane 1 | plane 2 << 1; low resolution pixels are 2x2
+    CHIP8_OBSERVE_PACKED, // the Chip8Display as it is (2048 bytes), then a byte that's 1 in high resolution
+    CHIP8_OBSERVE_COUNT
+} Chip8Observation;
+
+// where a hook reads its value
+typedef enum Chip8HookSource
+{
+    CHIP8_HOOK_MEMORY,   // `size` bytes big-endian from address `at`
+    CHIP8_HOOK_REGISTER, // V[at]
+} Chip8HookSource;
+
+/**
+ * Batch of environments
+ * `count` machines from one pool, all running the same ROM, stepped
+ *  together. Observations, rewards and done flags are written straight
+ *  into arrays the caller owns and hands over once (SetChip8BatchOutputs),
+ *  environment i at observations + i * Chip8BatchObservationSize, so a
+ *  numpy array can be filled in place; stepping allocates nothing.
+ * A step holds each environment's keys (a bitmask, bit n = key n) for
+ *  `frame` instructions, then ticks the timers, so a step is a 60 Hz
+ *  frame. The reward is the sum over the reward hooks of scale * how much
+ *  the value read went up during the step; an environment is done once it
+ *  halts, a done hook's value is reached or it has taken `maxSteps` steps. Done environments reset themselves at the
+ *  end of the step, so their observation is the first of the next episode.
+ */
+typedef struct Chip8Hook
+{
+    uint8_t source; // Chip8HookSource
+    uint8_t size;   // 1-4 bytes, for memory
+    uint16_t at;
+    float scale;    // reward hooks
+    uint32_t value; // done hooks
+} Chip8Hook;
+
+typedef struct Chip8Batch
+{
+    Chip8Image *image;
+    struct Chip8Pool *pool;
+    Chip8State **machines;
+    uint32_t count;
+    uint32_t frame;       // instructions per step
+    uint32_t maxSteps;    // 0 for no limit
+    Chip8Observation observation;
+    Chip8Hook rewards[CHIP8_BATCH_MAX_HOOKS];
+    Chip8Hook dones[CHIP8_BATCH_MAX_HOOKS];
+    uint32_t rewardCount;
+    uint32_t doneCount;
+    uint32_t *last;       // each environment's reward hook values after its last step
+    uint32_t *steps;      // each environment's steps this episode
+    uint32_t seed;        // 0: every environment draws the same random numbers
+    uint32_t episodes;    // started so far, to reseed from
+    uint8_t *observations; // caller's arrays; any may be NULL
+    float *rewardsOut;
+    uint8_t *donesOut;
+} Chip8Batch;
+
+// `count` environments running a ROM, stepping `frame` instructions at a time; returns NULL if out of memory
+CHIP8_RL_API Chip8Batch *CreateChip8Batch(Chip8Profile profile, const uint8_t *rom, uint32_t romSize, uint32_t count, uint32_t frame, Chip8Observation observation);
+CHIP8_RL_API void DestroyChip8Batch(Chip8Batch *batch);
+
+// bytes of one environment's observation
+CHIP8_RL_API uint32_t Chip8BatchObservationSize(const Chip8Batch *batch);
+
+// where steps write: count observations, count rewards, count done flags
+CHIP8_RL_API void SetChip8BatchOutputs(Chip8Batch *batch, uint8_t *observations, float *rewards, uint8_t *dones);
+
+// add a hook; returns 0 if there are CHIP8_BATCH_MAX_HOOKS already or it's malformed
+CHIP8_RL_API int AddChip8RewardHook(Chip8Batch *batch, Chip8HookSource source, uint32_t at, uint32_t size, float scale);
+CHIP8_RL_API int AddChip8DoneHook(Chip8Batch *batch, Chip8HookSource source, uint32_t at, uint32_t size, uint32_t value);
+
+// end episodes after this many steps (0: never)
+CHIP8_RL_API void SetChip8BatchMaxSteps(Chip8Batch *batch, uint32_t maxSteps);
+
+// start every environment's episode again and write their observations;
+//  a non-zero seed gives each episode its own random numbers from then on
+CHIP8_RL_API void ResetChip8Batch(Chip8Batch *batch, uint32_t seed);
+
+// one step of every environment with actions[i] held in environment i
+CHIP8_RL_API void StepChip8Batch(Chip8Batch *batch, const uint16_t *actions);
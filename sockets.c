@@ -0,0 +1,107 @@
+#include "sockets.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#pragma comment(lib, "ws2_32.lib")
+#ifndef IO_REPARSE_TAG_AF_UNIX
+#define IO_REPARSE_TAG_AF_UNIX 0x80000023L // older SDKs' winnt.h doesn't have it
+#endif
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#include <string.h>
+
+int StartChip8Sockets(void)
+{
+#if defined(_WIN32)
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+    return 1;
+#endif
+}
+
+void StopChip8Sockets(void)
+{
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+}
+
+int SetChip8SocketNonBlocking(Socket socket)
+{
+#if defined(_WIN32)
+    u_long on = 1;
+    return ioctlsocket(socket, FIONBIO, &on) == 0;
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) != -1;
+#endif
+}
+
+int Chip8SocketAddress(struct sockaddr_un *address, const char *path)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path))
+    {
+        return 0;
+    }
+    strcpy(address->sun_path, path);
+    return 1;
+}
+
+// whether path is a Unix domain socket, as opposed to nothing or some other file
+static int isSocketFile(const char *path)
+{
+#if defined(_WIN32)
+    // AF_UNIX sockets are reparse points with their own tag
+    WIN32_FIND_DATAA found;
+    HANDLE find = FindFirstFileA(path, &found);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return 0;
+    }
+    FindClose(find);
+    return (found.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) && found.dwReserved0 == IO_REPARSE_TAG_AF_UNIX;
+#else
+    struct stat info;
+    return lstat(path, &info) == 0 && S_ISSOCK(info.st_mode);
+#endif
+}
+
+int RemoveStaleChip8Socket(const char *path)
+{
+    if (!isSocketFile(path))
+    {
+        return 1;
+    }
+
+    // a listener that's still there takes the connection; only a socket nobody's listening on refuses it
+    struct sockaddr_un address;
+    Socket probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe == INVALID_SOCKET)
+    {
+        return 0;
+    }
+    int refused = Chip8SocketAddress(&address, path) && connect(probe, (struct sockaddr *)&address, sizeof(address)) != 0 &&
+#if defined(_WIN32)
+                  WSAGetLastError() == WSAECONNREFUSED;
+#else
+                  errno == ECONNREFUSED;
+#endif
+    closeSocket(probe);
+    if (!refused)
+    {
+        return 0;
+    }
+
+#if defined(_WIN32)
+    _unlink(path);
+#else
+    unlink(path);
+#endif
+    return 1;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+/**
+ * Sockets
+ * What the frame server and the statistics endpoint share: Winsock or BSD
+ *  sockets under one name, and the handful of calls that differ between
+ *  them. AF_UNIX needs Windows 10 1803 or later.
+ */
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+typedef SOCKET Socket;
+#define closeSocket closesocket
+#define wouldBlock() (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int Socket;
+#define INVALID_SOCKET (-1)
+#define closeSocket close
+#define wouldBlock() (errno == EAGAIN || errno == EWOULDBLOCK)
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // a peer going away is noticed from send failing instead
+#endif
+
+// WSAStartup on Windows; each successful start needs a StopChip8Sockets
+int StartChip8Sockets(void);
+void StopChip8Sockets(void);
+
+int SetChip8SocketNonBlocking(Socket socket);
+
+// returns 0 if path is too long for a Unix domain socket address
+int Chip8SocketAddress(struct sockaddr_un *address, const char *path);
+
+// remove a socket left at path by a listener that didn't close; anything else at path is left alone.
+//  returns 0 if something is still listening there (or it can't tell), so path shouldn't be taken over
+int RemoveStaleChip8Socket(const char *path);
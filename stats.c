@@ -0,0 +1,451 @@
+#include "sockets.h" // before SDL, so windows.h doesn't bring in the old winsock.h
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const uint32_t STATS_REQUEST_MS = 200u;  // how long a scraper gets to send its request
+const double STATS_LATE_FRACTION = 1.25; // a frame is late this far past its period
+#define STATS_TEXT_CAPACITY 4096u
+
+struct Chip8Stats
+{
+    SDL_SpinLock lock;
+    Chip8StatsSnapshot published;
+    double periodMs;
+    uint64_t frequency;
+    uint64_t created;
+    // emulation thread only
+    Chip8StatsSnapshot totals; // the emulation side's fields
+    uint64_t lastStart;
+    int lastWaiting;
+    uint64_t windowStart;
+    uint32_t histogram[CHIP8_STATS_BUCKETS];
+    uint32_t windowFrames; // including paused ones, for frame times
+    uint32_t windowRan;
+    uint32_t windowWaiting;
+    uint64_t windowInstructions;
+    uint64_t windowDraws;
+    // render thread only
+    uint64_t rendered;
+    uint64_t dropped;
+    uint64_t presses;
+    uint64_t latencyTotal;
+    uint64_t latencyMax;
+    uint32_t lastNumber;
+    // reporter thread
+    SDL_Thread *reporter;
+    SDL_atomic_t quit;
+    char *file;
+    char *socketPath; // to remove when done, for a Unix domain socket
+    Socket listener;
+    int socketsStarted;
+};
+
+// percentile of the histogram's frame times, as the top of its bucket
+static double percentile(const uint32_t *histogram, uint32_t count, double fraction)
+{
+    uint64_t wanted = (uint64_t)(count * fraction + 0.5);
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < CHIP8_STATS_BUCKETS; ++b)
+    {
+        seen += histogram[b];
+        if (seen >= wanted && seen)
+        {
+            return (b + 1) * CHIP8_STATS_BUCKET_MS;
+        }
+    }
+    return 0.0;
+}
+
+// the second that just ended: work out its rates and publish them with the totals
+static void publishWindow(Chip8Stats *stats, uint64_t now)
+{
+    Chip8StatsSnapshot *totals = &stats->totals;
+    double seconds = (double)(now - stats->windowStart) / (double)stats->frequency;
+    totals->uptime = (double)(now - stats->created) / (double)stats->frequency;
+    totals->ips = (double)stats->windowInstructions / seconds;
+    totals->hz = stats->windowRan / seconds;
+    totals->frameP50Ms = percentile(stats->histogram, stats->windowFrames, 0.50);
+    totals->frameP99Ms = percentile(stats->histogram, stats->windowFrames, 0.99);
+    totals->drawsPerFrame = stats->windowRan ? (double)stats->windowDraws / stats->windowRan : 0.0;
+    totals->keyWaitFraction = stats->windowFrames ? (double)stats->windowWaiting / stats->windowFrames : 0.0;
+
+    SDL_AtomicLock(&stats->lock);
+    Chip8StatsSnapshot *published = &stats->published;
+    published->uptime = totals->uptime;
+    published->instructions = totals->instructions;
+    published->frames = totals->frames;
+    published->lateFrames = totals->lateFrames;
+    published->draws = totals->draws;
+    published->keyWaitSeconds = totals->keyWaitSeconds;
+    published->ips = totals->ips;
+    published->hz = totals->hz;
+    published->frameP50Ms = totals->frameP50Ms;
+    published->frameP99Ms = totals->frameP99Ms;
+    published->drawsPerFrame = totals->drawsPerFrame;
+    published->keyWaitFraction = totals->keyWaitFraction;
+    SDL_AtomicUnlock(&stats->lock);
+
+    memset(stats->histogram, 0, sizeof(stats->histogram));
+    stats->windowStart = now;
+    stats->windowFrames = 0;
+    stats->windowRan = 0;
+    stats->windowWaiting = 0;
+    stats->windowInstructions = 0;
+    stats->windowDraws = 0;
+}
+
+void RecordChip8EmulatedFrame(Chip8Stats *stats, uint64_t start, uint32_t instructions, uint32_t draws, int waitingForKey, int ran)
+{
+    if (!stats)
+    {
+        return;
+    }
+
+    // the time since the last frame started was that frame's
+    if (stats->lastStart)
+    {
+        uint64_t period = start - stats->lastStart;
+        double ms = (double)period * 1000.0 / (double)stats->frequency;
+        uint32_t bucket = (uint32_t)(ms / CHIP8_STATS_BUCKET_MS);
+        ++stats->histogram[bucket < CHIP8_STATS_BUCKETS ? bucket : CHIP8_STATS_BUCKETS - 1];
+        ++stats->windowFrames;
+        if (ms > stats->periodMs * STATS_LATE_FRACTION)
+        {
+            ++stats->totals.lateFrames;
+        }
+        if (stats->lastWaiting)
+        {
+            stats->totals.keyWaitSeconds += (double)period / (double)stats->frequency;
+            ++stats->windowWaiting;
+        }
+    }
+    stats->lastStart = start;
+    stats->lastWaiting = waitingForKey;
+
+    if (ran)
+    {
+        ++stats->totals.frames;
+        stats->totals.instructions += instructions;
+        stats->totals.draws += draws;
+        ++stats->windowRan;
+        stats->windowInstructions += instructions;
+        stats->windowDraws += draws;
+    }
+
+    if (start - stats->windowStart >= stats->frequency)
+    {
+        publishWindow(stats, start);
+    }
+}
+
+void RecordChip8RenderedFrame(Chip8Stats *stats, uint32_t number, uint64_t latency)
+{
+    if (!stats)
+    {
+        return;
+    }
+
+    // the triple buffer skips frames the renderer was too slow for
+    if (stats->rendered && number > stats->lastNumber + 1)
+    {
+        stats->dropped += number - stats->lastNumber - 1;
+    }
+    stats->lastNumber = number;
+    ++stats->rendered;
+    if (latency)
+    {
+        ++stats->presses;
+        stats->latencyTotal += latency;
+        stats->latencyMax = latency > stats->latencyMax ? latency : stats->latencyMax;
+    }
+
+    double msPerCount = 1000.0 / (double)stats->frequency;
+    SDL_AtomicLock(&stats->lock);
+    stats->published.rendered = stats->rendered;
+    stats->published.dropped = stats->dropped;
+    stats->published.presses = stats->presses;
+    stats->published.latencyMs = stats->presses ? (double)stats->latencyTotal / (double)stats->presses * msPerCount : 0.0;
+    stats->published.latencyMaxMs = (double)stats->latencyMax * msPerCount;
+    SDL_AtomicUnlock(&stats->lock);
+}
+
+void GetChip8Stats(Chip8Stats *stats, Chip8StatsSnapshot *snapshot)
+{
+    SDL_AtomicLock(&stats->lock);
+    *snapshot = stats->published;
+    SDL_AtomicUnlock(&stats->lock);
+}
+
+// one metric in the Prometheus text format
+static void appendMetric(char *text, size_t size, size_t *length, const char *name, const char *type, const char *help, double value)
+{
+    if (*length >= size)
+    {
+        return;
+    }
+    int wrote = snprintf(text + *length, size - *length, "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n", name, help, name, type, name, value);
+    if (wrote > 0)
+    {
+        *length += (size_t)wrote;
+    }
+}
+
+size_t FormatChip8Stats(const Chip8StatsSnapshot *s, char *text, size_t size)
+{
+    size_t length = 0;
+    text[0] = '\0';
+    appendMetric(text, size, &length, "chip8_uptime_seconds", "gauge", "Time since the emulator started", s->uptime);
+    appendMetric(text, size, &length, "chip8_instructions_total", "counter", "Instructions emulated", (double)s->instructions);
+    appendMetric(text, size, &length, "chip8_frames_total", "counter", "Frames emulated", (double)s->frames);
+    appendMetric(text, size, &length, "chip8_late_frames_total", "counter", "Frames that started more than a quarter of a frame late", (double)s->lateFrames);
+    appendMetric(text, size, &length, "chip8_draws_total", "counter", "DXYN instructions run", (double)s->draws);
+    appendMetric(text, size, &length, "chip8_key_wait_seconds_total", "counter", "Time spent waiting for a key in FX0A", s->keyWaitSeconds);
+    appendMetric(text, size, &length, "chip8_rendered_frames_total", "counter", "Frames drawn on screen", (double)s->rendered);
+    appendMetric(text, size, &length, "chip8_dropped_frames_total", "counter", "Frames emulated but never drawn", (double)s->dropped);
+    appendMetric(text, size, &length, "chip8_key_presses_total", "counter", "Key presses that reached the screen", (double)s->presses);
+    appendMetric(text, size, &length, "chip8_input_latency_ms", "gauge", "Average time from a key press to the screen", s->latencyMs);
+    appendMetric(text, size, &length, "chip8_input_latency_max_ms", "gauge", "Longest time from a key press to the screen", s->latencyMaxMs);
+    appendMetric(text, size, &length, "chip8_instructions_per_second", "gauge", "Instructions emulated over the last second", s->ips);
+    appendMetric(text, size, &length, "chip8_emulated_hz", "gauge", "Frames emulated over the last second", s->hz);
+    appendMetric(text, size, &length, "chip8_frame_time_p50_ms", "gauge", "Median time between frames over the last second", s->frameP50Ms);
+    appendMetric(text, size, &length, "chip8_frame_time_p99_ms", "gauge", "99th percentile time between frames over the last second", s->frameP99Ms);
+    appendMetric(text, size, &length, "chip8_draws_per_frame", "gauge", "DXYN instructions per frame over the last second", s->drawsPerFrame);
+    appendMetric(text, size, &length, "chip8_key_wait_ratio", "gauge", "Share of the last second spent waiting for a key", s->keyWaitFraction);
+    return length < size ? length : size - 1;
+}
+
+// write to a temporary file and move it over the old one, so readers see one or the other
+static void writeStatsFile(Chip8Stats *stats, const char *text, size_t length)
+{
+    size_t pathLength = strlen(stats->file);
+    char *temporary = malloc(pathLength + 5);
+    if (!temporary)
+    {
+        return;
+    }
+    memcpy(temporary, stats->file, pathLength);
+    memcpy(temporary + pathLength, ".tmp", 5);
+
+    FILE *file = fopen(temporary, "w");
+    if (file)
+    {
+        int ok = fwrite(text, 1, length, file) == length;
+        ok = fclose(file) == 0 && ok;
+#if defined(_WIN32)
+        remove(stats->file); // rename won't replace a file here
+#endif
+        if (!ok || rename(temporary, stats->file) != 0)
+        {
+            remove(temporary);
+        }
+    }
+    free(temporary);
+}
+
+// wait up to ms for the socket to be readable
+static int waitReadable(Socket socket, uint32_t ms)
+{
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(socket, &readable);
+    struct timeval timeout = {(long)(ms / 1000), (long)(ms % 1000) * 1000};
+    return select((int)socket + 1, &readable, NULL, NULL, &timeout) > 0;
+}
+
+// read the request (whatever it asks for, the answer is the same) and send the statistics
+static void answerRequest(Chip8Stats *stats, Socket client)
+{
+    char request[1024];
+    size_t got = 0;
+    while (got < sizeof(request) - 1 && waitReadable(client, STATS_REQUEST_MS))
+    {
+        int n = recv(client, request + got, (int)(sizeof(request) - 1 - got), 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        got += (size_t)n;
+        request[got] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+        {
+            break;
+        }
+    }
+
+    Chip8StatsSnapshot snapshot;
+    GetChip8Stats(stats, &snapshot);
+    char body[STATS_TEXT_CAPACITY];
+    size_t length = FormatChip8Stats(&snapshot, body, sizeof(body));
+    char header[128];
+    int headerLength = snprintf(header, sizeof(header),
+                                "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\n\r\n", (unsigned int)length);
+    if (send(client, header, headerLength, MSG_NOSIGNAL) == headerLength)
+    {
+        for (size_t sent = 0; sent < length;)
+        {
+            int n = send(client, body + sent, (int)(length - sent), MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += (size_t)n;
+        }
+    }
+    closeSocket(client);
+}
+
+static int reporterThread(void *data)
+{
+    Chip8Stats *stats = data;
+    uint32_t nextWrite = SDL_GetTicks() + 1000;
+    while (!SDL_AtomicGet(&stats->quit))
+    {
+        // wait for a scraper, or just wait, until it's time to write the file (checking for quit every so often)
+        uint32_t now = SDL_GetTicks();
+        uint32_t wait = (int32_t)(nextWrite - now) > 0 ? nextWrite - now : 0;
+        wait = wait < 100 ? wait : 100;
+        if (stats->listener != INVALID_SOCKET)
+        {
+            if (waitReadable(stats->listener, wait))
+            {
+                Socket client = accept(stats->listener, NULL, NULL);
+                if (client != INVALID_SOCKET)
+                {
+                    answerRequest(stats, client);
+                }
+            }
+        }
+        else
+        {
+            SDL_Delay(wait);
+        }
+
+        if (stats->file && (int32_t)(SDL_GetTicks() - nextWrite) >= 0)
+        {
+            Chip8StatsSnapshot snapshot;
+            GetChip8Stats(stats, &snapshot);
+            char text[STATS_TEXT_CAPACITY];
+            size_t length = FormatChip8Stats(&snapshot, text, sizeof(text));
+            writeStatsFile(stats, text, length);
+            nextWrite += 1000;
+        }
+        else if (!stats->file)
+        {
+            nextWrite = SDL_GetTicks() + 1000;
+        }
+    }
+    return 0;
+}
+
+// listen on a localhost port (all digits) or a Unix domain socket path
+static int openListener(Chip8Stats *stats, const char *endpoint)
+{
+    if (!StartChip8Sockets())
+    {
+        return 0;
+    }
+    stats->socketsStarted = 1;
+
+    if (strspn(endpoint, "0123456789") == strlen(endpoint))
+    {
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons((uint16_t)atoi(endpoint));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        stats->listener = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        return stats->listener != INVALID_SOCKET &&
+               setsockopt(stats->listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on)) == 0 &&
+               bind(stats->listener, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+               listen(stats->listener, 4) == 0;
+    }
+
+    struct sockaddr_un address;
+    if (!Chip8SocketAddress(&address, endpoint) || !RemoveStaleChip8Socket(endpoint))
+    {
+        return 0;
+    }
+    stats->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (stats->listener == INVALID_SOCKET || bind(stats->listener, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        return 0;
+    }
+    stats->socketPath = malloc(strlen(endpoint) + 1);
+    if (stats->socketPath)
+    {
+        strcpy(stats->socketPath, endpoint);
+    }
+    return listen(stats->listener, 4) == 0;
+}
+
+Chip8Stats *CreateChip8Stats(double periodMs, const char *file, const char *endpoint)
+{
+    Chip8Stats *stats = calloc(sizeof(Chip8Stats), 1);
+    if (!stats)
+    {
+        return NULL;
+    }
+    stats->periodMs = periodMs;
+    stats->frequency = SDL_GetPerformanceFrequency();
+    stats->created = SDL_GetPerformanceCounter();
+    stats->windowStart = stats->created;
+    stats->listener = INVALID_SOCKET;
+    SDL_AtomicSet(&stats->quit, 0);
+
+    if (file)
+    {
+        stats->file = malloc(strlen(file) + 1);
+        if (!stats->file)
+        {
+            DestroyChip8Stats(stats);
+            return NULL;
+        }
+        strcpy(stats->file, file);
+    }
+    if (endpoint && !openListener(stats, endpoint))
+    {
+        DestroyChip8Stats(stats);
+        return NULL;
+    }
+    if (file || endpoint)
+    {
+        stats->reporter = SDL_CreateThread(reporterThread, "stats", stats);
+        if (!stats->reporter)
+        {
+            DestroyChip8Stats(stats);
+            return NULL;
+        }
+    }
+    return stats;
+}
+
+void DestroyChip8Stats(Chip8Stats *stats)
+{
+    if (!stats)
+    {
+        return;
+    }
+    if (stats->reporter)
+    {
+        SDL_AtomicSet(&stats->quit, 1);
+        SDL_WaitThread(stats->reporter, NULL);
+    }
+    if (stats->listener != INVALID_SOCKET)
+    {
+        closeSocket(stats->listener);
+    }
+    if (stats->socketPath)
+    {
+        RemoveStaleChip8Socket(stats->socketPath);
+    }
+    if (stats->socketsStarted)
+    {
+        StopChip8Sockets();
+    }
+    free(stats->socketPath);
+    free(stats->file);
+    free(stats);
+}
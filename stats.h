@@ -0,0 +1,62 @@
+#pragma once
+
+#include <SDL/SDL.h>
+
+#include <stdint.h>
+
+#define CHIP8_STATS_BUCKETS 256u // frame time histogram: 0.25 ms each, the last one everything over 63.75 ms
+#define CHIP8_STATS_BUCKET_MS 0.25
+
+// what the statistics were at the end of the last whole second
+typedef struct Chip8StatsSnapshot
+{
+    double uptime; // seconds
+    // totals
+    uint64_t instructions;
+    uint64_t frames;      // emulated (not paused)
+    uint64_t lateFrames;  // came more than a quarter of a frame after they were due
+    uint64_t draws;       // DXYN instructions
+    double keyWaitSeconds; // spent with FX0A waiting for a key
+    uint64_t rendered;    // frames drawn on screen
+    uint64_t dropped;     // frames emulated but never drawn
+    uint64_t presses;     // key presses that reached the screen
+    double latencyMs;     // average press to screen
+    double latencyMaxMs;
+    // over the last second
+    double ips;           // instructions per second
+    double hz;            // frames emulated per second
+    double frameP50Ms;    // time from one frame to the next
+    double frameP99Ms;
+    double drawsPerFrame;
+    double keyWaitFraction;
+} Chip8StatsSnapshot;
+
+/**
+ * Runtime statistics
+ * The emulation thread reports each frame and the render thread each frame
+ *  it draws, into counters only they touch; once a second the emulation
+ *  thread works out rates and percentiles from a histogram of the second's
+ *  frame times and publishes a snapshot under a spin lock, which is the
+ *  only thing other threads read.
+ * If asked to, a reporter thread writes the snapshot to a file every
+ *  second (replacing it whole, so readers never see half of one) and
+ *  answers HTTP requests on a Unix domain socket or a localhost TCP port,
+ *  both in the Prometheus text format.
+ */
+typedef struct Chip8Stats Chip8Stats;
+
+// frames are due every periodMs; file and endpoint may be NULL. endpoint is a
+//  port number (localhost) or a socket path. Returns NULL if either can't be opened.
+Chip8Stats *CreateChip8Stats(double periodMs, const char *file, const char *endpoint);
+void DestroyChip8Stats(Chip8Stats *stats);
+
+// emulation thread, once a frame: when it started, and what it did (all 0 if paused)
+void RecordChip8EmulatedFrame(Chip8Stats *stats, uint64_t start, uint32_t instructions, uint32_t draws, int waitingForKey, int ran);
+
+// render thread, for each frame it draws: the frame's number and how long a key press in it took to show (0 if none)
+void RecordChip8RenderedFrame(Chip8Stats *stats, uint32_t number, uint64_t latency);
+
+void GetChip8Stats(Chip8Stats *stats, Chip8StatsSnapshot *snapshot);
+
+// Prometheus text format; returns the length written (truncated to fit)
+size_t FormatChip8Stats(const Chip8StatsSnapshot *snapshot, char *text, size_t size);
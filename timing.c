@@ -0,0 +1,174 @@
+#include "timing.h"
+
+#include <string.h>
+
+/**
+ * VIP instruction costs
+ * In machine cycles, from how the VIP's interpreter is written: every
+ *  instruction pays for the fetch and dispatch, then its own routine,
+ *  some of which loop over their operands. Skips cost a little more when
+ *  taken. Instructions the VIP never had are charged like the nearest
+ *  one it did.
+ */
+#define VIP_FETCH 40u
+#define VIP_SKIP 4u           // extra for a skip that's taken
+#define VIP_CLEAR 3078u       // 00E0 clears the 256 display bytes a few at a time
+#define VIP_DRAW 26u          // DXYN set-up, plus for each row:
+#define VIP_DRAW_ROW 34u
+#define VIP_DRAW_ROW_SHIFT 16u // a row not on a byte boundary is shifted across two bytes
+#define VIP_BCD 80u           // FX33 set-up, plus each time round its subtract-and-count loops:
+#define VIP_BCD_DIGIT 16u
+#define VIP_LOAD_STORE 14u    // FX55/FX65 set-up, plus each register:
+#define VIP_LOAD_STORE_REG 14u
+
+uint32_t Chip8InstructionCycles(const Chip8State *state)
+{
+    uint8_t hi = Chip8ReadMemory(state, state->PC);
+    uint8_t lo = Chip8ReadMemory(state, state->PC + 1);
+    uint8_t X = hi & 0x0F;
+    uint8_t Y = lo >> 4;
+    uint8_t N = lo & 0x0F;
+
+    switch (hi >> 4)
+    {
+    case 0x0:
+        if (hi == 0x00 && lo == 0xE0)
+            return VIP_FETCH + VIP_CLEAR;
+        if (hi == 0x00 && lo == 0xEE)
+            return VIP_FETCH + 10;
+        return VIP_FETCH + 24; // machine code calls and the SUPER-CHIP/XO-CHIP screen instructions
+    case 0x1:
+        return VIP_FETCH + 12;
+    case 0x2:
+        return VIP_FETCH + 26;
+    case 0x3:
+        return VIP_FETCH + 10 + (state->V[X] == lo ? VIP_SKIP : 0);
+    case 0x4:
+        return VIP_FETCH + 10 + (state->V[X] != lo ? VIP_SKIP : 0);
+    case 0x5:
+        return VIP_FETCH + 14 + (N == 0 && state->V[X] == state->V[Y] ? VIP_SKIP : 0);
+    case 0x6:
+        return VIP_FETCH + 6;
+    case 0x7:
+        return VIP_FETCH + 10;
+    case 0x8:
+        return VIP_FETCH + 44;
+    case 0x9:
+        return VIP_FETCH + 14 + (state->V[X] != state->V[Y] ? VIP_SKIP : 0);
+    case 0xA:
+        return VIP_FETCH + 12;
+    case 0xB:
+        return VIP_FETCH + 22;
+    case 0xC:
+        return VIP_FETCH + 36;
+    case 0xD:
+    {
+        uint32_t rows = N ? N : 16;
+        uint32_t row = VIP_DRAW_ROW + (state->V[X] & 7 ? VIP_DRAW_ROW_SHIFT : 0);
+        return VIP_FETCH + VIP_DRAW + rows * row;
+    }
+    case 0xE:
+    {
+        int held = (state->keys >> (state->V[X] & 0xF)) & 1;
+        int skip = lo == 0x9E ? held : lo == 0xA1 ? !held : 0;
+        return VIP_FETCH + 14 + (skip ? VIP_SKIP : 0);
+    }
+    default: // 0xF
+        switch (lo)
+        {
+        case 0x33:
+        {
+            uint8_t value = state->V[X];
+            return VIP_FETCH + VIP_BCD + VIP_BCD_DIGIT * (value / 100 + value / 10 % 10 + value % 10);
+        }
+        case 0x55:
+        case 0x65:
+            return VIP_FETCH + VIP_LOAD_STORE + VIP_LOAD_STORE_REG * (X + 1);
+        case 0x1E:
+        case 0x29:
+            return VIP_FETCH + 16;
+        default: // timers, FX0A going round again, and the extensions
+            return VIP_FETCH + 10;
+        }
+    }
+}
+
+void InitChip8Scheduler(Chip8Scheduler *scheduler, Chip8Timing timing, uint32_t instructionsPerFrame)
+{
+    scheduler->timing = timing;
+    scheduler->instructionsPerFrame = instructionsPerFrame;
+    scheduler->cycles = 0;
+}
+
+// spend the frame's cycles; an instruction that overruns them is paid for out of the next frame's
+static uint32_t runVipFrame(Chip8Scheduler *scheduler, Chip8State *state, Chip8FrameHook hook, void *context)
+{
+    const int32_t budget = (int32_t)(CHIP8_VIP_CYCLES_PER_FRAME - CHIP8_VIP_DISPLAY_CYCLES);
+    const Chip8Until step = {1, 0, 0}; // each instruction is costed before it runs
+    uint32_t count = 0;
+    scheduler->cycles += budget;
+    while (scheduler->cycles > 0 && !state->halted)
+    {
+        if (hook && !hook(context, state, 1.0 - (double)scheduler->cycles / budget))
+        {
+            break;
+        }
+        uint32_t cycles = Chip8InstructionCycles(state);
+        uint32_t draws = state->draws;
+        uint64_t ran;
+        RunChip8Until(state, &step, &ran);
+        ++count;
+        scheduler->cycles -= (int32_t)cycles;
+        if (state->draws != draws)
+        {
+            break; // DRAW waits for the display interrupt
+        }
+    }
+    // what's left of a frame that ended early doesn't carry over
+    scheduler->cycles = scheduler->cycles < 0 ? scheduler->cycles : 0;
+    return count;
+}
+
+static uint32_t runFastFrame(Chip8Scheduler *scheduler, Chip8State *state, Chip8FrameHook hook, void *context)
+{
+    uint32_t limit = scheduler->instructionsPerFrame;
+    if (!limit && !hook)
+    {
+        limit = CHIP8_TICK_INSTRUCTIONS; // nothing would ever end the frame
+    }
+    uint32_t count = 0;
+    while (!state->halted && (!limit || count < limit))
+    {
+        if (hook && !hook(context, state, limit ? (double)count / limit : 0.0))
+        {
+            break;
+        }
+        // a key wait would only go round again until the frame's end, so the frame ends there
+        Chip8Until until = {limit && limit - count < CHIP8_FAST_CHUNK ? limit - count : CHIP8_FAST_CHUNK, CHIP8_UNTIL_KEY_WAIT, 0};
+        uint64_t ran;
+        Chip8Stop stop = RunChip8Until(state, &until, &ran);
+        count += (uint32_t)ran;
+        if (stop == CHIP8_STOP_KEY_WAIT)
+        {
+            break;
+        }
+    }
+    return count;
+}
+
+uint32_t RunChip8Frame(Chip8Scheduler *scheduler, Chip8State *state, Chip8FrameHook hook, void *context)
+{
+    uint32_t count = scheduler->timing == CHIP8_TIMING_VIP ? runVipFrame(scheduler, state, hook, context)
+                                                           : runFastFrame(scheduler, state, hook, context);
+    TickChip8Timers(state);
+    return count;
+}
+
+Chip8Timing Chip8TimingFromName(const char *name)
+{
+    if (strcmp(name, "vip") == 0)
+        return CHIP8_TIMING_VIP;
+    if (strcmp(name, "fast") == 0)
+        return CHIP8_TIMING_FAST;
+    return CHIP8_TIMING_COUNT;
+}
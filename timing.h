@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+#define CHIP8_VIP_CYCLES_PER_FRAME 3668u // 1.7609 MHz, 8 clocks a machine cycle, 60 frames a second
+#define CHIP8_VIP_DISPLAY_CYCLES 1070u   // taken each frame by the display's DMA and interrupt routine
+#define CHIP8_FAST_CHUNK 64u             // fast mode runs this many instructions between calls to the frame hook
+
+/**
+ * Timing modes
+ * VIP budgets each frame the machine cycles a COSMAC VIP had left over
+ *  from drawing the screen, charges every instruction what it cost the
+ *  VIP's interpreter, and ends the frame at a DRAW, which waited for the
+ *  next display interrupt; so ROMs run at the speed they were written
+ *  for. FAST runs a fixed number of instructions a frame, or as many as
+ *  the frame hook allows, for the most throughput; a frame that reaches
+ *  an FX0A still waiting for its key ends there rather than spinning.
+ *  Both tick the timers once a frame.
+ */
+typedef enum Chip8Timing
+{
+    CHIP8_TIMING_VIP,
+    CHIP8_TIMING_FAST,
+    CHIP8_TIMING_COUNT
+} Chip8Timing;
+
+/**
+ * Frame hook
+ * Called before each instruction (VIP) or each CHIP8_FAST_CHUNK of them
+ *  (FAST) with how much of the frame has gone, 0 to 1 (always 0 in FAST
+ *  without a fixed count), e.g. to feed in input; returns 0 to end the
+ *  frame there.
+ */
+typedef int (*Chip8FrameHook)(void *context, Chip8State *state, double done);
+
+typedef struct Chip8Scheduler
+{
+    Chip8Timing timing;
+    uint32_t instructionsPerFrame; // FAST: 0 runs until the frame hook stops it
+    int32_t cycles;                // VIP: left over from the last frame, negative if its last instruction overran
+} Chip8Scheduler;
+
+// both modes run the machine's core through RunChip8Until
+void InitChip8Scheduler(Chip8Scheduler *scheduler, Chip8Timing timing, uint32_t instructionsPerFrame);
+
+// run one 60 Hz frame and tick the timers; hook may be NULL. Returns the instructions run.
+uint32_t RunChip8Frame(Chip8Scheduler *scheduler, Chip8State *state, Chip8FrameHook hook, void *context);
+
+// what the instruction at PC would cost on the VIP, in machine cycles, given the machine as it is
+uint32_t Chip8InstructionCycles(const Chip8State *state);
+
+// look up a timing mode by name ("vip", "fast"); returns CHIP8_TIMING_COUNT if unknown
+Chip8Timing Chip8TimingFromName(const char *name);
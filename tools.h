@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Command-line tools
+ * Each takes the arguments after its name, e.g. `chip8 bench rom.ch8` calls
+ *  bench_main with argv = { "bench", "rom.ch8" }.
+ */
+
+// disassembler.c
+void disassembleChip8(uint8_t *program, int pc);
+int disassemble_main(int argc, char **argv);
+
+// bench.c
+int bench_main(int argc, char **argv);
+
+// recompiler.c
+int recompile_main(int argc, char **argv);
+
+// difftest.c
+int difftest_main(int argc, char **argv);
+
+// fuzz.c
+int fuzz_main(int argc, char **argv);
+
+// viewer.c
+int viewer_main(int argc, char **argv);
+
+// debugger.c
+int debug_main(int argc, char **argv);
+
+// explore.c
+int explore_main(int argc, char **argv);
+
+// regress.c
+int regress_main(int argc, char **argv);
@@ -0,0 +1,128 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Chip8Tracer *CreateChip8Tracer(uint32_t capacity)
+{
+    Chip8Tracer *tracer = calloc(sizeof(Chip8Tracer), 1);
+    if (!tracer)
+    {
+        return NULL;
+    }
+    tracer->capacity = 1;
+    while (tracer->capacity < capacity)
+    {
+        tracer->capacity <<= 1;
+    }
+    SDL_AtomicSet(&tracer->threads, 0);
+    tracer->start = SDL_GetPerformanceCounter();
+    return tracer;
+}
+
+void DestroyChip8Tracer(Chip8Tracer *tracer)
+{
+    if (!tracer)
+    {
+        return;
+    }
+    for (int t = 0; t < CHIP8_TRACE_MAX_THREADS; ++t)
+    {
+        free(tracer->buffers[t].events);
+    }
+    free(tracer);
+}
+
+Chip8TraceBuffer *Chip8TraceThread(Chip8Tracer *tracer, const char *name)
+{
+    if (!tracer)
+    {
+        return NULL;
+    }
+    Chip8TraceEvent *events = malloc(sizeof(Chip8TraceEvent) * tracer->capacity);
+    if (!events)
+    {
+        return NULL;
+    }
+
+    // claim a slot, then fill it in; dumps only look at buffers with events
+    int t = SDL_AtomicAdd(&tracer->threads, 1);
+    if (t >= CHIP8_TRACE_MAX_THREADS)
+    {
+        free(events);
+        return NULL;
+    }
+    Chip8TraceBuffer *buffer = &tracer->buffers[t];
+    buffer->capacity = tracer->capacity;
+    buffer->name = name;
+    SDL_AtomicSet(&buffer->written, 0);
+    SDL_AtomicSetPtr((void **)&buffer->events, events);
+    return buffer;
+}
+
+// JSON string contents; names are ours, but a thread name could be anything
+static void writeString(FILE *file, const char *s)
+{
+    for (; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', file);
+        if ((unsigned char)*s >= 0x20)
+            fputc(*s, file);
+    }
+}
+
+int DumpChip8Trace(Chip8Tracer *tracer, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    Chip8TraceEvent *copy = malloc(sizeof(Chip8TraceEvent) * tracer->capacity);
+    if (!file || !copy)
+    {
+        if (file)
+            fclose(file);
+        free(copy);
+        return 0;
+    }
+
+    double usPerCount = 1e6 / (double)SDL_GetPerformanceFrequency();
+    int threads = SDL_AtomicGet(&tracer->threads);
+    threads = threads < CHIP8_TRACE_MAX_THREADS ? threads : CHIP8_TRACE_MAX_THREADS;
+    const char *separator = "";
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int t = 0; t < threads; ++t)
+    {
+        Chip8TraceBuffer *buffer = &tracer->buffers[t];
+        if (!SDL_AtomicGetPtr((void **)&buffer->events))
+        {
+            continue; // claimed but not filled in yet
+        }
+
+        // copy the ring as it stands, then keep only what can't have been overwritten meanwhile
+        uint32_t before = (uint32_t)SDL_AtomicGet(&buffer->written);
+        uint32_t count = before < buffer->capacity ? before : buffer->capacity;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            copy[i] = buffer->events[(before - count + i) & (buffer->capacity - 1)];
+        }
+        uint32_t after = (uint32_t)SDL_AtomicGet(&buffer->written);
+        uint32_t lost = after - before; // slots the writer has been into since
+        uint32_t first = lost + 1 > buffer->capacity - count ? lost + 1 - (buffer->capacity - count) : 0;
+
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", separator, t + 1);
+        writeString(file, buffer->name);
+        fprintf(file, "\"}}");
+        separator = ",\n";
+        for (uint32_t i = first; i < count; ++i)
+        {
+            fprintf(file, ",\n{\"name\":\"");
+            writeString(file, copy[i].name);
+            fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", t + 1,
+                    (double)(int64_t)(copy[i].start - tracer->start) * usPerCount, (double)(copy[i].end - copy[i].start) * usPerCount);
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    free(copy);
+    return fclose(file) == 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <SDL/SDL.h>
+
+#include <stdint.h>
+
+#define CHIP8_TRACE_MAX_THREADS 16
+
+// a timed span; name must be a string that outlives the tracer (a literal)
+typedef struct Chip8TraceEvent
+{
+    const char *name;
+    uint64_t start; // performance counter
+    uint64_t end;
+} Chip8TraceEvent;
+
+/**
+ * Per-thread trace buffer
+ * A ring of the thread's most recent spans, written only by that thread,
+ *  so recording takes two counter reads and a store with no locking.
+ *  `written` counts every span ever recorded; a dump from another thread
+ *  reads it before and after copying and drops anything the writer could
+ *  have overwritten in between.
+ */
+typedef struct Chip8TraceBuffer
+{
+    Chip8TraceEvent *events;
+    uint32_t capacity; // a power of 2
+    SDL_atomic_t written;
+    const char *name;
+} Chip8TraceBuffer;
+
+/**
+ * Tracer
+ * Hands out a buffer per thread and writes them all out as a Chrome trace
+ *  (JSON; load it in chrome://tracing or ui.perfetto.dev). Code that may
+ *  or may not be traced holds a NULL buffer when it isn't, and then a span
+ *  costs a test and nothing else.
+ */
+typedef struct Chip8Tracer
+{
+    Chip8TraceBuffer buffers[CHIP8_TRACE_MAX_THREADS];
+    SDL_atomic_t threads;
+    uint32_t capacity;
+    uint64_t start; // performance counter when created; traces start from here
+} Chip8Tracer;
+
+// keep the last `capacity` (rounded up to a power of 2) spans of each thread; returns NULL if out of memory
+Chip8Tracer *CreateChip8Tracer(uint32_t capacity);
+void DestroyChip8Tracer(Chip8Tracer *tracer);
+
+// a buffer for the calling thread to record into; NULL if tracer is NULL, out of memory or out of threads
+Chip8TraceBuffer *Chip8TraceThread(Chip8Tracer *tracer, const char *name);
+
+// write every thread's buffered spans to a file; any thread can call it at any time. Returns 0 on failure.
+int DumpChip8Trace(Chip8Tracer *tracer, const char *path);
+
+// time a span: t = Chip8TraceBegin(buffer); ...; Chip8TraceEnd(buffer, "name", t);
+static inline uint64_t Chip8TraceBegin(const Chip8TraceBuffer *buffer)
+{
+    return buffer ? SDL_GetPerformanceCounter() : 0;
+}
+
+static inline void Chip8TraceEnd(Chip8TraceBuffer *buffer, const char *name, uint64_t start)
+{
+    if (!buffer)
+    {
+        return;
+    }
+    uint32_t written = (uint32_t)SDL_AtomicGet(&buffer->written);
+    Chip8TraceEvent *event = &buffer->events[written & (buffer->capacity - 1)];
+    event->name = name;
+    event->start = start;
+    event->end = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&buffer->written, (int)(written + 1)); // publishes the event
+}
@@ -0,0 +1,37 @@
+#include "triplebuffer.h"
+
+#include <string.h>
+
+#define TRIPLE_BUFFER_FRESH 4
+
+void InitChip8TripleBuffer(Chip8TripleBuffer *buffer)
+{
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->front = 0;
+    SDL_AtomicSet(&buffer->middle, 1);
+    buffer->back = 2;
+}
+
+void PublishChip8Frame(Chip8TripleBuffer *buffer, const Chip8State *state, uint64_t inputTime)
+{
+    Chip8Frame *frame = &buffer->frames[buffer->back];
+    memcpy(frame->display, state->display, sizeof(frame->display));
+    frame->hires = state->hires;
+    frame->number = buffer->published++;
+    frame->inputTime = inputTime;
+
+    // the old middle frame becomes our next back frame
+    buffer->back = SDL_AtomicSet(&buffer->middle, buffer->back | TRIPLE_BUFFER_FRESH) & 3;
+}
+
+const Chip8Frame *AcquireChip8Frame(Chip8TripleBuffer *buffer)
+{
+    if (!(SDL_AtomicGet(&buffer->middle) & TRIPLE_BUFFER_FRESH))
+    {
+        return NULL;
+    }
+
+    // only the writer can set the fresh bit, so this swap always takes a fresh frame
+    buffer->front = SDL_AtomicSet(&buffer->middle, buffer->front) & 3;
+    return &buffer->frames[buffer->front];
+}
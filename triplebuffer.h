@@ -0,0 +1,41 @@
+#pragma once
+
+#include <SDL/SDL.h>
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// a completed frame: everything the renderer needs from the machine
+typedef struct Chip8Frame
+{
+    Chip8Display display;
+    uint8_t hires;
+    uint32_t number; // frames published before this one
+    uint64_t inputTime; // when the oldest key press this frame is the first to show happened, 0 if none
+} Chip8Frame;
+
+/**
+ * Triple buffer
+ * The emulation thread fills the back frame and publishes it by swapping
+ *  it with the middle one; the renderer takes the middle one by swapping it
+ *  with its front frame. Neither side waits, the renderer always gets the
+ *  newest completed frame, and frames it was too slow for are skipped.
+ */
+typedef struct Chip8TripleBuffer
+{
+    Chip8Frame frames[3];
+    SDL_atomic_t middle; // index of the middle frame, | TRIPLE_BUFFER_FRESH if not yet taken
+    int back;            // only touched by the writer
+    int front;           // only touched by the reader
+    uint32_t published;
+} Chip8TripleBuffer;
+
+void InitChip8TripleBuffer(Chip8TripleBuffer *buffer);
+
+// writer: copy the machine's display into the back frame and publish it
+//  (inputTime as in Chip8Frame, for measuring input latency; 0 if unknown)
+void PublishChip8Frame(Chip8TripleBuffer *buffer, const Chip8State *state, uint64_t inputTime);
+
+// reader: the newest frame if one was published since the last call, else NULL
+const Chip8Frame *AcquireChip8Frame(Chip8TripleBuffer *buffer);
@@ -0,0 +1,218 @@
+#include <SDL/SDL.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framesrv.h"
+#include "tools.h"
+
+const uint32_t VIEWER_DEFAULT_SCALE = 2u;     // window pixels per high resolution pixel
+const uint32_t VIEWER_GAP = 2u;               // between tiles
+const uint32_t VIEWER_RECONNECT_MS = 1000u;   // how often to look for a server that isn't there
+const uint32_t VIEWER_TICKS_PER_FRAME = 1000u / 60u;
+
+//                              0xAARRGGBB
+static const uint32_t VIEWER_PALETTE[4] = {0xFF6495ED, 0xFF2051A9, 0xFFB0C8F5, 0xFF10285A}; // as the emulator draws them
+static const uint32_t VIEWER_OFFLINE = 0xFF404040; // a tile whose server isn't running
+static const uint32_t VIEWER_BACKGROUND = 0xFF000000;
+
+// one emulator being watched
+typedef struct Session
+{
+    const char *path;
+    Chip8FrameClient *client; // NULL while not connected
+    uint32_t retryAt;         // when to next try connecting
+    int dirty;                // needs drawing
+    Chip8Frame frame;
+} Session;
+
+// one session's frame at (left, top), 128x64 times scale; low resolution pixels are twice the size
+static void drawTile(SDL_Surface *surface, uint32_t left, uint32_t top, uint32_t scale, const Session *session)
+{
+    if (!session->client)
+    {
+        SDL_Rect rect = {(int)left, (int)top, (int)(HIRES_WIDTH * scale), (int)(HIRES_HEIGHT * scale)};
+        SDL_FillRect(surface, &rect, VIEWER_OFFLINE);
+        return;
+    }
+
+    const Chip8Frame *frame = &session->frame;
+    uint32_t width = frame->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+    uint32_t height = frame->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+    uint32_t size = frame->hires ? scale : scale * 2;
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        uint32_t *line = (uint32_t *)(((uint8_t *)surface->pixels) + ((top + y * size) * surface->pitch)) + left;
+        const uint64_t *plane1 = frame->display[0][y];
+        const uint64_t *plane2 = frame->display[1][y];
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            uint32_t word = x >> 6;
+            uint32_t bit = 63 - (x & 63);
+            uint32_t colour = VIEWER_PALETTE[((plane1[word] >> bit) & 1) | (((plane2[word] >> bit) & 1) << 1)];
+            for (uint32_t X = 0; X < size; ++X)
+            {
+                line[(x * size) + X] = colour;
+            }
+        }
+
+        // the rest of this pixel's rows are the same
+        for (uint32_t Y = 1; Y < size; ++Y)
+        {
+            memcpy(((uint8_t *)line) + (Y * surface->pitch), line, HIRES_WIDTH * scale * sizeof(uint32_t));
+        }
+    }
+}
+
+/**
+ * Watches emulators started with --serve, tiled in one window
+ * Sessions that aren't running (yet, or any more) show grey and are
+ *  retried every second, so the viewer can be left open while instances
+ *  come and go.
+ * usage: viewer [--scale n] <socket>...
+ */
+int viewer_main(int argc, char **argv)
+{
+    uint32_t scale = VIEWER_DEFAULT_SCALE;
+    Session *sessions = calloc(sizeof(Session), argc > 1 ? (size_t)argc : 1);
+    uint32_t count = 0;
+    if (!sessions)
+    {
+        printf("ERROR: Out of memory\n");
+        return 3;
+    }
+    for (int a = 1; a < argc; ++a)
+    {
+        if (strcmp(argv[a], "--scale") == 0 && a + 1 < argc)
+        {
+            scale = (uint32_t)atoi(argv[++a]);
+        }
+        else if (argv[a][0] != '-')
+        {
+            sessions[count++].path = argv[a];
+        }
+        else
+        {
+            count = 0;
+            break;
+        }
+    }
+    if (!count || scale < 1 || scale > 8)
+    {
+        printf("usage: viewer [--scale 1-8] <socket>...\n");
+        free(sessions);
+        return 1;
+    }
+
+    // as square a grid as fits them all
+    uint32_t columns = 1;
+    while (columns * columns < count)
+    {
+        ++columns;
+    }
+    uint32_t rows = (count + columns - 1) / columns;
+    uint32_t tileWidth = HIRES_WIDTH * scale + VIEWER_GAP;
+    uint32_t tileHeight = HIRES_HEIGHT * scale + VIEWER_GAP;
+
+    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    {
+        printf("SDL initialisation failed: %s\n", SDL_GetError());
+        free(sessions);
+        return 2;
+    }
+    SDL_Window *window = SDL_CreateWindow("Chip 8 Viewer", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                          (int)(columns * tileWidth + VIEWER_GAP), (int)(rows * tileHeight + VIEWER_GAP), 0);
+    if (!window)
+    {
+        printf("SDL failed to create window: %s\n", SDL_GetError());
+        SDL_Quit();
+        free(sessions);
+        return 2;
+    }
+    SDL_Surface *surface = SDL_GetWindowSurface(window);
+    SDL_FillRect(surface, NULL, VIEWER_BACKGROUND);
+    for (uint32_t s = 0; s < count; ++s)
+    {
+        sessions[s].dirty = 1;
+    }
+
+    int quit = 0;
+    uint32_t connected = UINT32_MAX; // shown in the title; nothing shown yet
+    uint32_t prevTime = SDL_GetTicks();
+    while (!quit)
+    {
+        SDL_Event e;
+        while (SDL_PollEvent(&e))
+        {
+            if (e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE))
+            {
+                quit = 1;
+            }
+        }
+
+        uint32_t now = SDL_GetTicks();
+        uint32_t live = 0;
+        int drawn = 0;
+        for (uint32_t s = 0; s < count; ++s)
+        {
+            Session *session = &sessions[s];
+            if (!session->client && (int32_t)(now - session->retryAt) >= 0)
+            {
+                session->client = ConnectChip8FrameServer(session->path);
+                session->retryAt = now + VIEWER_RECONNECT_MS;
+                memset(&session->frame, 0, sizeof(session->frame));
+                session->dirty |= session->client != NULL;
+            }
+            if (session->client)
+            {
+                int received = ReceiveChip8Frame(session->client, &session->frame);
+                if (received < 0)
+                {
+                    DisconnectChip8FrameServer(session->client);
+                    session->client = NULL;
+                    session->retryAt = now + VIEWER_RECONNECT_MS;
+                }
+                session->dirty |= received != 0;
+                live += session->client != NULL;
+            }
+
+            if (session->dirty)
+            {
+                drawTile(surface, VIEWER_GAP + (s % columns) * tileWidth, VIEWER_GAP + (s / columns) * tileHeight, scale, session);
+                session->dirty = 0;
+                drawn = 1;
+            }
+        }
+
+        if (drawn)
+        {
+            SDL_UpdateWindowSurface(window);
+        }
+        if (live != connected)
+        {
+            char title[64];
+            snprintf(title, sizeof(title), "Chip 8 Viewer: %u of %u running", live, count);
+            SDL_SetWindowTitle(window, title);
+            connected = live;
+        }
+
+        // time at end of frame
+        uint32_t timeDiff = (SDL_GetTicks() - prevTime);
+        if (timeDiff < VIEWER_TICKS_PER_FRAME)
+        {
+            SDL_Delay(VIEWER_TICKS_PER_FRAME - timeDiff);
+        }
+        prevTime = SDL_GetTicks();
+    }
+
+    for (uint32_t s = 0; s < count; ++s)
+    {
+        DisconnectChip8FrameServer(sessions[s].client);
+    }
+    free(sessions);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 0;
+}